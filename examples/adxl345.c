@@ -73,10 +73,39 @@
 #define ADXL345_REG_DATAZ0         0x36  // Z-axis data (LSB)
 #define ADXL345_REG_DATAZ1         0x37  // Z-axis data (MSB)
 
-uint8_t adxl345_read(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, int reg);
-void adxl345_write(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, int reg, uint8_t value);
-void adxl345_setup_double_tap(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev);
-int16_t adxl345_read_axis(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, uint8_t reg);
+static const mcupr_reg_desc_t adxl345_regs[] = {
+    { ADXL345_REG_DEVID,          1, MCUPR_REG_READ_ONLY, 0xe5 },
+    { ADXL345_REG_THRESH_TAP,     1, 0, 0x00 },
+    { ADXL345_REG_OFSX,           1, 0, 0x00 },
+    { ADXL345_REG_OFSY,           1, 0, 0x00 },
+    { ADXL345_REG_OFSZ,           1, 0, 0x00 },
+    { ADXL345_REG_DUR,            1, 0, 0x00 },
+    { ADXL345_REG_LATENT,         1, 0, 0x00 },
+    { ADXL345_REG_WINDOW,         1, 0, 0x00 },
+    { ADXL345_REG_THRESH_ACT,     1, 0, 0x00 },
+    { ADXL345_REG_THRESH_INACT,   1, 0, 0x00 },
+    { ADXL345_REG_TIME_INACT,     1, 0, 0x00 },
+    { ADXL345_REG_ACT_INACT_CTL,  1, 0, 0x00 },
+    { ADXL345_REG_THRESH_FF,      1, 0, 0x00 },
+    { ADXL345_REG_TIME_FF,        1, 0, 0x00 },
+    { ADXL345_REG_TAP_AXES,       1, 0, 0x00 },
+    { ADXL345_REG_ACT_TAP_STATUS, 1, MCUPR_REG_VOLATILE | MCUPR_REG_READ_ONLY, 0x00 },
+    { ADXL345_REG_BW_RATE,        1, 0, 0x0a },
+    { ADXL345_REG_POWER_CTL,      1, 0, 0x00 },
+    { ADXL345_REG_INT_ENABLE,     1, 0, 0x00 },
+    { ADXL345_REG_INT_MAP,        1, 0, 0x00 },
+    { ADXL345_REG_INT_SOURCE,     1, MCUPR_REG_VOLATILE | MCUPR_REG_READ_ONLY, 0x02 },
+    { ADXL345_REG_DATA_FORMAT,    1, 0, 0x00 },
+    { ADXL345_REG_DATAX0,         2, MCUPR_REG_VOLATILE | MCUPR_REG_READ_ONLY, 0x0000 },
+    { ADXL345_REG_DATAY0,         2, MCUPR_REG_VOLATILE | MCUPR_REG_READ_ONLY, 0x0000 },
+    { ADXL345_REG_DATAZ0,         2, MCUPR_REG_VOLATILE | MCUPR_REG_READ_ONLY, 0x0000 },
+    { ADXL345_REG_FIFO_CTL,       1, 0, 0x00 },
+    { ADXL345_REG_FIFO_STATUS,    1, MCUPR_REG_VOLATILE | MCUPR_REG_READ_ONLY, 0x00 },
+};
+
+uint8_t adxl345_read(mcupr_regmap_t *map, int reg);
+void adxl345_setup_double_tap(mcupr_regmap_t *map);
+void adxl345_read_axes(mcupr_regmap_t *map, int16_t *x, int16_t *y, int16_t *z);
 
 int main(int argc, char *argv[])
 {
@@ -84,6 +113,8 @@ int main(int argc, char *argv[])
     mcupr_spi_bus_t *bus;
     mcupr_spi_device_t dev;
     mcupr_spi_bus_params_t params;
+    mcupr_regmap_t *map;
+    mcupr_regmap_params_t map_params;
     int csnum = 0;
 
     printf("SPI ADXL345 Test Start\n");
@@ -100,8 +131,19 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    // Bit 7 selects read, bit 6 multi-byte access
+    mcupr_regmap_init_params(&map_params);
+    map_params.regs = adxl345_regs;
+    map_params.nregs = sizeof(adxl345_regs) / sizeof(adxl345_regs[0]);
+    map_params.read_mask = 0x80;
+    map_params.burst_mask = 0x40;
+    result = mcupr_regmap_create_spi(&map, bus, dev, &map_params);
+    if (result != MCUPR_RES_OK) {
+        exit(1);
+    }
+
     // Read the Device ID (should be 0xe5 if successful)
-    uint8_t devid = adxl345_read(bus, dev, ADXL345_REG_DEVID);
+    uint8_t devid = adxl345_read(map, ADXL345_REG_DEVID);
     if (devid != 0xe5) {
         fprintf(stderr, "Error: ADXL345 not detected! Read 0x%02x\n", devid);
         exit(1);
@@ -109,7 +151,7 @@ int main(int argc, char *argv[])
     printf("ADXL345 detected! Device ID: 0x%02x\n", devid);
 
     // Enable measurement mode
-    adxl345_setup_double_tap(bus, dev);
+    adxl345_setup_double_tap(map);
 
     printf("Reading acceleration data...\n");
     printf("Double tap to exit.\n");
@@ -120,9 +162,8 @@ int main(int argc, char *argv[])
 
     while (1) {
         // Read acceleration values
-        int16_t x = adxl345_read_axis(bus, dev, ADXL345_REG_DATAX0);
-        int16_t y = adxl345_read_axis(bus, dev, ADXL345_REG_DATAY0);
-        int16_t z = adxl345_read_axis(bus, dev, ADXL345_REG_DATAZ0);
+        int16_t x, y, z;
+        adxl345_read_axes(map, &x, &y, &z);
 
         // Check if any axis has changed significantly
         if (abs(x - prev_x) > thresh || abs(y - prev_y) > thresh || abs(z - prev_z) > thresh) {
@@ -133,7 +174,7 @@ int main(int argc, char *argv[])
         }
 
         // Read the interrupt source register
-        uint8_t int_source = adxl345_read(bus, dev, ADXL345_REG_INT_SOURCE);
+        uint8_t int_source = adxl345_read(map, ADXL345_REG_INT_SOURCE);
 
         // Check if a double tap was detected (bit 5 = 0x20)
         if (int_source & 0x20) {
@@ -144,72 +185,71 @@ int main(int argc, char *argv[])
         usleep(100000);  // Sleep for 100ms before next reading
     }
 
+    mcupr_regmap_release(map);
     mcupr_spi_close(bus, dev);
     mcupr_spi_bus_release(bus);
 
     return 0;
 }
 
-uint8_t adxl345_read(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, int reg)
+uint8_t adxl345_read(mcupr_regmap_t *map, int reg)
 {
-    int res;
-    uint8_t tx[2] = { reg | 0x80, 0x00 };
-    uint8_t rx[2] = { 0 };
+    uint32_t value;
 
-    res = mcupr_spi_transfer(bus, dev, tx, rx, 2);
-    if (res != 2) {
+    if (mcupr_regmap_read(map, reg, &value) != MCUPR_RES_OK) {
         printf("SPI transfer failed");
         return 0xFF;
     }
 
-    return rx[1];  // return the received byte
-}
-
-void adxl345_write(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, int reg, uint8_t value)
-{
-    int res;
-    uint8_t tx[2] = { reg & 0x7F, value };
-
-    res = mcupr_spi_transfer(bus, dev, tx, NULL, 2);
-    if (res != 2) {
-        printf("SPI transfer failed");
-    }
+    return (uint8_t)value;
 }
 
 // Initialize ADXL345 for double-tap detection
-void adxl345_setup_double_tap(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev)
+void adxl345_setup_double_tap(mcupr_regmap_t *map)
 {
-    // Enable measurement mode
-    adxl345_write(bus, dev, ADXL345_REG_POWER_CTL, 0x08);
-    usleep(10000);  // Wait 10ms
+    // Collect the settings in the cache and write them in bursts at once
+    mcupr_regmap_set_cache_only(map, 1);
 
-    // Verify if the setting has been applied
-    uint8_t power_ctl = adxl345_read(bus, dev, ADXL345_REG_POWER_CTL);
-    printf("Enable measurement mode: 0x%02x\n", power_ctl);
+    // Enable measurement mode
+    mcupr_regmap_write(map, ADXL345_REG_POWER_CTL, 0x08);
 
     // Set tap threshold (higher value = stronger tap required)
-    adxl345_write(bus, dev, ADXL345_REG_THRESH_TAP, 0x30);  // Example: ~3g
+    mcupr_regmap_write(map, ADXL345_REG_THRESH_TAP, 0x30);  // Example: ~3g
 
     // Set tap duration (how long acceleration must be maintained to be detected)
-    adxl345_write(bus, dev, ADXL345_REG_DUR, 0x10);  // Example: ~10ms
+    mcupr_regmap_write(map, ADXL345_REG_DUR, 0x10);  // Example: ~10ms
 
     // Set latency time between taps (time between first and second tap)
-    adxl345_write(bus, dev, ADXL345_REG_LATENT, 0x20);  // Example: ~40ms
+    mcupr_regmap_write(map, ADXL345_REG_LATENT, 0x20);  // Example: ~40ms
 
     // Set window time (max time between first and second tap)
-    adxl345_write(bus, dev, ADXL345_REG_WINDOW, 0x96);  // Example: ~150ms
+    mcupr_regmap_write(map, ADXL345_REG_WINDOW, 0x96);  // Example: ~150ms
 
     // Enable double-tap detection on all axes (X, Y, Z)
-    adxl345_write(bus, dev, ADXL345_REG_TAP_AXES, 0x07);  // 0x07 = Enable X, Y, Z
+    mcupr_regmap_write(map, ADXL345_REG_TAP_AXES, 0x07);  // 0x07 = Enable X, Y, Z
 
     // Enable double-tap interrupt
-    adxl345_write(bus, dev, ADXL345_REG_INT_ENABLE, 0x20);  // 0x20 = Enable double-tap interrupt
+    mcupr_regmap_write(map, ADXL345_REG_INT_ENABLE, 0x20);  // 0x20 = Enable double-tap interrupt
+
+    mcupr_regmap_set_cache_only(map, 0);
+    if (mcupr_regmap_sync(map) != MCUPR_RES_OK) {
+        printf("SPI transfer failed");
+    }
+
+    // The cached value, no bus access
+    uint8_t power_ctl = adxl345_read(map, ADXL345_REG_POWER_CTL);
+    printf("Enable measurement mode: 0x%02x\n", power_ctl);
 }
 
-// Reads a 16-bit signed value from two consecutive ADXL345 registers
-int16_t adxl345_read_axis(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, uint8_t reg)
+// Reads the signed 16-bit values of all axes in one burst (little-endian registers)
+void adxl345_read_axes(mcupr_regmap_t *map, int16_t *x, int16_t *y, int16_t *z)
 {
-    uint8_t low = adxl345_read(bus, dev, reg);
-    uint8_t high = adxl345_read(bus, dev, reg + 1);
-    return (int16_t)((high << 8) | low);  // Convert to signed 16-bit integer
+    uint8_t data[6] = { 0 };
+
+    if (mcupr_regmap_bulk_read(map, ADXL345_REG_DATAX0, data, sizeof(data)) != MCUPR_RES_OK) {
+        printf("SPI transfer failed");
+    }
+    *x = (int16_t)((data[1] << 8) | data[0]);
+    *y = (int16_t)((data[3] << 8) | data[2]);
+    *z = (int16_t)((data[5] << 8) | data[4]);
 }
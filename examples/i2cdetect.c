@@ -28,48 +28,59 @@
 
 #include <mcu_peripheral/mcu_peripheral.h>
 
-int main(int argc, char *argv[])
-{
-    mcupr_result_t result;
-    mcupr_i2c_bus_t *i2c_bus;
-    mcupr_i2c_device_t i2c_dev;
-    mcupr_i2c_bus_params_t i2c_bus_params;
-
-    mcupr_initialize();
+#define MAX_BUSES 16
 
-    mcupr_i2c_init_params(&i2c_bus_params);
-    result = mcupr_i2c_bus_create(&i2c_bus, &i2c_bus_params);
-    if (result != MCUPR_RES_OK) {
-        exit(1);
+static void print_bus(const mcupr_i2c_scan_result_t *result)
+{
+    printf("i2c-%d:\n", result->busnum);
+    if (result->result != MCUPR_RES_OK) {
+        printf("  %s\n", mcupr_error(result->result));
+        return;
     }
-
     printf("     0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f\n");
     for (int address = 0x00; address <= 0x7f; address++) {
         if((address & 0x0f) == 0x00) {
             printf("%02x: ", address);
         }
-        if (0x08 <= address && address <= 0x77) {
-            result = mcupr_i2c_open(i2c_bus, &i2c_dev, address);
-            if (result != MCUPR_RES_OK) {
-                printf("   ");
-            } else {
-                uint8_t tmp;
-                if (mcupr_i2c_write(i2c_bus, i2c_dev, &tmp, 0) < 0) {
-                    printf("-- ");
-                } else {
-                    printf("%02x ", address);
-                }
-            }
-            mcupr_i2c_close(i2c_bus, i2c_dev);
-        } else {
+        if (address < MCUPR_I2C_SCAN_FIRST || MCUPR_I2C_SCAN_LAST < address) {
             printf("   ");
+        } else if (MCUPR_I2C_ADDR_TEST(result->busy, address)) {
+            printf("UU ");
+        } else if (MCUPR_I2C_ADDR_TEST(result->present, address)) {
+            printf("%02x ", address);
+        } else {
+            printf("-- ");
         }
         if((address & 0x0f) == 0x0f) {
             printf("\n");
         }
     }
+}
 
-    mcupr_i2c_bus_release(i2c_bus);
+/*
+ * usage: i2cdetect [busnum...]
+ * Without arguments all I2C adapters are scanned.
+ */
+int main(int argc, char *argv[])
+{
+    mcupr_i2c_scan_result_t results[MAX_BUSES];
+    int busnums[MAX_BUSES];
+    int nbuses = 0;
+    int n;
+
+    mcupr_initialize();
+
+    for (int i = 1; i < argc && nbuses < MAX_BUSES; i++) {
+        busnums[nbuses++] = strtol(argv[i], NULL, 0);
+    }
+    n = mcupr_i2c_scan(nbuses ? busnums : NULL, nbuses, results, MAX_BUSES);
+    if (n < 0) {
+        fprintf(stderr, "scan failed, %s\n", mcupr_error(n));
+        exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+        print_bus(&results[i]);
+    }
 
     exit(0);
 }
@@ -59,10 +59,10 @@
 unsigned char tsl2561_read(mcupr_i2c_bus_t *i2c_bus, int handle, int reg)
 {
     int n;
-    unsigned char buf = TLS2561_REG_COMMAND_CMD | reg;
-    mcupr_i2c_write(i2c_bus, handle, &buf, 1);
+    unsigned char cmd = TLS2561_REG_COMMAND_CMD | reg;
+    unsigned char buf;
 
-    if (mcupr_i2c_read(i2c_bus, handle, &buf, 1) != 1) {
+    if (mcupr_i2c_write_read(i2c_bus, handle, &cmd, 1, &buf, 1) != 1) {
         return 0xff;
     }
 
@@ -104,13 +104,16 @@ int main(int argc, char *argv[])
     /* Timing Register (1h), Nominal intefration time 402ms */
     tsl2561_write(i2c_bus, i2c_dev, TLS2561_REG_TIMING, TLS2561_REG_TIMING_INTEG_402ms);
 
-    /* Read ADC Channel Data Registers */
-    unsigned char data0low = tsl2561_read(i2c_bus, i2c_dev, TLS2561_REG_DATA0LOW);
-    unsigned char data0high = tsl2561_read(i2c_bus, i2c_dev, TLS2561_REG_DATA0HIGH);
-    unsigned char data1low = tsl2561_read(i2c_bus, i2c_dev, TLS2561_REG_DATA1LOW);
-    unsigned char data1high = tsl2561_read(i2c_bus, i2c_dev, TLS2561_REG_DATA1HIGH);
-    float ch0 = (256 * data0high + data0low);
-    float ch1 = (256 * data1high + data1low);
+    /* Read ADC Channel Data Registers, low and high byte with one word read */
+    int data0 = mcupr_i2c_read_word_data(i2c_bus, i2c_dev, TLS2561_REG_COMMAND_CMD |
+                                         TLS2561_REG_COMMAND_WORD | TLS2561_REG_DATA0LOW);
+    int data1 = mcupr_i2c_read_word_data(i2c_bus, i2c_dev, TLS2561_REG_COMMAND_CMD |
+                                         TLS2561_REG_COMMAND_WORD | TLS2561_REG_DATA1LOW);
+    if (data0 < 0 || data1 < 0) {
+        exit(1);
+    }
+    float ch0 = data0;
+    float ch1 = data1;
     printf("Ch0=%.2f,  Ch1=%.2f\n", ch0, ch1);
 
     mcupr_i2c_close(i2c_bus, i2c_dev);
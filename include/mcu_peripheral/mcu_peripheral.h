@@ -55,8 +55,20 @@ typedef enum mcupr_result_e {
     MCUPR_RES_NOMEM = -10,
     MCUPR_RES_NODEV = -11,
     MCUPR_RES_IO_ERROR = -12,
+    MCUPR_RES_NOT_SUPPORTED = -13,
+    MCUPR_RES_TIMEOUT = -14,
+    MCUPR_RES_CANCELED = -15,
 } mcupr_result_t;
 
+/*
+ * Recursive lock of a bus object. All-zero is the unlocked state.
+ */
+typedef struct mcupr_lock_s {
+    uint32_t state;     /* 0: unlocked, 1: locked, 2: locked and other threads are waiting */
+    uint32_t depth;     /* nesting count of the owner */
+    uintptr_t owner;    /* thread holding the lock */
+} mcupr_lock_t;
+
 void mcupr_initialize(void);
 char *mcupr_error(int errno);
 
@@ -69,7 +81,8 @@ typedef enum {
     MCUPR_GPIO_MODE_INPUT = 0,
     MCUPR_GPIO_MODE_OUTPUT,
     MCUPR_GPIO_MODE_INPUT_PULLUP,
-    MCUPR_GPIO_MODE_INPUT_PULLDOWN
+    MCUPR_GPIO_MODE_INPUT_PULLDOWN,
+    MCUPR_GPIO_MODE_OUTPUT_OPEN_DRAIN  /* drive low, or release the line for 1 */
 } mcupr_gpio_mode_t;
 
 /* GPIO drive strength */
@@ -93,7 +106,8 @@ typedef struct mcupr_gpio_chip_s {
 }mcupr_gpio_chip_t;
 typedef int mcupr_gpio_device_t;
 typedef struct mcupr_gpio_chip_params_s {
-    int chip; /* Controller number for platforms with multiple controllers */
+    int chip; /* Controller number for platforms with multiple controllers (gpiochipN on Linux) */
+    uint32_t event_queue_size; /* Number of entries of the edge event queue */
 } mcupr_gpio_chip_params_t;
 
 void mcupr_gpio_init_params(mcupr_gpio_chip_params_t *params);
@@ -104,6 +118,7 @@ void mcupr_gpio_chip_release(mcupr_gpio_chip_t *chip);
  * Initialize a GPIO pin.
  * pin      : GPIO number (platform-dependent)
  * mode     : mcupr_gpio_mode_t
+ * Returns: MCUPR_RES_BUSY for an output mode while an interrupt is attached to the pin
  */
 mcupr_result_t mcupr_gpio_open(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t *dev, int pin,
 			       mcupr_gpio_mode_t mode);
@@ -119,7 +134,41 @@ int mcupr_gpio_read(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev);
  * Write to a GPIO pin.
  * value : 0 or 1
  */
-void mcupr_gpio_write(mcupr_gpio_chip_t *chip, int pin, mcupr_gpio_device_t dev);
+void mcupr_gpio_write(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev, int value);
+
+/*
+ * GPIO line group: several pins read or written together by one backend operation.
+ * Bit n of the value and mask words corresponds to pins[n].
+ */
+#define MCUPR_GPIO_GROUP_MAX 32
+
+typedef struct mcupr_gpio_group_s {
+    int npins;
+    int pins[MCUPR_GPIO_GROUP_MAX];
+    void *data;
+} mcupr_gpio_group_t;
+
+/*
+ * Open pins as a group.
+ * pins  : GPIO numbers, up to MCUPR_GPIO_GROUP_MAX
+ * mode  : mcupr_gpio_mode_t applied to all pins of the group
+ */
+mcupr_result_t mcupr_gpio_group_open(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t **group,
+                                     const int *pins, int npins, mcupr_gpio_mode_t mode);
+void mcupr_gpio_group_close(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t *group);
+
+/*
+ * Read all pins of a group at once.
+ * values : bit n is set if pins[n] is high
+ */
+mcupr_result_t mcupr_gpio_group_read(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t *group,
+                                     uint32_t *values);
+
+/*
+ * Write the pins selected by mask at once. Pins not in mask are left unchanged.
+ */
+mcupr_result_t mcupr_gpio_group_write(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t *group,
+                                      uint32_t mask, uint32_t values);
 
 /*
  * Set GPIO drive strength.
@@ -132,6 +181,7 @@ void mcupr_gpio_set_drive_strength(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t
  * edge      : Interrupt edge (RISING, FALLING, BOTH)
  * callback  : Function pointer invoked on interrupt
  * user_data : User data passed to the callback
+ * The callback is called from an event thread of the chip, once per detected edge.
  */
 typedef void (*mcupr_gpio_isr_t)(mcupr_gpio_chip_t *chip, int pin, void *user_data);
 
@@ -141,15 +191,99 @@ mcupr_result_t  mcupr_gpio_attach_interrupt(mcupr_gpio_chip_t *chip, int pin,
                                             void *user_data);
 
 /*
- * Disable the interrupt and detach the ISR.
+ * Disable the interrupt and detach the ISR, or stop queueing events of the pin.
+ * An opened pin returns to the mode it was opened with.
  */
 void mcupr_gpio_detach_interrupt(mcupr_gpio_chip_t *chip, int pin);
 
+/*
+ * Edge event queue.
+ * Instead of calling a handler, edges of the pin are recorded in the event queue of the chip
+ * with the timestamp taken by the kernel. The queue has one producer (the event thread of
+ * the chip) and must be drained by a single consumer thread.
+ */
+typedef struct mcupr_gpio_event_s {
+    int pin;
+    mcupr_gpio_int_edge_t edge;  /* MCUPR_GPIO_INT_RISING or MCUPR_GPIO_INT_FALLING */
+    uint32_t seqno;              /* sequence number of the event on the pin */
+    uint64_t timestamp_ns;       /* CLOCK_MONOTONIC */
+} mcupr_gpio_event_t;
+
+mcupr_result_t mcupr_gpio_attach_event(mcupr_gpio_chip_t *chip, int pin, mcupr_gpio_int_edge_t edge);
+
+/*
+ * Copy queued events.
+ * events : Buffer for the events
+ * max    : Number of entries of the buffer
+ * Returns: Number of events copied
+ */
+int mcupr_gpio_drain_events(mcupr_gpio_chip_t *chip, mcupr_gpio_event_t *events, int max);
+
+/*
+ * Returns: Number of events dropped because the queue was full since the last call
+ */
+uint32_t mcupr_gpio_event_overflows(mcupr_gpio_chip_t *chip);
+
+/*
+ * Waveform generator
+ * Plays PWM or an arbitrary pulse train on the pins of a group. The software engine runs
+ * a dedicated thread sleeping on absolute CLOCK_MONOTONIC deadlines of a precomputed edge
+ * schedule. Backends with hardware timed waveforms (pigpiod) use them instead.
+ */
+#define MCUPR_GPIO_PWM_DUTY_MAX 1000000  /* duty cycle is given in parts per million */
+
+typedef struct mcupr_gpio_pulse_s {
+    uint32_t set;       /* group bits to drive high */
+    uint32_t clear;     /* group bits to drive low */
+    uint32_t delay_ns;  /* time until the next pulse */
+} mcupr_gpio_pulse_t;
+
+typedef struct mcupr_gpio_wave_params_s {
+    int priority;       /* SCHED_FIFO priority of the engine thread, 0 for normal scheduling */
+    int cpu;            /* CPU the engine thread is pinned to, -1 for any */
+    uint32_t spin_ns;   /* busy-wait this long before each edge instead of sleeping */
+} mcupr_gpio_wave_params_t;
+
+typedef struct mcupr_gpio_wave_stats_s {
+    uint64_t edges;         /* number of scheduled writes performed */
+    uint32_t max_jitter_ns; /* largest delay from a scheduled edge to the write */
+    uint32_t avg_jitter_ns;
+} mcupr_gpio_wave_stats_t;
+
+typedef struct mcupr_gpio_wave_s {
+    mcupr_gpio_chip_t *chip;
+    mcupr_gpio_group_t *group;
+    void *data;
+} mcupr_gpio_wave_t;
+
+void mcupr_gpio_wave_init_params(mcupr_gpio_wave_params_t *params);
+mcupr_result_t mcupr_gpio_wave_create(mcupr_gpio_wave_t **wave, mcupr_gpio_chip_t *chip,
+                                      mcupr_gpio_group_t *group,
+                                      const mcupr_gpio_wave_params_t *params);
+void mcupr_gpio_wave_release(mcupr_gpio_wave_t *wave);
+
+/*
+ * Start PWM on all pins of the group with a common frequency.
+ * duty : duty cycle of each pin of the group, 0 to MCUPR_GPIO_PWM_DUTY_MAX
+ */
+mcupr_result_t mcupr_gpio_wave_pwm(mcupr_gpio_wave_t *wave, uint32_t frequency, const uint32_t *duty);
+
+/*
+ * Start a pulse train.
+ * repeat : 0 to play once, 1 to play repeatedly until stopped
+ */
+mcupr_result_t mcupr_gpio_wave_pulses(mcupr_gpio_wave_t *wave, const mcupr_gpio_pulse_t *pulses,
+                                      int npulses, int repeat);
+void mcupr_gpio_wave_stop(mcupr_gpio_wave_t *wave);
+mcupr_result_t mcupr_gpio_wave_get_stats(mcupr_gpio_wave_t *wave, mcupr_gpio_wave_stats_t *stats);
+
 /* =================================================================================================
  * I2C Section
  */
 
 typedef struct mcupr_i2c_bus_s {
+    const struct mcupr_i2c_ops_s *ops;
+    mcupr_lock_t lock;
     void *data;
 } mcupr_i2c_bus_t;
 typedef int mcupr_i2c_device_t;
@@ -162,6 +296,13 @@ void mcupr_i2c_init_params(mcupr_i2c_bus_params_t *params);
 mcupr_result_t mcupr_i2c_bus_create(mcupr_i2c_bus_t **bus, const mcupr_i2c_bus_params_t *params);
 void mcupr_i2c_bus_release(mcupr_i2c_bus_t *bus);
 
+/*
+ * All calls on a bus are serialized by a lock of the bus. Hold the lock to run a sequence of
+ * calls without other threads coming in between. Locks nest within the same thread.
+ */
+void mcupr_i2c_lock(mcupr_i2c_bus_t *bus);
+void mcupr_i2c_unlock(mcupr_i2c_bus_t *bus);
+
 /*
  * Initialize I2C.
  * bus     : I2C bus
@@ -186,6 +327,76 @@ int mcupr_i2c_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t *data,
  */
 int mcupr_i2c_write(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, const uint8_t *data, uint32_t length);
 
+/*
+ * I2C write then read as one transaction, with a repeated start instead of a stop between
+ * the two (typically a register address is written and the register is read).
+ * wdata  : Data to write
+ * wlength: Number of bytes to write
+ * rdata  : Buffer for incoming data
+ * rlength: Number of bytes to read
+ * Returns: Number of bytes actually read
+ */
+int mcupr_i2c_write_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                         const uint8_t *wdata, uint32_t wlength, uint8_t *rdata, uint32_t rlength);
+
+/*
+ * I2C message for mcupr_i2c_transfer()
+ */
+#define MCUPR_I2C_M_RD         0x0001  /* read from the slave */
+#define MCUPR_I2C_M_NOSTART    0x0002  /* continue the previous message without start and address */
+#define MCUPR_I2C_M_IGNORE_NAK 0x0004  /* go on even if a byte is not acknowledged */
+#define MCUPR_I2C_M_STOP       0x0008  /* end the transaction after this message */
+
+typedef struct mcupr_i2c_msg_s {
+    uint16_t addr;    /* I2C address (7-bit) */
+    uint16_t flags;   /* MCUPR_I2C_M_* */
+    uint32_t length;
+    uint8_t *data;
+} mcupr_i2c_msg_t;
+
+/*
+ * Transfer messages to one or more devices as one transaction. Each message begins with a
+ * (repeated) start unless MCUPR_I2C_M_NOSTART is given, and a stop ends the last one.
+ * MCUPR_I2C_M_STOP ends a transaction early, so that a batch of transactions can be passed
+ * in one call. Backends with a limit on the number of messages per transaction split the array.
+ * Returns: Number of messages transferred
+ */
+int mcupr_i2c_transfer(mcupr_i2c_bus_t *bus, const mcupr_i2c_msg_t *msgs, int n);
+
+/*
+ * SMBus style register access. Each call is one transaction: the register number is written
+ * and, for reads, the data is read after a repeated start. Words are little endian.
+ * Read functions return the value or the number of bytes read, or a negative mcupr_result_t.
+ */
+#define MCUPR_I2C_SMBUS_BLOCK_MAX 32
+
+int mcupr_i2c_read_byte_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t reg);
+mcupr_result_t mcupr_i2c_write_byte_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                         uint8_t reg, uint8_t value);
+int mcupr_i2c_read_word_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t reg);
+mcupr_result_t mcupr_i2c_write_word_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                         uint8_t reg, uint16_t value);
+
+/*
+ * SMBus block transfer: the device sends (or is sent) a byte count before the data.
+ * data   : Buffer of MCUPR_I2C_SMBUS_BLOCK_MAX bytes for reads
+ * Buses without SMBus block reads fetch the count and then the block in two transactions, the
+ * read fails with MCUPR_RES_COMMUNICATION_ERROR if the count changes in between.
+ */
+int mcupr_i2c_read_block_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t reg,
+                              uint8_t *data);
+mcupr_result_t mcupr_i2c_write_block_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                          uint8_t reg, const uint8_t *data, uint32_t length);
+
+/*
+ * I2C block transfer: length bytes from consecutive registers, without a byte count.
+ * length : up to MCUPR_I2C_SMBUS_BLOCK_MAX
+ */
+int mcupr_i2c_read_i2c_block_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t reg,
+                                  uint8_t *data, uint32_t length);
+mcupr_result_t mcupr_i2c_write_i2c_block_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                              uint8_t reg, const uint8_t *data, uint32_t length);
+
 /*
  * Dynamically set I2C clock frequency (if platform supports it).
  */
@@ -197,6 +408,35 @@ mcupr_result_t mcupr_i2c_set_freq(mcupr_i2c_bus_t *bus, uint32_t freq);
  */
 mcupr_result_t mcupr_i2c_set_clock_stretch(mcupr_i2c_bus_t *bus, int enable);
 
+/*
+ * Device discovery
+ * Addresses 0x08 to 0x77 are probed with SMBus quick write, except 0x30-0x37 and 0x50-0x5f
+ * which are probed with read byte because a quick write can lock some EEPROMs.
+ */
+#define MCUPR_I2C_SCAN_FIRST 0x08
+#define MCUPR_I2C_SCAN_LAST  0x77
+#define MCUPR_I2C_ADDR_TEST(bitmap, addr) (((bitmap)[(addr) >> 3] >> ((addr) & 7)) & 1)
+
+typedef struct mcupr_i2c_scan_result_s {
+    int busnum;
+    mcupr_result_t result;  /* MCUPR_RES_OK if the bus was scanned */
+    uint8_t present[16];    /* addresses which acknowledged, test with MCUPR_I2C_ADDR_TEST() */
+    uint8_t busy[16];       /* addresses claimed by a kernel driver, not probed */
+} mcupr_i2c_scan_result_t;
+
+/*
+ * Scan one bus.
+ */
+mcupr_result_t mcupr_i2c_scan_bus(mcupr_i2c_bus_t *bus, mcupr_i2c_scan_result_t *result);
+
+/*
+ * Scan several buses concurrently, one thread per bus.
+ * busnums : bus numbers to scan, NULL to scan all adapters
+ * results : one entry per bus, in the order of busnums or by bus number
+ * Returns: Number of entries filled in results
+ */
+int mcupr_i2c_scan(const int *busnums, int nbuses, mcupr_i2c_scan_result_t *results, int max);
+
 /* =================================================================================================
  * SPI Section
  */
@@ -215,6 +455,8 @@ typedef struct mcupr_spi_bus_params_s {
     mcupr_spi_mode_t mode;
 } mcupr_spi_bus_params_t;
 typedef struct mcupr_spi_bus_s  {
+    const struct mcupr_spi_ops_s *ops;
+    mcupr_lock_t lock;
     mcupr_spi_bus_params_t params;
     void *data;
 } mcupr_spi_bus_t;
@@ -224,28 +466,424 @@ void mcupr_spi_init_params(mcupr_spi_bus_params_t *params);
 mcupr_result_t mcupr_spi_bus_create(mcupr_spi_bus_t **bus, mcupr_spi_bus_params_t *params);
 void mcupr_spi_bus_release(mcupr_spi_bus_t *bus);
 
+/*
+ * Hold the lock of the bus across a sequence of calls, see mcupr_i2c_lock().
+ */
+void mcupr_spi_lock(mcupr_spi_bus_t *bus);
+void mcupr_spi_unlock(mcupr_spi_bus_t *bus);
+
 mcupr_result_t mcupr_spi_open(mcupr_spi_bus_t *bus, mcupr_spi_device_t *dev, int csnum);
 void mcupr_spi_close(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev);
 
 /*
  * SPI transfer (full-duplex).
  * tx_data, rx_data: TX/RX buffers (rx_data can be NULL if TX-only)
- * length          : Number of bytes
+ * length          : Number of bytes, transfers larger than the buffer of the driver are split
+ *                   into chunks with the device kept selected where the backend allows
  * Returns         : Number of bytes actually transferred
  */
 int mcupr_spi_transfer(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
                        const uint8_t *tx_data, uint8_t *rx_data, int length);
 
+/*
+ * SPI transfer of 16-bit or 32-bit words in host byte order, sent most significant bit first.
+ * bits   : bits per word, up to the size of the word, e.g. 12 for a 12-bit ADC
+ * count  : Number of words
+ * Backends which can't change the word size clock whole words out as bytes, then bits must be
+ * 16 or 32; on little-endian hosts the words are byte swapped in rx_data, or without rx_data
+ * in tx_data for the duration of the transfer, so tx_data must be writable.
+ * Returns: Number of words transferred
+ */
+int mcupr_spi_transfer16(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                         const uint16_t *tx_data, uint16_t *rx_data, int count, int bits);
+int mcupr_spi_transfer32(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                         const uint32_t *tx_data, uint32_t *rx_data, int count, int bits);
+
+/*
+ * SPI message segment for mcupr_spi_message()
+ */
+typedef struct mcupr_spi_segment_s {
+    const uint8_t *tx_data;  /* NULL to send zeros */
+    uint8_t *rx_data;        /* NULL if the received data is not needed */
+    uint32_t length;
+    uint32_t speed_hz;       /* 0 for the speed of the device */
+    uint16_t delay_usecs;    /* delay after the segment */
+    uint8_t bits_per_word;   /* 0 for the word size of the device */
+    uint8_t cs_change;       /* deselect the device between this segment and the next */
+} mcupr_spi_segment_t;
+
+/*
+ * Transfer segments as one message, keeping the device selected from the first segment to
+ * the last unless cs_change is set. Buffers of the segments are used in place.
+ * Backends without native support send the segments between cs_change points as one transfer
+ * through a bounce buffer; speed_hz and bits_per_word are not supported there.
+ * Returns: Number of bytes transferred
+ */
+int mcupr_spi_message(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                      const mcupr_spi_segment_t *segs, int n);
+
+/*
+ * Streaming transfer of length bytes in chunks with the device kept selected where the backend
+ * allows. fill is called to prepare the data to send of a chunk and drain to consume the data
+ * received, on the calling thread while the previous chunk is on the wire where the backend
+ * supports double buffering. The callbacks return 0 to go on or a negative value to abort
+ * the stream with that value.
+ * fill  : NULL to send zeros
+ * drain : NULL if the received data is not needed
+ * Returns: Number of bytes transferred
+ */
+typedef int (*mcupr_spi_fill_t)(void *user_data, uint8_t *tx_data, uint32_t offset,
+                                uint32_t length);
+typedef int (*mcupr_spi_drain_t)(void *user_data, const uint8_t *rx_data, uint32_t offset,
+                                 uint32_t length);
+
+int mcupr_spi_stream(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, uint32_t length,
+                     mcupr_spi_fill_t fill, mcupr_spi_drain_t drain, void *user_data);
+
 /*
  * Dynamically set SPI clock speed (if platform supports it).
+ * The speed applies to devices without their own configuration.
  */
 mcupr_result_t mcupr_spi_set_speed(mcupr_spi_bus_t *bus, uint32_t speed);
 
 /*
  * Dynamically set SPI mode (if platform supports it).
+ * The mode applies to devices without their own configuration.
  */
 mcupr_result_t mcupr_spi_set_mode(mcupr_spi_bus_t *bus, mcupr_spi_mode_t mode);
 
+/*
+ * Per-device configuration, for devices with different modes or clocks on one bus.
+ * The settings are applied on the next transfer to the device, and only those which differ from
+ * the last ones applied cost a driver call.
+ * config : NULL to follow the speed and mode of the bus again
+ */
+typedef struct mcupr_spi_config_s {
+    uint32_t speed;          /* 0 for the speed of the bus */
+    mcupr_spi_mode_t mode;
+    uint8_t bits_per_word;   /* 0 for 8 */
+} mcupr_spi_config_t;
+
+mcupr_result_t mcupr_spi_configure(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                                   const mcupr_spi_config_t *config);
+
+/*
+ * Register access of an SPI device. The address is sent most significant byte first with the
+ * masks OR'ed into it, followed by dummy bytes for reads and then the data. A block at
+ * consecutive addresses is one transfer. Blocks which fit in 64 bytes together with the address
+ * and dummy bytes go through a buffer on the stack. Larger ones are sent with
+ * mcupr_spi_message(), which uses the data in place on linuxdev; the other backends copy it
+ * through a bounce buffer on the heap.
+ */
+typedef struct mcupr_spi_regdev_s {
+    mcupr_spi_bus_t *bus;
+    mcupr_spi_device_t dev;
+    uint8_t addr_width;   /* bytes of the register address, 1 to 4 */
+    uint8_t dummy;        /* dummy bytes between the address and the data of reads */
+    uint32_t read_mask;   /* e.g. 0x80 for most devices with 8-bit addresses */
+    uint32_t write_mask;
+    uint32_t burst_mask;  /* OR'ed into the address of multi-byte accesses (auto increment) */
+} mcupr_spi_regdev_t;
+
+mcupr_result_t mcupr_spi_reg_read(const mcupr_spi_regdev_t *rd, uint32_t reg, uint8_t *data,
+                                  uint32_t length);
+mcupr_result_t mcupr_spi_reg_write(const mcupr_spi_regdev_t *rd, uint32_t reg,
+                                   const uint8_t *data, uint32_t length);
+
+/*
+ * Sampling engine
+ * Runs conversions of an SPI device, e.g. an ADC, at a fixed rate. A dedicated thread sleeps
+ * on absolute CLOCK_MONOTONIC deadlines and sends batch conversions per deadline as one
+ * message, the device being deselected between conversions. The received data goes straight
+ * into a set of buffers, which the consumer takes and puts back without copying. When no buffer
+ * is free, the engine overwrites the oldest full one which the consumer hasn't taken, or drops
+ * batches until a buffer is put back, and counts the lost batches as overruns.
+ */
+typedef struct mcupr_spi_sampler_params_s {
+    uint32_t rate;          /* conversions per second */
+    uint32_t batch;         /* conversions per message, sent back to back at each deadline */
+    uint32_t count;         /* conversions per buffer, a multiple of batch */
+    uint32_t nbuffers;      /* 2 to MCUPR_SPI_SAMPLER_MAX_BUFFERS */
+    const uint8_t *tx_data; /* command of one conversion, NULL to send zeros */
+    uint32_t length;        /* bytes of one conversion */
+    uint16_t spacing_us;    /* delay between the conversions of a batch */
+    int priority;           /* SCHED_FIFO priority of the engine thread, 0 for normal scheduling */
+    int cpu;                /* CPU the engine thread is pinned to, -1 for any */
+} mcupr_spi_sampler_params_t;
+
+#define MCUPR_SPI_SAMPLER_MAX_BUFFERS 8
+
+typedef struct mcupr_spi_sampler_buffer_s {
+    const uint8_t *data;    /* count conversions of length bytes */
+    uint32_t count;
+    uint32_t seqno;         /* sequence number of the buffer, a gap means an overrun */
+    uint64_t timestamp_ns;  /* CLOCK_MONOTONIC start of the first conversion */
+    int index;              /* private to the engine */
+} mcupr_spi_sampler_buffer_t;
+
+typedef struct mcupr_spi_sampler_stats_s {
+    uint64_t samples;       /* conversions done */
+    uint32_t overruns;      /* batches lost because the consumer didn't put buffers back in time */
+    uint32_t missed;        /* deadlines skipped because the engine fell behind */
+    uint32_t errors;        /* failed transfers */
+    uint32_t max_jitter_ns; /* largest delay from a deadline to the start of its batch */
+    uint32_t avg_jitter_ns;
+} mcupr_spi_sampler_stats_t;
+
+typedef struct mcupr_spi_sampler_s {
+    mcupr_spi_bus_t *bus;
+    mcupr_spi_device_t dev;
+    void *data;
+} mcupr_spi_sampler_t;
+
+void mcupr_spi_sampler_init_params(mcupr_spi_sampler_params_t *params);
+mcupr_result_t mcupr_spi_sampler_create(mcupr_spi_sampler_t **sampler, mcupr_spi_bus_t *bus,
+                                        mcupr_spi_device_t dev,
+                                        const mcupr_spi_sampler_params_t *params);
+void mcupr_spi_sampler_release(mcupr_spi_sampler_t *sampler);
+
+/*
+ * Start sampling on a fresh schedule, or stop after the batch in progress. Full buffers stay
+ * available to the consumer after a stop.
+ */
+mcupr_result_t mcupr_spi_sampler_start(mcupr_spi_sampler_t *sampler);
+void mcupr_spi_sampler_stop(mcupr_spi_sampler_t *sampler);
+
+/*
+ * Take the oldest full buffer. It belongs to the consumer until it is put back.
+ * timeout_ms : -1 to wait forever, 0 to poll
+ * Returns: MCUPR_RES_TIMEOUT if no buffer was filled in time
+ */
+mcupr_result_t mcupr_spi_sampler_get(mcupr_spi_sampler_t *sampler,
+                                     mcupr_spi_sampler_buffer_t *buffer, int timeout_ms);
+void mcupr_spi_sampler_put(mcupr_spi_sampler_t *sampler, mcupr_spi_sampler_buffer_t *buffer);
+mcupr_result_t mcupr_spi_sampler_get_stats(mcupr_spi_sampler_t *sampler,
+                                           mcupr_spi_sampler_stats_t *stats);
+
+/* =================================================================================================
+ * Bit-bang Section
+ *
+ * Software I2C and SPI buses on GPIO lines of a chip. The buses are used with the usual
+ * mcupr_i2c_* and mcupr_spi_* functions and released with mcupr_i2c_bus_release() or
+ * mcupr_spi_bus_release(). The GPIO chip must outlive the bus.
+ */
+
+#define MCUPR_SPI_BITBANG_MAX_CS 4
+
+typedef struct mcupr_i2c_bitbang_params_s {
+    int scl;
+    int sda;
+    uint32_t freq;               /* target SCL frequency */
+    uint32_t stretch_timeout_us; /* how long a slave may hold SCL low, 0 to not check SCL */
+} mcupr_i2c_bitbang_params_t;
+
+typedef struct mcupr_spi_bitbang_params_s {
+    int sclk;
+    int mosi;
+    int miso;                    /* -1 if not connected */
+    int cs[MCUPR_SPI_BITBANG_MAX_CS];  /* chip select pins (active low) selected by csnum */
+    int ncs;
+    uint32_t speed;              /* target SCLK frequency */
+    mcupr_spi_mode_t mode;
+} mcupr_spi_bitbang_params_t;
+
+typedef struct mcupr_bitbang_stats_s {
+    uint64_t bytes;     /* bytes shifted, including addresses */
+    uint64_t busy_ns;   /* time spent in transfers */
+    uint32_t bit_rate;  /* achieved bits per second */
+} mcupr_bitbang_stats_t;
+
+void mcupr_i2c_bitbang_init_params(mcupr_i2c_bitbang_params_t *params);
+mcupr_result_t mcupr_i2c_bitbang_create(mcupr_i2c_bus_t **bus, mcupr_gpio_chip_t *chip,
+                                        const mcupr_i2c_bitbang_params_t *params);
+mcupr_result_t mcupr_i2c_bitbang_get_stats(mcupr_i2c_bus_t *bus, mcupr_bitbang_stats_t *stats);
+
+void mcupr_spi_bitbang_init_params(mcupr_spi_bitbang_params_t *params);
+mcupr_result_t mcupr_spi_bitbang_create(mcupr_spi_bus_t **bus, mcupr_gpio_chip_t *chip,
+                                        const mcupr_spi_bitbang_params_t *params);
+mcupr_result_t mcupr_spi_bitbang_get_stats(mcupr_spi_bus_t *bus, mcupr_bitbang_stats_t *stats);
+
+/* =================================================================================================
+ * Register Map Section
+ *
+ * Cached register access for a device on an I2C or SPI bus. Registers are described by a
+ * table. Non-volatile registers are read from the bus once and served from the cache after
+ * that, and writes of an unchanged value never reach the bus. In cache-only mode writes are
+ * only recorded, and mcupr_regmap_sync() flushes all dirty registers, merging registers at
+ * consecutive addresses into burst writes.
+ */
+
+#define MCUPR_REG_VOLATILE   0x01  /* changed by the device, never cached */
+#define MCUPR_REG_READ_ONLY  0x02
+#define MCUPR_REG_WRITE_ONLY 0x04  /* reads are served from the cache only */
+
+typedef struct mcupr_reg_desc_s {
+    uint8_t reg;        /* register address, a register occupies addresses reg to reg + width - 1 */
+    uint8_t width;      /* size in bytes, 1 to 4 */
+    uint8_t flags;      /* MCUPR_REG_* */
+    uint32_t def;       /* value after reset */
+} mcupr_reg_desc_t;
+
+typedef struct mcupr_regmap_params_s {
+    const mcupr_reg_desc_t *regs;
+    int nregs;
+    int big_endian;     /* byte order of multi-byte registers on the bus */
+    int use_defaults;   /* the device was just reset, preload the cache with the defaults */
+    uint8_t read_mask;  /* OR'ed into the register address of reads, e.g. 0x80 for most SPI devices */
+    uint8_t write_mask; /* OR'ed into the register address of writes */
+    uint8_t burst_mask; /* OR'ed into the register address of multi-byte accesses */
+    uint8_t spi_dummy;  /* dummy bytes between the address and the data of SPI reads */
+} mcupr_regmap_params_t;
+
+typedef struct mcupr_regmap_stats_s {
+    uint32_t cache_hits;     /* reads served from the cache */
+    uint32_t bus_reads;      /* register reads which went to the bus */
+    uint32_t bus_writes;     /* bus write transactions, a burst counts as one */
+    uint32_t skipped_writes; /* writes dropped because the value was unchanged */
+} mcupr_regmap_stats_t;
+
+typedef struct mcupr_regmap_s {
+    mcupr_i2c_bus_t *i2c_bus;
+    mcupr_spi_bus_t *spi_bus;
+    int dev;
+    int address;        /* slave address on an I2C bus */
+    void *data;
+} mcupr_regmap_t;
+
+void mcupr_regmap_init_params(mcupr_regmap_params_t *params);
+/*
+ * The I2C map opens the device at address itself and closes it on release.
+ * Bursts rely on the device auto-incrementing the register address.
+ */
+mcupr_result_t mcupr_regmap_create_i2c(mcupr_regmap_t **map, mcupr_i2c_bus_t *bus, int address,
+                                       const mcupr_regmap_params_t *params);
+mcupr_result_t mcupr_regmap_create_spi(mcupr_regmap_t **map, mcupr_spi_bus_t *bus,
+                                       mcupr_spi_device_t dev, const mcupr_regmap_params_t *params);
+void mcupr_regmap_release(mcupr_regmap_t *map);
+
+mcupr_result_t mcupr_regmap_read(mcupr_regmap_t *map, uint8_t reg, uint32_t *value);
+mcupr_result_t mcupr_regmap_write(mcupr_regmap_t *map, uint8_t reg, uint32_t value);
+
+/*
+ * Replace the bits of mask with value, the register is written only if it changes.
+ */
+mcupr_result_t mcupr_regmap_update_bits(mcupr_regmap_t *map, uint8_t reg, uint32_t mask,
+                                        uint32_t value);
+
+/*
+ * Read length bytes starting at reg straight from the bus, e.g. for sample data.
+ */
+mcupr_result_t mcupr_regmap_bulk_read(mcupr_regmap_t *map, uint8_t reg, uint8_t *data,
+                                      uint32_t length);
+
+/*
+ * In cache-only mode writes only update the cache and mark the registers dirty. Writes of
+ * volatile registers fail with MCUPR_RES_BUSY while it is enabled.
+ */
+void mcupr_regmap_set_cache_only(mcupr_regmap_t *map, int enable);
+
+/*
+ * Write all dirty registers to the device.
+ */
+mcupr_result_t mcupr_regmap_sync(mcupr_regmap_t *map);
+
+/*
+ * Forget all cached values, e.g. after the device was reset or lost power.
+ */
+void mcupr_regmap_invalidate(mcupr_regmap_t *map);
+
+mcupr_result_t mcupr_regmap_get_stats(mcupr_regmap_t *map, mcupr_regmap_stats_t *stats);
+
+/* =================================================================================================
+ * Async Section
+ *
+ * Transfers submitted to a queue are run in FIFO order by a worker thread of the queue, so that
+ * one application thread can keep several buses busy. A transfer is described by a caller owned
+ * mcupr_xfer_t which must be zeroed before its first submit, e.g. with = { 0 }, and stay valid
+ * until it completes. Completion is signalled by the optional
+ * callback, which runs on the worker thread, and by the mcupr_xfer_wait*() functions. A transfer
+ * counts as done for the wait functions before its callback is called, so the callback may
+ * submit it again.
+ */
+
+typedef enum {
+    MCUPR_XFER_I2C_READ = 0,     /* rdata, rlength */
+    MCUPR_XFER_I2C_WRITE,        /* wdata, wlength */
+    MCUPR_XFER_I2C_WRITE_READ,   /* wdata, wlength, rdata, rlength */
+    MCUPR_XFER_I2C_TRANSFER,     /* msgs, nmsgs, dev is not used */
+    MCUPR_XFER_SPI_TRANSFER,     /* wdata, rdata, wlength */
+} mcupr_xfer_type_t;
+
+typedef struct mcupr_xfer_s mcupr_xfer_t;
+typedef void (*mcupr_xfer_callback_t)(mcupr_xfer_t *xfer, void *user_data);
+
+struct mcupr_xfer_s {
+    mcupr_xfer_type_t type;
+    int dev;                     /* mcupr_i2c_device_t or mcupr_spi_device_t */
+    const uint8_t *wdata;
+    uint32_t wlength;
+    uint8_t *rdata;
+    uint32_t rlength;
+    const mcupr_i2c_msg_t *msgs;
+    int nmsgs;
+    mcupr_xfer_callback_t callback;  /* NULL for none */
+    void *user_data;
+    int result;                  /* return value of the bus function, MCUPR_RES_CANCELED if canceled */
+
+    /* private to the queue, zero before the first submit */
+    int state;
+    struct mcupr_xfer_s *next;
+};
+
+typedef struct mcupr_queue_params_s {
+    uint32_t depth;     /* number of transfers which may be queued or running */
+    int nonblock;       /* fail with MCUPR_RES_BUSY instead of waiting when the queue is full */
+} mcupr_queue_params_t;
+
+typedef struct mcupr_queue_s {
+    mcupr_i2c_bus_t *i2c_bus;
+    mcupr_spi_bus_t *spi_bus;
+    void *data;
+} mcupr_queue_t;
+
+void mcupr_queue_init_params(mcupr_queue_params_t *params);
+mcupr_result_t mcupr_queue_create_i2c(mcupr_queue_t **queue, mcupr_i2c_bus_t *bus,
+                                      const mcupr_queue_params_t *params);
+mcupr_result_t mcupr_queue_create_spi(mcupr_queue_t **queue, mcupr_spi_bus_t *bus,
+                                      const mcupr_queue_params_t *params);
+
+/*
+ * Stop the worker. Transfers still pending are completed with MCUPR_RES_CANCELED.
+ */
+void mcupr_queue_release(mcupr_queue_t *queue);
+
+/*
+ * Append a transfer to the queue. Waits while depth transfers are queued or running, except
+ * when called from a callback of the same queue, which can't wait for its own worker.
+ * Returns: MCUPR_RES_BUSY if the transfer is still queued or running, or if the queue is full
+ *          and either nonblock is set or the caller is the worker of the queue
+ */
+mcupr_result_t mcupr_queue_submit(mcupr_queue_t *queue, mcupr_xfer_t *xfer);
+
+/*
+ * Remove a pending transfer and complete it with MCUPR_RES_CANCELED.
+ * Returns: MCUPR_RES_BUSY if the transfer is already running or done
+ */
+mcupr_result_t mcupr_queue_cancel(mcupr_queue_t *queue, mcupr_xfer_t *xfer);
+
+/*
+ * Wait for completion of transfers, which may belong to different queues.
+ * timeout_ms : -1 to wait forever, 0 to poll
+ * Returns: MCUPR_RES_TIMEOUT if the transfers didn't complete in time
+ */
+mcupr_result_t mcupr_xfer_wait(mcupr_xfer_t *xfer, int timeout_ms);
+mcupr_result_t mcupr_xfer_wait_all(mcupr_xfer_t **xfers, int n, int timeout_ms);
+
+/*
+ * Returns: index of a completed transfer, or MCUPR_RES_TIMEOUT
+ */
+int mcupr_xfer_wait_any(mcupr_xfer_t **xfers, int n, int timeout_ms);
+
 #ifdef __cplusplus
 }
 #endif
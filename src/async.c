@@ -0,0 +1,426 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 hanyazou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "utils.h"
+#include "impl.h"
+#include <mcu_peripheral/mcu_peripheral.h>
+#include <mcu_peripheral/log.h>
+
+/*
+ * Async transfer queue
+ * Each queue has a worker thread which owns the bus while the queue exists. Completions of all
+ * queues are announced on one process wide condition so that a thread can wait for transfers
+ * on several buses at once. If the bus has the batch operation, the worker hands it all the
+ * pending transfers at once so that a remote backend can pipeline them.
+ */
+
+#define ASYNC_BATCH_MAX 16
+
+enum {
+    ASYNC_XFER_IDLE = 0,
+    ASYNC_XFER_QUEUED,
+    ASYNC_XFER_RUNNING,
+    ASYNC_XFER_DONE,
+};
+
+struct async_queue_data {
+    mcupr_queue_params_t params;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    mcupr_xfer_t *head;
+    mcupr_xfer_t *tail;
+    uint32_t count;    /* transfers queued or running, bounded by depth */
+    int exiting;
+};
+
+static pthread_once_t async_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t async_done_lock;
+static pthread_cond_t async_done_cond;
+
+static void async_init_once(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(&async_done_lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&async_done_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/*
+ * The transfer is marked done before the callback runs, so that the callback can submit it
+ * again without its new state being overwritten afterwards.
+ */
+static void async_complete(mcupr_xfer_t *xfer, int result)
+{
+    mcupr_xfer_callback_t callback = xfer->callback;
+    void *user_data = xfer->user_data;
+
+    xfer->result = result;
+    pthread_mutex_lock(&async_done_lock);
+    __atomic_store_n(&xfer->state, ASYNC_XFER_DONE, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&async_done_cond);
+    pthread_mutex_unlock(&async_done_lock);
+    if (callback != NULL) {
+        (*callback)(xfer, user_data);
+    }
+}
+
+static int async_run(mcupr_queue_t *queue, mcupr_xfer_t *xfer)
+{
+    switch (xfer->type) {
+    case MCUPR_XFER_I2C_READ:
+        return mcupr_i2c_read(queue->i2c_bus, xfer->dev, xfer->rdata, xfer->rlength);
+    case MCUPR_XFER_I2C_WRITE:
+        return mcupr_i2c_write(queue->i2c_bus, xfer->dev, xfer->wdata, xfer->wlength);
+    case MCUPR_XFER_I2C_WRITE_READ:
+        return mcupr_i2c_write_read(queue->i2c_bus, xfer->dev, xfer->wdata, xfer->wlength,
+                                    xfer->rdata, xfer->rlength);
+    case MCUPR_XFER_I2C_TRANSFER:
+        return mcupr_i2c_transfer(queue->i2c_bus, xfer->msgs, xfer->nmsgs);
+    case MCUPR_XFER_SPI_TRANSFER:
+        return mcupr_spi_transfer(queue->spi_bus, xfer->dev, xfer->wdata, xfer->rdata,
+                                  xfer->wlength);
+    }
+    return MCUPR_RES_INVALID_ARGUMENT;
+}
+
+/* run transfers with the batch operation of the bus, returns 0 if the bus has none */
+static int async_run_batch(mcupr_queue_t *queue, mcupr_xfer_t **xfers, int n)
+{
+    if (queue->i2c_bus != NULL && queue->i2c_bus->ops->batch != NULL) {
+        mcupr_i2c_lock(queue->i2c_bus);
+        (*queue->i2c_bus->ops->batch)(queue->i2c_bus, xfers, n);
+        mcupr_i2c_unlock(queue->i2c_bus);
+        return 1;
+    }
+    if (queue->spi_bus != NULL && queue->spi_bus->ops->batch != NULL) {
+        mcupr_spi_lock(queue->spi_bus);
+        (*queue->spi_bus->ops->batch)(queue->spi_bus, xfers, n);
+        mcupr_spi_unlock(queue->spi_bus);
+        return 1;
+    }
+    return 0;
+}
+
+/* running transfers count against the depth until they are done */
+static void async_retire(struct async_queue_data *priv, mcupr_xfer_t *xfer, int result)
+{
+    pthread_mutex_lock(&priv->lock);
+    priv->count--;
+    pthread_cond_broadcast(&priv->not_full);
+    pthread_mutex_unlock(&priv->lock);
+    async_complete(xfer, result);
+}
+
+static void *async_thread(void *arg)
+{
+    mcupr_queue_t *queue = (mcupr_queue_t *)arg;
+    struct async_queue_data *priv = (struct async_queue_data *)queue->data;
+    mcupr_xfer_t *xfers[ASYNC_BATCH_MAX];
+    int i, n;
+
+    pthread_mutex_lock(&priv->lock);
+    while (!priv->exiting) {
+        if (priv->head == NULL) {
+            pthread_cond_wait(&priv->not_empty, &priv->lock);
+            continue;
+        }
+        for (n = 0; n < ASYNC_BATCH_MAX && priv->head != NULL; n++) {
+            xfers[n] = priv->head;
+            priv->head = xfers[n]->next;
+            __atomic_store_n(&xfers[n]->state, ASYNC_XFER_RUNNING, __ATOMIC_RELEASE);
+        }
+        if (priv->head == NULL) {
+            priv->tail = NULL;
+        }
+        pthread_mutex_unlock(&priv->lock);
+
+        if (1 < n && async_run_batch(queue, xfers, n)) {
+            for (i = 0; i < n; i++) {
+                async_retire(priv, xfers[i], xfers[i]->result);
+            }
+        } else {
+            for (i = 0; i < n; i++) {
+                async_retire(priv, xfers[i], async_run(queue, xfers[i]));
+            }
+        }
+
+        pthread_mutex_lock(&priv->lock);
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return NULL;
+}
+
+static mcupr_result_t async_queue_create(mcupr_queue_t **queuep, mcupr_i2c_bus_t *i2c_bus,
+                                         mcupr_spi_bus_t *spi_bus,
+                                         const mcupr_queue_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_queue_t *queue;
+    int err;
+
+    if (params == NULL || params->depth == 0) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    pthread_once(&async_once, async_init_once);
+    res = MCUPR_ALLOC_OBJECT(queue, mcupr_queue_t, data, struct async_queue_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct async_queue_data *priv = (struct async_queue_data *)queue->data;
+    queue->i2c_bus = i2c_bus;
+    queue->spi_bus = spi_bus;
+    priv->params = *params;
+    pthread_mutex_init(&priv->lock, NULL);
+    pthread_cond_init(&priv->not_empty, NULL);
+    pthread_cond_init(&priv->not_full, NULL);
+
+    err = pthread_create(&priv->thread, NULL, async_thread, queue);
+    if (err != 0) {
+        MCUPR_ERR("%s: can't create worker thread, %s", __func__, strerror(err));
+        pthread_cond_destroy(&priv->not_full);
+        pthread_cond_destroy(&priv->not_empty);
+        pthread_mutex_destroy(&priv->lock);
+        mcupr_release_object(queue);
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+    *queuep = queue;
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_queue_create_i2c(mcupr_queue_t **queue, mcupr_i2c_bus_t *bus,
+                                      const mcupr_queue_params_t *params)
+{
+    if (bus == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    return async_queue_create(queue, bus, NULL, params);
+}
+
+mcupr_result_t mcupr_queue_create_spi(mcupr_queue_t **queue, mcupr_spi_bus_t *bus,
+                                      const mcupr_queue_params_t *params)
+{
+    if (bus == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    return async_queue_create(queue, NULL, bus, params);
+}
+
+void mcupr_queue_release(mcupr_queue_t *queue)
+{
+    mcupr_xfer_t *pending, *xfer;
+
+    if (queue == NULL || queue->data == NULL) {
+        return;
+    }
+    struct async_queue_data *priv = (struct async_queue_data *)queue->data;
+
+    pthread_mutex_lock(&priv->lock);
+    priv->exiting = 1;
+    pending = priv->head;
+    priv->head = NULL;
+    priv->tail = NULL;
+    pthread_cond_signal(&priv->not_empty);
+    pthread_cond_broadcast(&priv->not_full);
+    pthread_mutex_unlock(&priv->lock);
+    pthread_join(priv->thread, NULL);
+
+    while (pending != NULL) {
+        xfer = pending;
+        pending = xfer->next;
+        async_complete(xfer, MCUPR_RES_CANCELED);
+    }
+    pthread_cond_destroy(&priv->not_full);
+    pthread_cond_destroy(&priv->not_empty);
+    pthread_mutex_destroy(&priv->lock);
+    mcupr_release_object(queue);
+}
+
+mcupr_result_t mcupr_queue_submit(mcupr_queue_t *queue, mcupr_xfer_t *xfer)
+{
+    int state;
+
+    if (queue == NULL || queue->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (xfer == NULL) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    struct async_queue_data *priv = (struct async_queue_data *)queue->data;
+    int i2c = (xfer->type != MCUPR_XFER_SPI_TRANSFER);
+    if ((i2c && queue->i2c_bus == NULL) || (!i2c && queue->spi_bus == NULL)) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&priv->lock);
+    state = __atomic_load_n(&xfer->state, __ATOMIC_ACQUIRE);
+    if (state == ASYNC_XFER_QUEUED || state == ASYNC_XFER_RUNNING) {
+        pthread_mutex_unlock(&priv->lock);
+        return MCUPR_RES_BUSY;
+    }
+    while (priv->params.depth <= priv->count && !priv->exiting) {
+        /* a callback waiting for room would stop the worker which makes it */
+        if (priv->params.nonblock || pthread_equal(pthread_self(), priv->thread)) {
+            pthread_mutex_unlock(&priv->lock);
+            return MCUPR_RES_BUSY;
+        }
+        pthread_cond_wait(&priv->not_full, &priv->lock);
+    }
+    if (priv->exiting) {
+        pthread_mutex_unlock(&priv->lock);
+        return MCUPR_RES_CANCELED;
+    }
+    xfer->result = 0;
+    xfer->next = NULL;
+    __atomic_store_n(&xfer->state, ASYNC_XFER_QUEUED, __ATOMIC_RELEASE);
+    if (priv->tail == NULL) {
+        priv->head = xfer;
+    } else {
+        priv->tail->next = xfer;
+    }
+    priv->tail = xfer;
+    priv->count++;
+    pthread_cond_signal(&priv->not_empty);
+    pthread_mutex_unlock(&priv->lock);
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_queue_cancel(mcupr_queue_t *queue, mcupr_xfer_t *xfer)
+{
+    mcupr_xfer_t **pp, *prev = NULL;
+
+    if (queue == NULL || queue->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct async_queue_data *priv = (struct async_queue_data *)queue->data;
+
+    pthread_mutex_lock(&priv->lock);
+    for (pp = &priv->head; *pp != NULL; prev = *pp, pp = &(*pp)->next) {
+        if (*pp == xfer) {
+            break;
+        }
+    }
+    if (*pp == NULL) {
+        pthread_mutex_unlock(&priv->lock);
+        return MCUPR_RES_BUSY;
+    }
+    *pp = xfer->next;
+    if (priv->tail == xfer) {
+        priv->tail = prev;
+    }
+    priv->count--;
+    pthread_cond_signal(&priv->not_full);
+    pthread_mutex_unlock(&priv->lock);
+
+    async_complete(xfer, MCUPR_RES_CANCELED);
+
+    return MCUPR_RES_OK;
+}
+
+static int async_done(mcupr_xfer_t *xfer)
+{
+    return __atomic_load_n(&xfer->state, __ATOMIC_ACQUIRE) == ASYNC_XFER_DONE;
+}
+
+/* wait until all (or any) of the transfers are done, returns the index of a done transfer */
+static int async_wait(mcupr_xfer_t **xfers, int n, int all, int timeout_ms)
+{
+    struct timespec deadline;
+    int i, ndone, first, err = 0;
+
+    if (xfers == NULL || n <= 0) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    pthread_once(&async_once, async_init_once);
+    if (0 < timeout_ms) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (1000000000L <= deadline.tv_nsec) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&async_done_lock);
+    for (;;) {
+        ndone = 0;
+        first = -1;
+        for (i = 0; i < n; i++) {
+            if (async_done(xfers[i])) {
+                ndone++;
+                if (first < 0) {
+                    first = i;
+                }
+            }
+        }
+        if ((all && ndone == n) || (!all && 0 < ndone)) {
+            break;
+        }
+        if (timeout_ms == 0 || err == ETIMEDOUT) {
+            first = MCUPR_RES_TIMEOUT;
+            break;
+        }
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&async_done_cond, &async_done_lock);
+        } else {
+            err = pthread_cond_timedwait(&async_done_cond, &async_done_lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&async_done_lock);
+
+    return first;
+}
+
+mcupr_result_t mcupr_xfer_wait(mcupr_xfer_t *xfer, int timeout_ms)
+{
+    int res = async_wait(&xfer, 1, 1, timeout_ms);
+
+    return (res < 0) ? res : MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_xfer_wait_all(mcupr_xfer_t **xfers, int n, int timeout_ms)
+{
+    int res = async_wait(xfers, n, 1, timeout_ms);
+
+    return (res < 0) ? res : MCUPR_RES_OK;
+}
+
+int mcupr_xfer_wait_any(mcupr_xfer_t **xfers, int n, int timeout_ms)
+{
+    return async_wait(xfers, n, 0, timeout_ms);
+}
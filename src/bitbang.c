@@ -0,0 +1,833 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 hanyazou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mcu_peripheral/mcu_peripheral.h>
+#include <mcu_peripheral/log.h>
+#include "utils.h"
+#include "impl.h"
+
+/*
+ * Bit-banged I2C and SPI buses
+ *
+ * The output lines of a bus are opened as one GPIO group, so that lines changing together
+ * (both I2C lines at start and stop, SPI data with a clock edge and chip selects) are written
+ * by one backend operation. Half clock periods are timed by a busy-wait loop calibrated when
+ * the bus is created. The measured cost of a GPIO write is subtracted from the half period,
+ * so the clock gets as close to the target as the GPIO backend allows.
+ */
+
+#define MIN_ADDR 0x00
+#define MAX_ADDR 0x7f
+#define VALID_ADDR(addr) ((MIN_ADDR <= (addr) && (addr) <= MAX_ADDR))
+
+#define BITBANG_CALIBRATE_NS 2000000  /* run the delay loop at least this long to calibrate it */
+#define BITBANG_CALIBRATE_WRITES 16
+
+struct bitbang_port {
+    mcupr_gpio_chip_t *chip;
+    mcupr_gpio_group_t *group;
+    uint32_t loops_per_ms;   /* calibrated delay loop */
+    uint32_t write_ns;       /* measured cost of a group write */
+    uint32_t half_loops;     /* delay of a half clock period */
+    mcupr_bitbang_stats_t stats;
+};
+
+static uint64_t bitbang_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bitbang_spin(uint32_t loops)
+{
+    volatile uint32_t i;
+
+    for (i = 0; i < loops; i++) {
+    }
+}
+
+static void bitbang_delay(struct bitbang_port *port)
+{
+    bitbang_spin(port->half_loops);
+}
+
+static mcupr_result_t bitbang_write(struct bitbang_port *port, uint32_t values)
+{
+    return mcupr_gpio_group_write(port->chip, port->group, (1UL << port->group->npins) - 1,
+                                  values);
+}
+
+/*
+ * Measure the delay loop and the cost of writing the idle state of the bus to the lines.
+ */
+static mcupr_result_t bitbang_calibrate(struct bitbang_port *port, uint32_t idle)
+{
+    uint64_t start, elapsed;
+    uint32_t loops = 1000;
+    mcupr_result_t res;
+    int i;
+
+    for (;;) {
+        start = bitbang_now_ns();
+        bitbang_spin(loops);
+        elapsed = bitbang_now_ns() - start;
+        if (BITBANG_CALIBRATE_NS <= elapsed || (1U << 30) <= loops) {
+            break;
+        }
+        loops *= 2;
+    }
+    port->loops_per_ms = (uint32_t)((uint64_t)loops * 1000000 / (elapsed ? elapsed : 1));
+
+    start = bitbang_now_ns();
+    for (i = 0; i < BITBANG_CALIBRATE_WRITES; i++) {
+        res = bitbang_write(port, idle);
+        if (res != MCUPR_RES_OK) {
+            return res;
+        }
+    }
+    port->write_ns = (uint32_t)((bitbang_now_ns() - start) / BITBANG_CALIBRATE_WRITES);
+    MCUPR_DBG("%s: %u loops/ms, %u ns/write", __func__, port->loops_per_ms, port->write_ns);
+
+    return MCUPR_RES_OK;
+}
+
+static void bitbang_set_freq(struct bitbang_port *port, uint32_t freq)
+{
+    uint32_t half_ns = 1000000000 / (2 * freq);
+
+    if (half_ns <= port->write_ns) {
+        port->half_loops = 0;
+        MCUPR_INF("%s: %u Hz is faster than the GPIO backend, running at full speed", __func__,
+                  freq);
+        return;
+    }
+    port->half_loops = (uint32_t)((uint64_t)(half_ns - port->write_ns) * port->loops_per_ms /
+                                  1000000);
+}
+
+static void bitbang_account(struct bitbang_port *port, uint64_t start, uint32_t bytes)
+{
+    mcupr_bitbang_stats_t *stats = &port->stats;
+
+    stats->bytes += bytes;
+    stats->busy_ns += bitbang_now_ns() - start;
+    if (stats->busy_ns != 0) {
+        stats->bit_rate = (uint32_t)(stats->bytes * 8 * 1000000000ULL / stats->busy_ns);
+    }
+}
+
+static void bitbang_port_close(struct bitbang_port *port)
+{
+    if (port->group != NULL) {
+        mcupr_gpio_group_close(port->chip, port->group);
+        port->group = NULL;
+    }
+}
+
+/*=================================================================================================
+ * I2C
+ *
+ * SCL and SDA are open drain outputs, 1 releases the line. The device handle is the address.
+ */
+
+#define I2C_SCL 0x01  /* group bits */
+#define I2C_SDA 0x02
+#define I2C_IDLE (I2C_SCL | I2C_SDA)
+
+struct bitbang_i2c_data {
+    struct bitbang_port port;
+    uint32_t stretch_timeout_ns;  /* 0 if SCL is not checked */
+    uint32_t default_stretch_timeout_ns;
+    uint32_t state;               /* last written lines */
+};
+
+static const struct mcupr_i2c_ops_s bitbang_i2c_ops;
+
+static mcupr_result_t bitbang_i2c_set(struct bitbang_i2c_data *priv, uint32_t state)
+{
+    priv->state = state;
+    return bitbang_write(&priv->port, state);
+}
+
+/*
+ * Release SCL and wait while a slave holds it low, then wait for the high period.
+ */
+static mcupr_result_t bitbang_i2c_scl_high(struct bitbang_i2c_data *priv)
+{
+    mcupr_result_t res;
+    uint32_t values;
+
+    res = bitbang_i2c_set(priv, priv->state | I2C_SCL);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    if (priv->stretch_timeout_ns != 0) {
+        uint64_t deadline = 0;
+        for (;;) {
+            res = mcupr_gpio_group_read(priv->port.chip, priv->port.group, &values);
+            if (res != MCUPR_RES_OK) {
+                return res;
+            }
+            if (values & I2C_SCL) {
+                break;
+            }
+            if (deadline == 0) {
+                deadline = bitbang_now_ns() + priv->stretch_timeout_ns;
+            } else if (deadline < bitbang_now_ns()) {
+                MCUPR_DBG("%s: SCL is held low", __func__);
+                return MCUPR_RES_COMMUNICATION_ERROR;
+            }
+        }
+    }
+    bitbang_delay(&priv->port);
+
+    return MCUPR_RES_OK;
+}
+
+static mcupr_result_t bitbang_i2c_start(struct bitbang_i2c_data *priv)
+{
+    mcupr_result_t res;
+
+    if (priv->state != I2C_IDLE) {
+        /* release SDA while SCL is low, then SCL, so that no stop condition is generated */
+        res = bitbang_i2c_set(priv, priv->state | I2C_SDA);
+        if (res == MCUPR_RES_OK) {
+            bitbang_delay(&priv->port);
+            res = bitbang_i2c_scl_high(priv);
+        }
+        if (res != MCUPR_RES_OK) {
+            return res;
+        }
+    }
+    res = bitbang_i2c_set(priv, I2C_SCL);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    bitbang_delay(&priv->port);
+    res = bitbang_i2c_set(priv, 0);
+    bitbang_delay(&priv->port);
+
+    return res;
+}
+
+static mcupr_result_t bitbang_i2c_stop(struct bitbang_i2c_data *priv)
+{
+    mcupr_result_t res;
+
+    res = bitbang_i2c_set(priv, 0);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    bitbang_delay(&priv->port);
+    res = bitbang_i2c_scl_high(priv);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    res = bitbang_i2c_set(priv, I2C_IDLE);
+    bitbang_delay(&priv->port);
+
+    return res;
+}
+
+/*
+ * Shift one bit out. SCL is low on entry and on return.
+ */
+static mcupr_result_t bitbang_i2c_bit_out(struct bitbang_i2c_data *priv, int bit)
+{
+    mcupr_result_t res;
+
+    res = bitbang_i2c_set(priv, bit ? I2C_SDA : 0);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    bitbang_delay(&priv->port);
+    res = bitbang_i2c_scl_high(priv);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    return bitbang_i2c_set(priv, priv->state & ~I2C_SCL);
+}
+
+/*
+ * Release SDA and sample it while SCL is high.
+ * Returns: 0 or 1, or a negative mcupr_result_t
+ */
+static int bitbang_i2c_bit_in(struct bitbang_i2c_data *priv)
+{
+    mcupr_result_t res;
+    uint32_t values;
+
+    res = bitbang_i2c_set(priv, I2C_SDA);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    bitbang_delay(&priv->port);
+    res = bitbang_i2c_scl_high(priv);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    res = mcupr_gpio_group_read(priv->port.chip, priv->port.group, &values);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    res = bitbang_i2c_set(priv, I2C_SDA);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+
+    return (values & I2C_SDA) ? 1 : 0;
+}
+
+/*
+ * Returns: 0 if acknowledged, 1 if not, or a negative mcupr_result_t
+ */
+static int bitbang_i2c_write_byte(struct bitbang_i2c_data *priv, uint8_t byte)
+{
+    mcupr_result_t res;
+    int i;
+
+    for (i = 7; 0 <= i; i--) {
+        res = bitbang_i2c_bit_out(priv, (byte >> i) & 1);
+        if (res != MCUPR_RES_OK) {
+            return res;
+        }
+    }
+    return bitbang_i2c_bit_in(priv);
+}
+
+/*
+ * Returns: the byte read, or a negative mcupr_result_t
+ */
+static int bitbang_i2c_read_byte(struct bitbang_i2c_data *priv, int ack)
+{
+    mcupr_result_t res;
+    int i, bit, byte = 0;
+
+    for (i = 0; i < 8; i++) {
+        bit = bitbang_i2c_bit_in(priv);
+        if (bit < 0) {
+            return bit;
+        }
+        byte = (byte << 1) | bit;
+    }
+    res = bitbang_i2c_bit_out(priv, !ack);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+
+    return byte;
+}
+
+static void bitbang_i2c_bus_release(mcupr_i2c_bus_t *bus)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return;
+    }
+    struct bitbang_i2c_data *priv = (struct bitbang_i2c_data *)bus->data;
+    bitbang_port_close(&priv->port);
+    mcupr_release_object(bus);
+}
+
+static mcupr_result_t bitbang_i2c_open(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t *dev, int addr)
+{
+    if (!VALID_ADDR(addr)) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    *dev = addr;
+
+    return MCUPR_RES_OK;
+}
+
+static void bitbang_i2c_close(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev)
+{
+    /* nothing to do here */
+}
+
+/*
+ * Transfer one message. The bus is left started.
+ * more   : the next message continues reading without a start, acknowledge the last byte
+ * count  : incremented by the number of bytes shifted including the address
+ */
+static mcupr_result_t bitbang_i2c_xfer(struct bitbang_i2c_data *priv, const mcupr_i2c_msg_t *msg,
+                                       int more, uint32_t *count)
+{
+    int rd = (msg->flags & MCUPR_I2C_M_RD) != 0;
+    int ignore_nak = (msg->flags & MCUPR_I2C_M_IGNORE_NAK) != 0;
+    mcupr_result_t res;
+    uint32_t i;
+    int ret;
+
+    if (!VALID_ADDR(msg->addr)) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    if (!(msg->flags & MCUPR_I2C_M_NOSTART)) {
+        res = bitbang_i2c_start(priv);
+        if (res != MCUPR_RES_OK) {
+            return res;
+        }
+        ret = bitbang_i2c_write_byte(priv, (msg->addr << 1) | rd);
+        if (ret < 0) {
+            return ret;
+        }
+        (*count)++;
+        if (ret != 0 && !ignore_nak) {
+            return MCUPR_RES_COMMUNICATION_ERROR;
+        }
+    }
+    for (i = 0; i < msg->length; i++) {
+        if (rd) {
+            ret = bitbang_i2c_read_byte(priv, more || i + 1 < msg->length);
+            if (ret < 0) {
+                return ret;
+            }
+            msg->data[i] = (uint8_t)ret;
+        } else {
+            ret = bitbang_i2c_write_byte(priv, msg->data[i]);
+            if (ret < 0) {
+                return ret;
+            }
+            if (ret != 0 && !ignore_nak) {
+                (*count)++;
+                return MCUPR_RES_COMMUNICATION_ERROR;
+            }
+        }
+        (*count)++;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+static int bitbang_i2c_transfer(mcupr_i2c_bus_t *bus, const mcupr_i2c_msg_t *msgs, int n)
+{
+    struct bitbang_i2c_data *priv = (struct bitbang_i2c_data *)bus->data;
+    uint64_t start = bitbang_now_ns();
+    mcupr_result_t res = MCUPR_RES_OK;
+    uint32_t count = 0;
+    int i, more;
+
+    for (i = 0; i < n && res == MCUPR_RES_OK; i++) {
+        int stop = (msgs[i].flags & MCUPR_I2C_M_STOP) != 0;
+        more = (!stop && i + 1 < n &&
+                (msgs[i + 1].flags & (MCUPR_I2C_M_NOSTART | MCUPR_I2C_M_RD)) ==
+                (MCUPR_I2C_M_NOSTART | MCUPR_I2C_M_RD));
+        res = bitbang_i2c_xfer(priv, &msgs[i], more, &count);
+        if (res == MCUPR_RES_OK && stop && i + 1 < n) {
+            res = bitbang_i2c_stop(priv);
+        }
+    }
+    if (bitbang_i2c_stop(priv) != MCUPR_RES_OK && res == MCUPR_RES_OK) {
+        res = MCUPR_RES_COMMUNICATION_ERROR;
+    }
+    bitbang_account(&priv->port, start, count);
+
+    return res == MCUPR_RES_OK ? n : res;
+}
+
+static int bitbang_i2c_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t *data,
+                            uint32_t length)
+{
+    mcupr_i2c_msg_t msg = { dev, MCUPR_I2C_M_RD, length, data };
+    int res;
+
+    if (!VALID_ADDR(dev)) {
+        return MCUPR_RES_INVALID_HANDLE;
+    }
+    res = bitbang_i2c_transfer(bus, &msg, 1);
+
+    return res < 0 ? res : (int)length;
+}
+
+static int bitbang_i2c_write(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, const uint8_t *data,
+                             uint32_t length)
+{
+    mcupr_i2c_msg_t msg = { dev, 0, length, (uint8_t *)data };
+    int res;
+
+    if (!VALID_ADDR(dev)) {
+        return MCUPR_RES_INVALID_HANDLE;
+    }
+    res = bitbang_i2c_transfer(bus, &msg, 1);
+
+    return res < 0 ? res : (int)length;
+}
+
+static int bitbang_i2c_write_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                  const uint8_t *wdata, uint32_t wlength,
+                                  uint8_t *rdata, uint32_t rlength)
+{
+    mcupr_i2c_msg_t msgs[2] = {
+        { dev, 0, wlength, (uint8_t *)wdata },
+        { dev, MCUPR_I2C_M_RD, rlength, rdata },
+    };
+    int res;
+
+    if (!VALID_ADDR(dev)) {
+        return MCUPR_RES_INVALID_HANDLE;
+    }
+    res = bitbang_i2c_transfer(bus, msgs, 2);
+
+    return res < 0 ? res : (int)rlength;
+}
+
+static mcupr_result_t bitbang_i2c_set_freq(mcupr_i2c_bus_t *bus, uint32_t freq)
+{
+    struct bitbang_i2c_data *priv = (struct bitbang_i2c_data *)bus->data;
+
+    if (freq == 0) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    bitbang_set_freq(&priv->port, freq);
+
+    return MCUPR_RES_OK;
+}
+
+static mcupr_result_t bitbang_i2c_set_clock_stretch(mcupr_i2c_bus_t *bus, int enable)
+{
+    struct bitbang_i2c_data *priv = (struct bitbang_i2c_data *)bus->data;
+
+    priv->stretch_timeout_ns = enable ? priv->default_stretch_timeout_ns : 0;
+
+    return MCUPR_RES_OK;
+}
+
+static const struct mcupr_i2c_ops_s bitbang_i2c_ops = {
+    .release = bitbang_i2c_bus_release,
+    .open = bitbang_i2c_open,
+    .close = bitbang_i2c_close,
+    .read = bitbang_i2c_read,
+    .write = bitbang_i2c_write,
+    .write_read = bitbang_i2c_write_read,
+    .transfer = bitbang_i2c_transfer,
+    .set_freq = bitbang_i2c_set_freq,
+    .set_clock_stretch = bitbang_i2c_set_clock_stretch,
+};
+
+mcupr_result_t mcupr_i2c_bitbang_create(mcupr_i2c_bus_t **busp, mcupr_gpio_chip_t *chip,
+                                        const mcupr_i2c_bitbang_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_i2c_bus_t *bus;
+    int pins[2];
+
+    if (chip == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (params->scl < 0 || params->sda < 0 || params->scl == params->sda || params->freq == 0) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    res = MCUPR_ALLOC_OBJECT(bus, mcupr_i2c_bus_t, data, struct bitbang_i2c_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct bitbang_i2c_data *priv = (struct bitbang_i2c_data *)bus->data;
+    bus->ops = &bitbang_i2c_ops;
+    priv->port.chip = chip;
+    priv->default_stretch_timeout_ns = params->stretch_timeout_us * 1000;
+    if (priv->default_stretch_timeout_ns == 0) {
+        priv->default_stretch_timeout_ns = 10000000;
+    }
+    priv->stretch_timeout_ns = params->stretch_timeout_us * 1000;
+
+    /* group bits must match I2C_SCL and I2C_SDA */
+    pins[0] = params->scl;
+    pins[1] = params->sda;
+    res = mcupr_gpio_group_open(chip, &priv->port.group, pins, 2,
+                                MCUPR_GPIO_MODE_OUTPUT_OPEN_DRAIN);
+    if (res != MCUPR_RES_OK) {
+        MCUPR_ERR("%s: can't open GPIO%d and GPIO%d as open drain outputs, %s", __func__,
+                  params->scl, params->sda, mcupr_error(res));
+        mcupr_release_object(bus);
+        return res;
+    }
+    priv->state = I2C_IDLE;
+    res = bitbang_calibrate(&priv->port, I2C_IDLE);
+    if (res != MCUPR_RES_OK) {
+        bitbang_i2c_bus_release(bus);
+        return res;
+    }
+    bitbang_set_freq(&priv->port, params->freq);
+
+    MCUPR_INF("%s: SCL=GPIO%d SDA=GPIO%d, %u Hz", __func__, params->scl, params->sda,
+              params->freq);
+    *busp = bus;
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_i2c_bitbang_get_stats(mcupr_i2c_bus_t *bus, mcupr_bitbang_stats_t *stats)
+{
+    if (bus == NULL || bus->ops != &bitbang_i2c_ops) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct bitbang_i2c_data *priv = (struct bitbang_i2c_data *)bus->data;
+    *stats = priv->port.stats;
+
+    return MCUPR_RES_OK;
+}
+
+/*=================================================================================================
+ * SPI
+ *
+ * SCLK, MOSI and the chip selects are a group of push-pull outputs. MISO is a one pin input
+ * group read once per bit. The device handle is the chip select index.
+ */
+
+struct bitbang_spi_data {
+    struct bitbang_port port;
+    uint32_t sclk;     /* group bits */
+    uint32_t mosi;
+    uint32_t cs[MCUPR_SPI_BITBANG_MAX_CS];
+    uint32_t cs_all;
+    int ncs;
+    mcupr_gpio_group_t *miso;  /* one pin input group, NULL if MISO is not connected */
+};
+
+static const struct mcupr_spi_ops_s bitbang_spi_ops;
+
+static void bitbang_spi_bus_release(mcupr_spi_bus_t *bus)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return;
+    }
+    struct bitbang_spi_data *priv = (struct bitbang_spi_data *)bus->data;
+    if (priv->miso != NULL) {
+        mcupr_gpio_group_close(priv->port.chip, priv->miso);
+    }
+    bitbang_port_close(&priv->port);
+    mcupr_release_object(bus);
+}
+
+static mcupr_result_t bitbang_spi_open(mcupr_spi_bus_t *bus, mcupr_spi_device_t *dev, int csnum)
+{
+    struct bitbang_spi_data *priv = (struct bitbang_spi_data *)bus->data;
+
+    if (csnum == MCUPR_UNSPECIFIED) {
+        csnum = 0;
+    }
+    if (csnum < 0 || (priv->ncs == 0 ? 1 : priv->ncs) <= csnum) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    *dev = csnum;
+
+    return MCUPR_RES_OK;
+}
+
+static void bitbang_spi_close(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev)
+{
+    /* nothing to do here */
+}
+
+static int bitbang_spi_transfer(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                                const uint8_t *tx_data, uint8_t *rx_data, int length)
+{
+    struct bitbang_spi_data *priv = (struct bitbang_spi_data *)bus->data;
+    struct bitbang_port *port = &priv->port;
+    uint64_t start = bitbang_now_ns();
+    mcupr_result_t res;
+    int cpol = (bus->params.mode & 0x02) != 0;
+    int cpha = (bus->params.mode & 0x01) != 0;
+    uint32_t value;
+    int i, bit;
+
+    if (dev < 0 || (priv->ncs == 0 ? 1 : priv->ncs) <= dev) {
+        return MCUPR_RES_INVALID_HANDLE;
+    }
+    uint32_t idle = cpol ? priv->sclk : 0;
+    uint32_t active = idle ^ priv->sclk;
+    uint32_t selected = priv->ncs == 0 ? 0 : (priv->cs_all & ~priv->cs[dev]);
+
+    res = bitbang_write(port, idle | selected);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    bitbang_delay(port);
+
+    uint32_t mosi = 0;
+    for (i = 0; i < length; i++) {
+        uint8_t out = tx_data ? tx_data[i] : 0;
+        uint8_t in = 0;
+        for (bit = 7; 0 <= bit; bit--) {
+            mosi = ((out >> bit) & 1) ? priv->mosi : 0;
+            /*
+             * Each write changes the data line together with a clock edge. With CPHA=0 the
+             * data is changed with the trailing edge of the previous bit and sampled on the
+             * leading edge, with CPHA=1 it is changed on the leading edge and sampled on the
+             * trailing edge.
+             */
+            res = bitbang_write(port, (cpha ? active : idle) | mosi | selected);
+            if (res != MCUPR_RES_OK) {
+                goto wayout;
+            }
+            bitbang_delay(port);
+            res = bitbang_write(port, (cpha ? idle : active) | mosi | selected);
+            if (res != MCUPR_RES_OK) {
+                goto wayout;
+            }
+            if (priv->miso != NULL) {
+                res = mcupr_gpio_group_read(port->chip, priv->miso, &value);
+                if (res != MCUPR_RES_OK) {
+                    goto wayout;
+                }
+                in = (in << 1) | (value & 1);
+            }
+            bitbang_delay(port);
+        }
+        if (rx_data != NULL) {
+            rx_data[i] = in;
+        }
+    }
+    if (!cpha) {
+        /* trailing edge of the last bit */
+        res = bitbang_write(port, idle | mosi | selected);
+        bitbang_delay(port);
+    }
+
+ wayout:
+    if (bitbang_write(port, idle | priv->cs_all) != MCUPR_RES_OK && res == MCUPR_RES_OK) {
+        res = MCUPR_RES_IO_ERROR;
+    }
+    bitbang_account(port, start, i);
+
+    return res == MCUPR_RES_OK ? length : res;
+}
+
+static mcupr_result_t bitbang_spi_set_speed(mcupr_spi_bus_t *bus, uint32_t speed)
+{
+    struct bitbang_spi_data *priv = (struct bitbang_spi_data *)bus->data;
+
+    if (speed == 0) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    bus->params.speed = speed;
+    bitbang_set_freq(&priv->port, speed);
+
+    return MCUPR_RES_OK;
+}
+
+static mcupr_result_t bitbang_spi_set_mode(mcupr_spi_bus_t *bus, mcupr_spi_mode_t mode)
+{
+    struct bitbang_spi_data *priv = (struct bitbang_spi_data *)bus->data;
+    uint32_t idle = (mode & 0x02) ? priv->sclk : 0;
+
+    bus->params.mode = mode;
+
+    /* move SCLK to the new idle level while no device is selected */
+    return bitbang_write(&priv->port, idle | priv->cs_all);
+}
+
+static const struct mcupr_spi_ops_s bitbang_spi_ops = {
+    .release = bitbang_spi_bus_release,
+    .open = bitbang_spi_open,
+    .close = bitbang_spi_close,
+    .transfer = bitbang_spi_transfer,
+    .set_speed = bitbang_spi_set_speed,
+    .set_mode = bitbang_spi_set_mode,
+};
+
+mcupr_result_t mcupr_spi_bitbang_create(mcupr_spi_bus_t **busp, mcupr_gpio_chip_t *chip,
+                                        const mcupr_spi_bitbang_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_spi_bus_t *bus;
+    int pins[2 + MCUPR_SPI_BITBANG_MAX_CS];
+    int i, npins = 0;
+
+    if (chip == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (params->sclk < 0 || params->speed == 0 ||
+        params->ncs < 0 || MCUPR_SPI_BITBANG_MAX_CS < params->ncs) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    res = MCUPR_ALLOC_OBJECT(bus, mcupr_spi_bus_t, data, struct bitbang_spi_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct bitbang_spi_data *priv = (struct bitbang_spi_data *)bus->data;
+    bus->ops = &bitbang_spi_ops;
+    bus->params.busnum = MCUPR_UNSPECIFIED;
+    bus->params.speed = params->speed;
+    bus->params.mode = params->mode;
+    priv->port.chip = chip;
+
+    priv->sclk = (1UL << npins);
+    pins[npins++] = params->sclk;
+    if (0 <= params->mosi) {
+        priv->mosi = (1UL << npins);
+        pins[npins++] = params->mosi;
+    }
+    priv->ncs = params->ncs;
+    for (i = 0; i < params->ncs; i++) {
+        priv->cs[i] = (1UL << npins);
+        priv->cs_all |= priv->cs[i];
+        pins[npins++] = params->cs[i];
+    }
+
+    res = mcupr_gpio_group_open(chip, &priv->port.group, pins, npins, MCUPR_GPIO_MODE_OUTPUT);
+    if (res != MCUPR_RES_OK) {
+        MCUPR_ERR("%s: can't open GPIO%d and %d other pins, %s", __func__, params->sclk,
+                  npins - 1, mcupr_error(res));
+        mcupr_release_object(bus);
+        return res;
+    }
+    if (0 <= params->miso) {
+        res = mcupr_gpio_group_open(chip, &priv->miso, &params->miso, 1, MCUPR_GPIO_MODE_INPUT);
+        if (res != MCUPR_RES_OK) {
+            MCUPR_ERR("%s: can't open GPIO%d, %s", __func__, params->miso, mcupr_error(res));
+            priv->miso = NULL;
+            bitbang_spi_bus_release(bus);
+            return res;
+        }
+    }
+    res = bitbang_calibrate(&priv->port, ((params->mode & 0x02) ? priv->sclk : 0) | priv->cs_all);
+    if (res != MCUPR_RES_OK) {
+        bitbang_spi_bus_release(bus);
+        return res;
+    }
+    bitbang_set_freq(&priv->port, params->speed);
+
+    MCUPR_INF("%s: SCLK=GPIO%d MOSI=GPIO%d MISO=GPIO%d, %u Hz mode %d", __func__, params->sclk,
+              params->mosi, params->miso, params->speed, params->mode);
+    *busp = bus;
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_spi_bitbang_get_stats(mcupr_spi_bus_t *bus, mcupr_bitbang_stats_t *stats)
+{
+    if (bus == NULL || bus->ops != &bitbang_spi_ops) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct bitbang_spi_data *priv = (struct bitbang_spi_data *)bus->data;
+    *stats = priv->port.stats;
+
+    return MCUPR_RES_OK;
+}
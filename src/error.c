@@ -50,6 +50,14 @@ static struct {
       "Not enough memory" },
     { MCUPR_RES_NODEV,
       "No such device" },
+    { MCUPR_RES_IO_ERROR,
+      "I/O error" },
+    { MCUPR_RES_NOT_SUPPORTED,
+      "Not supported" },
+    { MCUPR_RES_TIMEOUT,
+      "Timed out" },
+    { MCUPR_RES_CANCELED,
+      "Canceled" },
 };
 
 char *mcupr_error(int errno)
@@ -0,0 +1,405 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 hanyazou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "utils.h"
+#include <mcu_peripheral/mcu_peripheral.h>
+#include <mcu_peripheral/log.h>
+
+/*
+ * Software waveform engine for backends without timed GPIO output.
+ *
+ * A waveform is compiled into a schedule of group writes at offsets from the start of a
+ * round. The engine thread sleeps until each absolute deadline with clock_nanosleep() and
+ * writes all pins changing at that time with one mcupr_gpio_group_write(). A new schedule
+ * replaces the current one at the end of a round so that PWM changes don't glitch.
+ */
+
+#define GPIO_WAVE_START_DELAY_NS 100000   /* lead time before the first edge */
+#define GPIO_WAVE_MAX_SLEEP_NS 10000000   /* sleep in slices to notice a stop request */
+
+struct gpio_wave_edge {
+    uint64_t offset_ns;
+    uint32_t mask;
+    uint32_t values;
+};
+
+struct gpio_wave_schedule {
+    int repeat;
+    uint64_t period_ns;
+    int nedges;
+    struct gpio_wave_edge edges[];
+};
+
+struct gpio_wave_data {
+    mcupr_gpio_wave_params_t params;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int exiting;
+    int stop;                           /* abandon the current schedule */
+    struct gpio_wave_schedule *next;    /* schedule to play after the current round */
+    mcupr_gpio_wave_stats_t stats;
+    uint64_t jitter_sum;
+};
+
+static uint64_t gpio_wave_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Wait until the deadline, returns non-zero if a stop was requested meanwhile */
+static int gpio_wave_wait(struct gpio_wave_data *priv, uint64_t deadline)
+{
+    struct timespec ts;
+    uint64_t wakeup = deadline - priv->params.spin_ns;
+    uint64_t now;
+
+    while ((now = gpio_wave_now()) < wakeup) {
+        if (__atomic_load_n(&priv->stop, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+        uint64_t t = wakeup;
+        if (GPIO_WAVE_MAX_SLEEP_NS < t - now) {
+            t = now + GPIO_WAVE_MAX_SLEEP_NS;
+        }
+        ts.tv_sec = t / 1000000000;
+        ts.tv_nsec = t % 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    while (gpio_wave_now() < deadline) {
+        /* busy-wait the last spin_ns */
+    }
+
+    return __atomic_load_n(&priv->stop, __ATOMIC_RELAXED);
+}
+
+static void *gpio_wave_thread(void *arg)
+{
+    mcupr_gpio_wave_t *wave = (mcupr_gpio_wave_t *)arg;
+    struct gpio_wave_data *priv = (struct gpio_wave_data *)wave->data;
+    struct gpio_wave_schedule *cur = NULL;
+    uint64_t base = 0;
+    int i;
+
+    pthread_mutex_lock(&priv->lock);
+    while (!priv->exiting) {
+        if (priv->stop) {
+            free(cur);
+            cur = NULL;
+            priv->stop = 0;
+        }
+        if (priv->next != NULL) {
+            if (cur == NULL) {
+                base = gpio_wave_now() + GPIO_WAVE_START_DELAY_NS;
+            }
+            free(cur);
+            cur = priv->next;
+            priv->next = NULL;
+        }
+        if (cur == NULL) {
+            pthread_cond_wait(&priv->cond, &priv->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&priv->lock);
+
+        /* play one round of the schedule */
+        uint64_t max_jitter = 0, jitter_sum = 0;
+        for (i = 0; i < cur->nedges; i++) {
+            struct gpio_wave_edge *edge = &cur->edges[i];
+            uint64_t deadline = base + edge->offset_ns;
+            if (gpio_wave_wait(priv, deadline)) {
+                break;
+            }
+            uint64_t jitter = gpio_wave_now() - deadline;
+            mcupr_gpio_group_write(wave->chip, wave->group, edge->mask, edge->values);
+            if (max_jitter < jitter) {
+                max_jitter = jitter;
+            }
+            jitter_sum += jitter;
+        }
+        base += cur->period_ns;
+
+        pthread_mutex_lock(&priv->lock);
+        priv->stats.edges += i;
+        priv->jitter_sum += jitter_sum;
+        if (priv->stats.max_jitter_ns < max_jitter) {
+            priv->stats.max_jitter_ns = (max_jitter < UINT32_MAX) ? max_jitter : UINT32_MAX;
+        }
+        if (!cur->repeat) {
+            free(cur);
+            cur = NULL;
+        }
+        if (base < gpio_wave_now()) {
+            /* fell behind by more than a round, restart from now instead of catching up */
+            base = gpio_wave_now() + GPIO_WAVE_START_DELAY_NS;
+        }
+    }
+    pthread_mutex_unlock(&priv->lock);
+    free(cur);
+
+    return NULL;
+}
+
+static mcupr_result_t gpio_wave_start_thread(mcupr_gpio_wave_t *wave)
+{
+    struct gpio_wave_data *priv = (struct gpio_wave_data *)wave->data;
+    pthread_attr_t attr;
+    int res;
+
+    pthread_attr_init(&attr);
+    if (0 <= priv->params.cpu) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(priv->params.cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    if (0 < priv->params.priority) {
+        struct sched_param sp;
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = priv->params.priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &sp);
+    }
+    res = pthread_create(&priv->thread, &attr, gpio_wave_thread, wave);
+    if (res == EPERM && 0 < priv->params.priority) {
+        MCUPR_WRN("%s: no permission for SCHED_FIFO, use normal scheduling", __func__);
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        res = pthread_create(&priv->thread, &attr, gpio_wave_thread, wave);
+    }
+    pthread_attr_destroy(&attr);
+    if (res != 0) {
+        MCUPR_ERR("%s: can't create engine thread, %s", __func__, strerror(res));
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_gpio_wave_create(mcupr_gpio_wave_t **wavep, mcupr_gpio_chip_t *chip,
+                                      mcupr_gpio_group_t *group,
+                                      const mcupr_gpio_wave_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_gpio_wave_t *wave;
+
+    if (chip == NULL || group == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    res = MCUPR_ALLOC_OBJECT(wave, mcupr_gpio_wave_t, data, struct gpio_wave_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct gpio_wave_data *priv = (struct gpio_wave_data *)wave->data;
+    wave->chip = chip;
+    wave->group = group;
+    priv->params = *params;
+    pthread_mutex_init(&priv->lock, NULL);
+    pthread_cond_init(&priv->cond, NULL);
+
+    res = gpio_wave_start_thread(wave);
+    if (res != MCUPR_RES_OK) {
+        pthread_cond_destroy(&priv->cond);
+        pthread_mutex_destroy(&priv->lock);
+        mcupr_release_object(wave);
+        return res;
+    }
+    *wavep = wave;
+
+    return MCUPR_RES_OK;
+}
+
+void mcupr_gpio_wave_release(mcupr_gpio_wave_t *wave)
+{
+    if (wave == NULL || wave->data == NULL) {
+        return;
+    }
+    struct gpio_wave_data *priv = (struct gpio_wave_data *)wave->data;
+
+    pthread_mutex_lock(&priv->lock);
+    priv->exiting = 1;
+    __atomic_store_n(&priv->stop, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&priv->cond);
+    pthread_mutex_unlock(&priv->lock);
+    pthread_join(priv->thread, NULL);
+
+    free(priv->next);
+    pthread_cond_destroy(&priv->cond);
+    pthread_mutex_destroy(&priv->lock);
+    mcupr_release_object(wave);
+}
+
+static int gpio_wave_compare_edge(const void *a, const void *b)
+{
+    const struct gpio_wave_edge *ea = a;
+    const struct gpio_wave_edge *eb = b;
+
+    if (ea->offset_ns != eb->offset_ns) {
+        return (ea->offset_ns < eb->offset_ns) ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Sort the edges, merge those at the same time into one write and hand it to the engine */
+static mcupr_result_t gpio_wave_post(mcupr_gpio_wave_t *wave, struct gpio_wave_schedule *sched)
+{
+    struct gpio_wave_data *priv = (struct gpio_wave_data *)wave->data;
+    int i, n;
+
+    if (sched->period_ns == 0) {
+        free(sched);
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    qsort(sched->edges, sched->nedges, sizeof(sched->edges[0]), gpio_wave_compare_edge);
+    for (i = 1, n = 1; i < sched->nedges; i++) {
+        struct gpio_wave_edge *last = &sched->edges[n - 1];
+        if (sched->edges[i].offset_ns == last->offset_ns) {
+            last->values = (last->values & ~sched->edges[i].mask) | sched->edges[i].values;
+            last->mask |= sched->edges[i].mask;
+        } else {
+            sched->edges[n++] = sched->edges[i];
+        }
+    }
+    sched->nedges = (0 < sched->nedges) ? n : 0;
+
+    pthread_mutex_lock(&priv->lock);
+    free(priv->next);
+    priv->next = sched;
+    pthread_cond_signal(&priv->cond);
+    pthread_mutex_unlock(&priv->lock);
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_gpio_wave_pwm(mcupr_gpio_wave_t *wave, uint32_t frequency, const uint32_t *duty)
+{
+    struct gpio_wave_schedule *sched;
+    int i, npins;
+
+    if (wave == NULL || wave->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (frequency == 0) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    npins = wave->group->npins;
+    sched = calloc(1, sizeof(*sched) + sizeof(sched->edges[0]) * (npins + 1));
+    if (sched == NULL) {
+        MCUPR_ERR("%s: memory allocation failed", __func__);
+        return MCUPR_RES_NOMEM;
+    }
+    sched->repeat = 1;
+    sched->period_ns = 1000000000ULL / frequency;
+
+    /* all pins are set at the start of a period and each one is cleared after its duty */
+    sched->edges[0].mask = (uint32_t)(((uint64_t)1 << npins) - 1);
+    sched->nedges = 1;
+    for (i = 0; i < npins; i++) {
+        if (duty[i] == 0) {
+            continue;
+        }
+        sched->edges[0].values |= (1UL << i);
+        if (duty[i] < MCUPR_GPIO_PWM_DUTY_MAX) {
+            struct gpio_wave_edge *edge = &sched->edges[sched->nedges++];
+            edge->offset_ns = sched->period_ns * duty[i] / MCUPR_GPIO_PWM_DUTY_MAX;
+            edge->mask = (1UL << i);
+            edge->values = 0;
+        }
+    }
+
+    return gpio_wave_post(wave, sched);
+}
+
+mcupr_result_t mcupr_gpio_wave_pulses(mcupr_gpio_wave_t *wave, const mcupr_gpio_pulse_t *pulses,
+                                      int npulses, int repeat)
+{
+    struct gpio_wave_schedule *sched;
+    uint64_t offset = 0;
+    int i;
+
+    if (wave == NULL || wave->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (npulses <= 0) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    sched = calloc(1, sizeof(*sched) + sizeof(sched->edges[0]) * npulses);
+    if (sched == NULL) {
+        MCUPR_ERR("%s: memory allocation failed", __func__);
+        return MCUPR_RES_NOMEM;
+    }
+    sched->repeat = repeat;
+    for (i = 0; i < npulses; i++) {
+        sched->edges[i].offset_ns = offset;
+        sched->edges[i].mask = pulses[i].set | pulses[i].clear;
+        sched->edges[i].values = pulses[i].set;
+        offset += pulses[i].delay_ns;
+    }
+    sched->nedges = npulses;
+    sched->period_ns = offset;
+
+    return gpio_wave_post(wave, sched);
+}
+
+void mcupr_gpio_wave_stop(mcupr_gpio_wave_t *wave)
+{
+    if (wave == NULL || wave->data == NULL) {
+        return;
+    }
+    struct gpio_wave_data *priv = (struct gpio_wave_data *)wave->data;
+
+    pthread_mutex_lock(&priv->lock);
+    free(priv->next);
+    priv->next = NULL;
+    __atomic_store_n(&priv->stop, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&priv->cond);
+    pthread_mutex_unlock(&priv->lock);
+}
+
+mcupr_result_t mcupr_gpio_wave_get_stats(mcupr_gpio_wave_t *wave, mcupr_gpio_wave_stats_t *stats)
+{
+    if (wave == NULL || wave->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct gpio_wave_data *priv = (struct gpio_wave_data *)wave->data;
+
+    pthread_mutex_lock(&priv->lock);
+    *stats = priv->stats;
+    if (0 < priv->stats.edges) {
+        stats->avg_jitter_ns = priv->jitter_sum / priv->stats.edges;
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return MCUPR_RES_OK;
+}
@@ -0,0 +1,353 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 hanyazou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <mcu_peripheral/mcu_peripheral.h>
+#include <mcu_peripheral/log.h>
+#include "impl.h"
+#include "utils.h"
+
+/*
+ * I2C API
+ * Dispatch to the operations of the bus. Every call holds the lock of the bus, which is
+ * recursive so that fallbacks built from other calls and mcupr_i2c_lock() sections nest.
+ */
+
+void mcupr_i2c_lock(mcupr_i2c_bus_t *bus)
+{
+    mcupr_lock_acquire(&bus->lock);
+}
+
+void mcupr_i2c_unlock(mcupr_i2c_bus_t *bus)
+{
+    mcupr_lock_release(&bus->lock);
+}
+
+void mcupr_i2c_bus_release(mcupr_i2c_bus_t *bus)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return;
+    }
+    (*bus->ops->release)(bus);
+}
+
+mcupr_result_t mcupr_i2c_open(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t *dev, int address)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    mcupr_i2c_lock(bus);
+    mcupr_result_t res = (*bus->ops->open)(bus, dev, address);
+    mcupr_i2c_unlock(bus);
+
+    return res;
+}
+
+void mcupr_i2c_close(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return;
+    }
+    mcupr_i2c_lock(bus);
+    (*bus->ops->close)(bus, dev);
+    mcupr_i2c_unlock(bus);
+}
+
+int mcupr_i2c_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t *data, uint32_t length)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    mcupr_i2c_lock(bus);
+    int res = (*bus->ops->read)(bus, dev, data, length);
+    mcupr_i2c_unlock(bus);
+
+    return res;
+}
+
+int mcupr_i2c_write(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, const uint8_t *data,
+                    uint32_t length)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    mcupr_i2c_lock(bus);
+    int res = (*bus->ops->write)(bus, dev, data, length);
+    mcupr_i2c_unlock(bus);
+
+    return res;
+}
+
+int mcupr_i2c_write_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                         const uint8_t *wdata, uint32_t wlength, uint8_t *rdata, uint32_t rlength)
+{
+    int res;
+
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    mcupr_i2c_lock(bus);
+    if (bus->ops->write_read != NULL) {
+        res = (*bus->ops->write_read)(bus, dev, wdata, wlength, rdata, rlength);
+    } else {
+        /* two separate transactions, no other thread comes in between */
+        res = (*bus->ops->write)(bus, dev, wdata, wlength);
+        if (0 <= res) {
+            res = (*bus->ops->read)(bus, dev, rdata, rlength);
+        }
+    }
+    mcupr_i2c_unlock(bus);
+
+    return res;
+}
+
+static int i2c_transfer_locked(mcupr_i2c_bus_t *bus, const mcupr_i2c_msg_t *msgs, int n)
+{
+    mcupr_i2c_device_t dev;
+    mcupr_result_t res;
+    int i, ret;
+
+    if (bus->ops->transfer != NULL) {
+        return (*bus->ops->transfer)(bus, msgs, n);
+    }
+
+    /* one transaction per message */
+    for (i = 0; i < n; i++) {
+        if (msgs[i].flags & MCUPR_I2C_M_NOSTART) {
+            return MCUPR_RES_NOT_SUPPORTED;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        res = (*bus->ops->open)(bus, &dev, msgs[i].addr);
+        if (res != MCUPR_RES_OK) {
+            return res;
+        }
+        if (msgs[i].flags & MCUPR_I2C_M_RD) {
+            ret = (*bus->ops->read)(bus, dev, msgs[i].data, msgs[i].length);
+        } else {
+            ret = (*bus->ops->write)(bus, dev, msgs[i].data, msgs[i].length);
+        }
+        (*bus->ops->close)(bus, dev);
+        if (ret < 0 && !(msgs[i].flags & MCUPR_I2C_M_IGNORE_NAK)) {
+            return ret;
+        }
+    }
+
+    return n;
+}
+
+int mcupr_i2c_transfer(mcupr_i2c_bus_t *bus, const mcupr_i2c_msg_t *msgs, int n)
+{
+    int res;
+
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (n < 0 || (0 < n && msgs == NULL)) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    mcupr_i2c_lock(bus);
+    res = i2c_transfer_locked(bus, msgs, n);
+    mcupr_i2c_unlock(bus);
+
+    return res;
+}
+
+/*
+ * SMBus register access
+ */
+int mcupr_i2c_smbus_emulate(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, int read, uint8_t reg,
+                            mcupr_smbus_type_t type, uint8_t *data, uint32_t length)
+{
+    uint8_t buf[2 + MCUPR_I2C_SMBUS_BLOCK_MAX];
+    int res, n = 0;
+
+    if (read) {
+        if (type == MCUPR_SMBUS_BLOCK_DATA) {
+            /*
+             * Without I2C_M_RECV_LEN the count is fetched in a transaction of its own, then the
+             * block is read again with exactly that many bytes, so that no byte past the block
+             * is consumed. A count which changed in between fails the read.
+             */
+            res = mcupr_i2c_write_read(bus, dev, &reg, 1, buf, 1);
+            if (res < 0) {
+                return res;
+            }
+            n = buf[0];
+            if (MCUPR_I2C_SMBUS_BLOCK_MAX < n) {
+                return MCUPR_RES_COMMUNICATION_ERROR;
+            }
+            if (n == 0) {
+                return 0;
+            }
+            res = mcupr_i2c_write_read(bus, dev, &reg, 1, buf, 1 + n);
+            if (res < 0) {
+                return res;
+            }
+            if (buf[0] != n) {
+                return MCUPR_RES_COMMUNICATION_ERROR;
+            }
+            memcpy(data, &buf[1], n);
+            return n;
+        }
+        res = mcupr_i2c_write_read(bus, dev, &reg, 1, data, length);
+        return res < 0 ? res : (int)length;
+    }
+
+    buf[n++] = reg;
+    if (type == MCUPR_SMBUS_BLOCK_DATA) {
+        buf[n++] = (uint8_t)length;
+    }
+    memcpy(&buf[n], data, length);
+    n += length;
+    res = mcupr_i2c_write(bus, dev, buf, n);
+
+    return res < 0 ? res : (int)length;
+}
+
+static int mcupr_i2c_smbus(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, int read, uint8_t reg,
+                           mcupr_smbus_type_t type, uint8_t *data, uint32_t length)
+{
+    int res;
+
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (MCUPR_I2C_SMBUS_BLOCK_MAX < length) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    mcupr_i2c_lock(bus);
+    if (bus->ops->smbus != NULL) {
+        res = (*bus->ops->smbus)(bus, dev, read, reg, type, data, length);
+    } else {
+        res = mcupr_i2c_smbus_emulate(bus, dev, read, reg, type, data, length);
+    }
+    mcupr_i2c_unlock(bus);
+
+    return res;
+}
+
+int mcupr_i2c_read_byte_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t reg)
+{
+    uint8_t value;
+    int res;
+
+    res = mcupr_i2c_smbus(bus, dev, 1, reg, MCUPR_SMBUS_BYTE_DATA, &value, 1);
+
+    return res < 0 ? res : value;
+}
+
+mcupr_result_t mcupr_i2c_write_byte_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                         uint8_t reg, uint8_t value)
+{
+    int res;
+
+    res = mcupr_i2c_smbus(bus, dev, 0, reg, MCUPR_SMBUS_BYTE_DATA, &value, 1);
+
+    return res < 0 ? res : MCUPR_RES_OK;
+}
+
+int mcupr_i2c_read_word_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t reg)
+{
+    uint8_t buf[2];
+    int res;
+
+    res = mcupr_i2c_smbus(bus, dev, 1, reg, MCUPR_SMBUS_WORD_DATA, buf, 2);
+
+    return res < 0 ? res : (buf[0] | (buf[1] << 8));
+}
+
+mcupr_result_t mcupr_i2c_write_word_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                         uint8_t reg, uint16_t value)
+{
+    uint8_t buf[2] = { value & 0xff, value >> 8 };
+    int res;
+
+    res = mcupr_i2c_smbus(bus, dev, 0, reg, MCUPR_SMBUS_WORD_DATA, buf, 2);
+
+    return res < 0 ? res : MCUPR_RES_OK;
+}
+
+int mcupr_i2c_read_block_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t reg,
+                              uint8_t *data)
+{
+    return mcupr_i2c_smbus(bus, dev, 1, reg, MCUPR_SMBUS_BLOCK_DATA, data,
+                           MCUPR_I2C_SMBUS_BLOCK_MAX);
+}
+
+mcupr_result_t mcupr_i2c_write_block_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                          uint8_t reg, const uint8_t *data, uint32_t length)
+{
+    int res;
+
+    res = mcupr_i2c_smbus(bus, dev, 0, reg, MCUPR_SMBUS_BLOCK_DATA, (uint8_t *)data, length);
+
+    return res < 0 ? res : MCUPR_RES_OK;
+}
+
+int mcupr_i2c_read_i2c_block_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t reg,
+                                  uint8_t *data, uint32_t length)
+{
+    return mcupr_i2c_smbus(bus, dev, 1, reg, MCUPR_SMBUS_I2C_BLOCK_DATA, data, length);
+}
+
+mcupr_result_t mcupr_i2c_write_i2c_block_data(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                              uint8_t reg, const uint8_t *data, uint32_t length)
+{
+    int res;
+
+    res = mcupr_i2c_smbus(bus, dev, 0, reg, MCUPR_SMBUS_I2C_BLOCK_DATA, (uint8_t *)data, length);
+
+    return res < 0 ? res : MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_i2c_set_freq(mcupr_i2c_bus_t *bus, uint32_t freq)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (bus->ops->set_freq == NULL) {
+        return MCUPR_RES_NOT_SUPPORTED;
+    }
+    mcupr_i2c_lock(bus);
+    mcupr_result_t res = (*bus->ops->set_freq)(bus, freq);
+    mcupr_i2c_unlock(bus);
+
+    return res;
+}
+
+mcupr_result_t mcupr_i2c_set_clock_stretch(mcupr_i2c_bus_t *bus, int enable)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (bus->ops->set_clock_stretch == NULL) {
+        return MCUPR_RES_NOT_SUPPORTED;
+    }
+    mcupr_i2c_lock(bus);
+    mcupr_result_t res = (*bus->ops->set_clock_stretch)(bus, enable);
+    mcupr_i2c_unlock(bus);
+
+    return res;
+}
@@ -0,0 +1,166 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 hanyazou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <mcu_peripheral/mcu_peripheral.h>
+#include <mcu_peripheral/log.h>
+#include "impl.h"
+
+/*
+ * I2C device discovery
+ */
+
+#define I2C_SCAN_MAX_BUSES 64
+
+struct i2c_scan_job {
+    pthread_t thread;
+    int started;
+    mcupr_i2c_scan_result_t *result;
+};
+
+static int i2c_scan_use_quick(int addr)
+{
+    /* same ranges as i2cdetect, a quick write may set the write protection of EEPROMs */
+    return !((0x30 <= addr && addr <= 0x37) || (0x50 <= addr && addr <= 0x5f));
+}
+
+static int i2c_scan_probe(mcupr_i2c_bus_t *bus, int addr)
+{
+    mcupr_i2c_device_t dev;
+    uint8_t tmp;
+    int res;
+    int quick = i2c_scan_use_quick(addr);
+
+    if (bus->ops->probe != NULL) {
+        mcupr_i2c_lock(bus);
+        res = (*bus->ops->probe)(bus, addr, quick);
+        mcupr_i2c_unlock(bus);
+        return res;
+    }
+
+    /* zero length write or one byte read through the generic calls */
+    res = mcupr_i2c_open(bus, &dev, addr);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    if (quick) {
+        res = mcupr_i2c_write(bus, dev, &tmp, 0);
+    } else {
+        res = mcupr_i2c_read(bus, dev, &tmp, 1);
+    }
+    mcupr_i2c_close(bus, dev);
+
+    return (res < 0) ? 0 : 1;
+}
+
+mcupr_result_t mcupr_i2c_scan_bus(mcupr_i2c_bus_t *bus, mcupr_i2c_scan_result_t *result)
+{
+    int addr, res;
+
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    memset(result->present, 0, sizeof(result->present));
+    memset(result->busy, 0, sizeof(result->busy));
+
+    for (addr = MCUPR_I2C_SCAN_FIRST; addr <= MCUPR_I2C_SCAN_LAST; addr++) {
+        res = i2c_scan_probe(bus, addr);
+        if (res == MCUPR_RES_BUSY) {
+            result->busy[addr >> 3] |= 1 << (addr & 7);
+        } else if (res == 1) {
+            result->present[addr >> 3] |= 1 << (addr & 7);
+        } else if (res < 0) {
+            return res;
+        }
+    }
+    result->result = MCUPR_RES_OK;
+
+    return MCUPR_RES_OK;
+}
+
+static void *i2c_scan_thread(void *arg)
+{
+    struct i2c_scan_job *job = (struct i2c_scan_job *)arg;
+    mcupr_i2c_bus_params_t params;
+    mcupr_i2c_bus_t *bus;
+
+    mcupr_i2c_init_params(&params);
+    params.busnum = job->result->busnum;
+    job->result->result = mcupr_i2c_bus_create(&bus, &params);
+    if (job->result->result != MCUPR_RES_OK) {
+        return NULL;
+    }
+    job->result->result = mcupr_i2c_scan_bus(bus, job->result);
+    mcupr_i2c_bus_release(bus);
+
+    return NULL;
+}
+
+int mcupr_i2c_scan(const int *busnums, int nbuses, mcupr_i2c_scan_result_t *results, int max)
+{
+    struct i2c_scan_job jobs[I2C_SCAN_MAX_BUSES];
+    int all[I2C_SCAN_MAX_BUSES];
+    int i, err;
+
+    if (results == NULL) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    if (busnums == NULL) {
+        nbuses = mcupr_i2c_enumerate(all, I2C_SCAN_MAX_BUSES);
+        if (nbuses < 0) {
+            return nbuses;
+        }
+        busnums = all;
+    }
+    if (max < nbuses) {
+        nbuses = max;
+    }
+    if (I2C_SCAN_MAX_BUSES < nbuses) {
+        nbuses = I2C_SCAN_MAX_BUSES;
+    }
+
+    memset(jobs, 0, sizeof(jobs));
+    for (i = 0; i < nbuses; i++) {
+        memset(&results[i], 0, sizeof(results[i]));
+        results[i].busnum = busnums[i];
+        jobs[i].result = &results[i];
+        err = pthread_create(&jobs[i].thread, NULL, i2c_scan_thread, &jobs[i]);
+        if (err != 0) {
+            /* scan it from this thread instead */
+            MCUPR_WRN("%s: can't create scan thread, %s", __func__, strerror(err));
+            i2c_scan_thread(&jobs[i]);
+        } else {
+            jobs[i].started = 1;
+        }
+    }
+    for (i = 0; i < nbuses; i++) {
+        if (jobs[i].started) {
+            pthread_join(jobs[i].thread, NULL);
+        }
+    }
+
+    return nbuses;
+}
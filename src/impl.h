@@ -0,0 +1,105 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 hanyazou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MCU_PERIPHERAL_IMPL_H__
+#define MCU_PERIPHERAL_IMPL_H__
+
+#include <mcu_peripheral/mcu_peripheral.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Operations of a bus object.
+ * The mcupr_i2c_* and mcupr_spi_* functions validate the bus and call the operations of it,
+ * so buses of the platform backend and software buses can be used side by side.
+ * Optional operations are NULL if the bus doesn't support them.
+ */
+/* SMBus transaction types of the smbus operation */
+typedef enum {
+    MCUPR_SMBUS_BYTE_DATA,
+    MCUPR_SMBUS_WORD_DATA,       /* data[0] is the low byte */
+    MCUPR_SMBUS_BLOCK_DATA,
+    MCUPR_SMBUS_I2C_BLOCK_DATA,
+} mcupr_smbus_type_t;
+
+struct mcupr_i2c_ops_s {
+    void (*release)(mcupr_i2c_bus_t *bus);
+    mcupr_result_t (*open)(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t *dev, int address);
+    void (*close)(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev);
+    int (*read)(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t *data, uint32_t length);
+    int (*write)(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, const uint8_t *data,
+                 uint32_t length);
+    int (*write_read)(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,  /* optional */
+                      const uint8_t *wdata, uint32_t wlength, uint8_t *rdata, uint32_t rlength);
+    int (*transfer)(mcupr_i2c_bus_t *bus, const mcupr_i2c_msg_t *msgs, int n);  /* optional */
+    /* optional, returns the number of bytes read or written */
+    int (*smbus)(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, int read, uint8_t reg,
+                 mcupr_smbus_type_t type, uint8_t *data, uint32_t length);
+    mcupr_result_t (*set_freq)(mcupr_i2c_bus_t *bus, uint32_t freq);  /* optional */
+    mcupr_result_t (*set_clock_stretch)(mcupr_i2c_bus_t *bus, int enable);  /* optional */
+    /* optional, SMBus quick write or read byte, returns 1 if the address acknowledged */
+    int (*probe)(mcupr_i2c_bus_t *bus, int address, int quick);
+    /* optional, run queued transfers back to back and store the return values in their result */
+    void (*batch)(mcupr_i2c_bus_t *bus, mcupr_xfer_t **xfers, int n);
+};
+
+struct mcupr_spi_ops_s {
+    void (*release)(mcupr_spi_bus_t *bus);
+    mcupr_result_t (*open)(mcupr_spi_bus_t *bus, mcupr_spi_device_t *dev, int csnum);
+    void (*close)(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev);
+    int (*transfer)(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                    const uint8_t *tx_data, uint8_t *rx_data, int length);
+    /* optional, words of size bytes in host byte order, returns the number of bytes */
+    int (*transfer_words)(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, const void *tx_data,
+                          void *rx_data, int count, int size, int bits);
+    int (*message)(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,  /* optional */
+                   const mcupr_spi_segment_t *segs, int n);
+    int (*stream)(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, uint32_t length,  /* optional */
+                  mcupr_spi_fill_t fill, mcupr_spi_drain_t drain, void *user_data);
+    mcupr_result_t (*configure)(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,  /* optional */
+                                const mcupr_spi_config_t *config);
+    mcupr_result_t (*set_speed)(mcupr_spi_bus_t *bus, uint32_t speed);  /* optional */
+    mcupr_result_t (*set_mode)(mcupr_spi_bus_t *bus, mcupr_spi_mode_t mode);  /* optional */
+    void (*batch)(mcupr_spi_bus_t *bus, mcupr_xfer_t **xfers, int n);  /* optional */
+};
+
+/*
+ * SMBus transaction built from write and write_read of the bus, for buses without the smbus
+ * operation or adapters which can't do the transaction natively.
+ */
+int mcupr_i2c_smbus_emulate(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, int read, uint8_t reg,
+                            mcupr_smbus_type_t type, uint8_t *data, uint32_t length);
+
+/*
+ * Bus numbers of the I2C adapters of the backend, for mcupr_i2c_scan().
+ */
+int mcupr_i2c_enumerate(int *busnums, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* MCU_PERIPHERAL_IMPL_H__ */
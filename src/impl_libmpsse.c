@@ -24,24 +24,783 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include <mcu_peripheral/mcu_peripheral.h>
 #include <mcu_peripheral/log.h>
 #include <mpsse.h>
 
+#include "utils.h"
+#include "impl.h"
+
+#define FTDI_VID 0x0403
+#define FT232H_PID 0x6014
+#define FTDI_READ_RETRY 1000
+
 #define MIN_ADDR 0x00
 #define MAX_ADDR 0x7f
 #define VALID_ADDR(addr) ((MIN_ADDR <= (addr) && (addr) <= MAX_ADDR))
 #define VALID_HANDLE(hdl) (((hdl) & 0x01) == 0 && (MIN_ADDR * 2 <= (hdl) && (hdl) <= MAX_ADDR * 2))
 
+static mcupr_result_t mpsse_raw_write(struct mpsse_context *mpsse, uint8_t *buf, int size);
+static mcupr_result_t mpsse_raw_read(struct mpsse_context *mpsse, uint8_t *buf, int size);
+
+/*=================================================================================================
+ * GPIO API
+ *
+ * The chip is a FT232H opened in GPIO mode. GPIO 0-7 are ADBUS0-7 and GPIO 8-15 are ACBUS0-7.
+ * The state written to the ports is cached, so a write only sends the changed port byte and
+ * a push-pull output is read from the cache without a USB round trip.
+ */
+
+#define MPSSE_GPIO_PINS 16
+#define MPSSE_GPIO_POLL_US 1000  /* sampling interval of pins with an attached interrupt */
+
+struct libmpsse_gpio_line {
+    mcupr_gpio_int_edge_t edge; /* MCUPR_GPIO_INT_NONE if not attached */
+    mcupr_gpio_isr_t callback;
+    void *user_data;
+    int queued;                 /* edges are recorded in the event queue */
+    uint32_t seqno;
+};
+
+struct libmpsse_gpio_data {
+    struct mpsse_context *mpsse;
+    pthread_mutex_t lock;  /* serializes the USB access and the cached port state */
+    uint8_t value[2];  /* last written port state, [0] low byte (ADBUS), [1] high byte (ACBUS) */
+    uint8_t dir[2];    /* port direction, 1 is output */
+    uint8_t open_drain[2];  /* outputs in drive-zero mode */
+    struct libmpsse_gpio_line lines[MPSSE_GPIO_PINS];
+    uint16_t armed;    /* pins with an attached interrupt */
+    uint16_t sampled;  /* pin levels of the last poll */
+    pthread_t thread;
+    int running;       /* the poll thread is started */
+    int stopping;
+    uint32_t event_queue_size;
+    mcupr_ring_t events;  /* edge event queue, allocated by the first mcupr_gpio_attach_event() */
+};
+
+#define MPSSE_SET_DRIVE_ZERO 0x9e  /* FT232H only, outputs drive low and are tristated for 1 */
+
+static mcupr_result_t mpsse_gpio_update(struct libmpsse_gpio_data *priv,
+                                        const uint8_t value[2], const uint8_t dir[2])
+{
+    uint8_t buf[6];
+    int n = 0;
+
+    if (value[0] != priv->value[0] || dir[0] != priv->dir[0]) {
+        buf[n++] = SET_BITS_LOW;
+        buf[n++] = value[0];
+        buf[n++] = dir[0];
+    }
+    if (value[1] != priv->value[1] || dir[1] != priv->dir[1]) {
+        buf[n++] = SET_BITS_HIGH;
+        buf[n++] = value[1];
+        buf[n++] = dir[1];
+    }
+    if (n == 0) {
+        return MCUPR_RES_OK;
+    }
+    if (mpsse_raw_write(priv->mpsse, buf, n) != MCUPR_RES_OK) {
+        return MCUPR_RES_COMMUNICATION_ERROR;
+    }
+    memcpy(priv->value, value, sizeof(priv->value));
+    memcpy(priv->dir, dir, sizeof(priv->dir));
+
+    return MCUPR_RES_OK;
+}
+
+static mcupr_result_t mpsse_gpio_read_ports(struct libmpsse_gpio_data *priv, uint8_t ports[2])
+{
+    uint8_t buf[] = { GET_BITS_LOW, GET_BITS_HIGH, SEND_IMMEDIATE };
+
+    if (mpsse_raw_write(priv->mpsse, buf, sizeof(buf)) != MCUPR_RES_OK ||
+        mpsse_raw_read(priv->mpsse, ports, 2) != MCUPR_RES_OK) {
+        return MCUPR_RES_COMMUNICATION_ERROR;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_gpio_chip_create(mcupr_gpio_chip_t **chipp, mcupr_gpio_chip_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_gpio_chip_t *chip;
+    int index = params->chip;
+
+    if (index == MCUPR_UNSPECIFIED) {
+        index = 0;
+    }
+
+    res = MCUPR_ALLOC_OBJECT(chip, mcupr_gpio_chip_t, data, struct libmpsse_gpio_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+
+    priv->mpsse = OpenIndex(FTDI_VID, FT232H_PID, GPIO, 0, MSB, IFACE_A, NULL, NULL, index);
+    if (priv->mpsse == NULL || !priv->mpsse->open) {
+        if (priv->mpsse) {
+            Close(priv->mpsse);
+        }
+        mcupr_release_object(chip);
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+
+    /* all pins are inputs until opened */
+    uint8_t buf[] = { SET_BITS_LOW, 0x00, 0x00, SET_BITS_HIGH, 0x00, 0x00 };
+    if (mpsse_raw_write(priv->mpsse, buf, sizeof(buf)) != MCUPR_RES_OK) {
+        Close(priv->mpsse);
+        mcupr_release_object(chip);
+        return MCUPR_RES_COMMUNICATION_ERROR;
+    }
+
+    pthread_mutex_init(&priv->lock, NULL);
+    priv->event_queue_size = params->event_queue_size;
+
+    MCUPR_INF("%s: index=%d", __func__, index);
+    *chipp = chip;
+
+    return MCUPR_RES_OK;
+}
+
+static void libmpsse_gpio_stop_thread(struct libmpsse_gpio_data *priv);
+
+void mcupr_gpio_chip_release(mcupr_gpio_chip_t *chip)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return;
+    }
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+    libmpsse_gpio_stop_thread(priv);
+    Close(priv->mpsse);
+    if (priv->events.buf != NULL) {
+        mcupr_ring_free(&priv->events);
+    }
+    pthread_mutex_destroy(&priv->lock);
+    mcupr_release_object(chip);
+}
+
+/* Configure pins, called with the lock held */
+static mcupr_result_t mpsse_gpio_set_mode(struct libmpsse_gpio_data *priv, const int *pins,
+                                          int npins, mcupr_gpio_mode_t mode)
+{
+    uint8_t dir[2], open_drain[2];
+    int i;
+
+    if (mode == MCUPR_GPIO_MODE_INPUT_PULLUP || mode == MCUPR_GPIO_MODE_INPUT_PULLDOWN) {
+        /* FT232H has no configurable pull resistors */
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    memcpy(dir, priv->dir, sizeof(dir));
+    memcpy(open_drain, priv->open_drain, sizeof(open_drain));
+    for (i = 0; i < npins; i++) {
+        if (pins[i] < 0 || MPSSE_GPIO_PINS <= pins[i]) {
+            return MCUPR_RES_INVALID_ARGUMENT;
+        }
+        uint8_t bit = (1 << (pins[i] % 8));
+        if (mode == MCUPR_GPIO_MODE_OUTPUT || mode == MCUPR_GPIO_MODE_OUTPUT_OPEN_DRAIN) {
+            dir[pins[i] / 8] |= bit;
+        } else {
+            dir[pins[i] / 8] &= ~bit;
+        }
+        if (mode == MCUPR_GPIO_MODE_OUTPUT_OPEN_DRAIN) {
+            open_drain[pins[i] / 8] |= bit;
+        } else {
+            open_drain[pins[i] / 8] &= ~bit;
+        }
+    }
+
+    if (memcmp(open_drain, priv->open_drain, sizeof(open_drain)) != 0) {
+        uint8_t buf[] = { MPSSE_SET_DRIVE_ZERO, open_drain[0], open_drain[1] };
+        if (mpsse_raw_write(priv->mpsse, buf, sizeof(buf)) != MCUPR_RES_OK) {
+            return MCUPR_RES_COMMUNICATION_ERROR;
+        }
+        memcpy(priv->open_drain, open_drain, sizeof(priv->open_drain));
+    }
+
+    return mpsse_gpio_update(priv, priv->value, dir);
+}
+
+mcupr_result_t mcupr_gpio_open(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t *dev, int pin,
+                               mcupr_gpio_mode_t mode)
+{
+    mcupr_result_t res;
+
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+
+    pthread_mutex_lock(&priv->lock);
+    res = mpsse_gpio_set_mode(priv, &pin, 1, mode);
+    pthread_mutex_unlock(&priv->lock);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    *dev = pin;
+
+    return MCUPR_RES_OK;
+}
+
+void mcupr_gpio_close(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev)
+{
+    /* the pin keeps its direction and level */
+}
+
+/* Write value (0 or 1), only the port byte of the pin is sent */
+void mcupr_gpio_write(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev, int value)
+{
+    uint8_t port[2];
+
+    if (chip == NULL || chip->data == NULL || dev < 0 || MPSSE_GPIO_PINS <= dev) {
+        return;
+    }
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+
+    pthread_mutex_lock(&priv->lock);
+    memcpy(port, priv->value, sizeof(port));
+    if (value) {
+        port[dev / 8] |= (1 << (dev % 8));
+    } else {
+        port[dev / 8] &= ~(1 << (dev % 8));
+    }
+    mpsse_gpio_update(priv, port, priv->dir);
+    pthread_mutex_unlock(&priv->lock);
+}
+
+/* Read the pin value (0 or 1, negative on error) */
+int mcupr_gpio_read(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev)
+{
+    uint8_t cmd[] = { GET_BITS_LOW, SEND_IMMEDIATE };
+    uint8_t port;
+    int res;
+
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+    if (dev < 0 || MPSSE_GPIO_PINS <= dev) {
+        return MCUPR_RES_INVALID_HANDLE;
+    }
+    uint8_t bit = (1 << (dev % 8));
+
+    pthread_mutex_lock(&priv->lock);
+    if ((priv->dir[dev / 8] & bit) && !(priv->open_drain[dev / 8] & bit)) {
+        /* a push-pull output is at the level last written */
+        res = (priv->value[dev / 8] & bit) ? 1 : 0;
+    } else {
+        if (dev / 8) {
+            cmd[0] = GET_BITS_HIGH;
+        }
+        if (mpsse_raw_write(priv->mpsse, cmd, sizeof(cmd)) != MCUPR_RES_OK ||
+            mpsse_raw_read(priv->mpsse, &port, 1) != MCUPR_RES_OK) {
+            res = MCUPR_RES_COMMUNICATION_ERROR;
+        } else {
+            res = (port & bit) ? 1 : 0;
+        }
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return res;
+}
+
+/*
+ * The drive current of the FT232H is set in its EEPROM, not at run time.
+ */
+void mcupr_gpio_set_drive_strength(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev,
+                                   mcupr_gpio_drive_t drive)
+{
+    if (drive != MCUPR_GPIO_DRIVE_DEFAULT) {
+        MCUPR_WRN("%s: drive strength is not configurable on FT232H", __func__);
+    }
+}
+
+mcupr_result_t mcupr_gpio_group_open(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t **groupp,
+                                     const int *pins, int npins, mcupr_gpio_mode_t mode)
+{
+    mcupr_result_t res;
+    mcupr_gpio_group_t *group;
+
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+    if (npins <= 0 || MPSSE_GPIO_PINS < npins) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    res = mcupr_alloc_object((void**)&group, sizeof(*group), 0, 0);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    group->npins = npins;
+    memcpy(group->pins, pins, sizeof(*pins) * npins);
+
+    pthread_mutex_lock(&priv->lock);
+    res = mpsse_gpio_set_mode(priv, pins, npins, mode);
+    pthread_mutex_unlock(&priv->lock);
+    if (res != MCUPR_RES_OK) {
+        mcupr_release_object(group);
+        return res;
+    }
+    *groupp = group;
+
+    return MCUPR_RES_OK;
+}
+
+void mcupr_gpio_group_close(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t *group)
+{
+    mcupr_release_object(group);
+}
+
+mcupr_result_t mcupr_gpio_group_read(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t *group,
+                                     uint32_t *values)
+{
+    mcupr_result_t res;
+    uint8_t ports[2];
+    int i;
+
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+
+    pthread_mutex_lock(&priv->lock);
+    res = mpsse_gpio_read_ports(priv, ports);
+    pthread_mutex_unlock(&priv->lock);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    *values = 0;
+    for (i = 0; i < group->npins; i++) {
+        int pin = group->pins[i];
+        if (ports[pin / 8] & (1 << (pin % 8))) {
+            *values |= (1UL << i);
+        }
+    }
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_gpio_group_write(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t *group,
+                                      uint32_t mask, uint32_t values)
+{
+    mcupr_result_t res;
+    uint8_t value[2];
+    int i;
+
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+
+    pthread_mutex_lock(&priv->lock);
+    memcpy(value, priv->value, sizeof(value));
+    for (i = 0; i < group->npins; i++) {
+        int pin = group->pins[i];
+        if (!(mask & (1UL << i))) {
+            continue;
+        }
+        if (values & (1UL << i)) {
+            value[pin / 8] |= (1 << (pin % 8));
+        } else {
+            value[pin / 8] &= ~(1 << (pin % 8));
+        }
+    }
+    res = mpsse_gpio_update(priv, value, priv->dir);
+    pthread_mutex_unlock(&priv->lock);
+
+    return res;
+}
+
+/*
+ * GPIO interrupts
+ *
+ * FT232H can't notify pin changes, so a thread samples both ports every MPSSE_GPIO_POLL_US
+ * while any interrupt is attached and reports the edges found between two samples. Pulses
+ * shorter than the interval are missed and events are timestamped when the sample is taken.
+ */
+static uint64_t libmpsse_gpio_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *libmpsse_gpio_poll_thread(void *arg)
+{
+    mcupr_gpio_chip_t *chip = (mcupr_gpio_chip_t *)arg;
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+    mcupr_gpio_event_t queued[MPSSE_GPIO_PINS];
+    struct {
+        mcupr_gpio_isr_t callback;
+        void *user_data;
+        int pin;
+    } calls[MPSSE_GPIO_PINS];
+    uint8_t ports[2];
+    int pin, n, ncalls, i;
+
+    pthread_mutex_lock(&priv->lock);
+    while (!priv->stopping) {
+        n = ncalls = 0;
+        if (priv->armed && mpsse_gpio_read_ports(priv, ports) == MCUPR_RES_OK) {
+            uint64_t now = libmpsse_gpio_now();
+            uint16_t levels = ports[0] | (ports[1] << 8);
+            uint16_t changed = (levels ^ priv->sampled) & priv->armed;
+            for (pin = 0; changed && pin < MPSSE_GPIO_PINS; pin++) {
+                struct libmpsse_gpio_line *line = &priv->lines[pin];
+                if (!(changed & (1 << pin))) {
+                    continue;
+                }
+                mcupr_gpio_int_edge_t edge = (levels & (1 << pin)) ?
+                    MCUPR_GPIO_INT_RISING : MCUPR_GPIO_INT_FALLING;
+                if (line->edge != MCUPR_GPIO_INT_BOTH && line->edge != edge) {
+                    continue;
+                }
+                if (line->queued) {
+                    queued[n].pin = pin;
+                    queued[n].edge = edge;
+                    queued[n].seqno = ++line->seqno;
+                    queued[n].timestamp_ns = now;
+                    n++;
+                }
+                if (line->callback != NULL) {
+                    calls[ncalls].callback = line->callback;
+                    calls[ncalls].user_data = line->user_data;
+                    calls[ncalls].pin = pin;
+                    ncalls++;
+                }
+            }
+            priv->sampled = levels;
+        }
+        if (0 < n) {
+            /* this thread is the only producer of the queue */
+            mcupr_ring_push(&priv->events, queued, n);
+        }
+        pthread_mutex_unlock(&priv->lock);
+
+        /* callbacks are called without the lock so that they can attach or detach */
+        for (i = 0; i < ncalls; i++) {
+            (*calls[i].callback)(chip, calls[i].pin, calls[i].user_data);
+        }
+        usleep(MPSSE_GPIO_POLL_US);
+        pthread_mutex_lock(&priv->lock);
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return NULL;
+}
+
+static void libmpsse_gpio_stop_thread(struct libmpsse_gpio_data *priv)
+{
+    if (!priv->running) {
+        return;
+    }
+    pthread_mutex_lock(&priv->lock);
+    priv->stopping = 1;
+    pthread_mutex_unlock(&priv->lock);
+    pthread_join(priv->thread, NULL);
+    priv->running = 0;
+    priv->stopping = 0;
+}
+
+static mcupr_result_t libmpsse_gpio_attach(mcupr_gpio_chip_t *chip, int pin,
+                                           mcupr_gpio_int_edge_t edge, mcupr_gpio_isr_t callback,
+                                           void *user_data, int queued)
+{
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+    mcupr_result_t res = MCUPR_RES_OK;
+    uint8_t ports[2];
+
+    if (edge < MCUPR_GPIO_INT_RISING || MCUPR_GPIO_INT_BOTH < edge ||
+        pin < 0 || MPSSE_GPIO_PINS <= pin) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&priv->lock);
+    if (queued && priv->events.buf == NULL) {
+        res = mcupr_ring_init(&priv->events, sizeof(mcupr_gpio_event_t), priv->event_queue_size);
+        if (res != MCUPR_RES_OK) {
+            goto wayout;
+        }
+    }
+    if (!(priv->armed & (1 << pin))) {
+        /* take the current level so that attaching doesn't report an edge */
+        res = mpsse_gpio_read_ports(priv, ports);
+        if (res != MCUPR_RES_OK) {
+            goto wayout;
+        }
+        priv->sampled &= ~(1 << pin);
+        priv->sampled |= ((ports[0] | (ports[1] << 8)) & (1 << pin));
+    }
+    if (!priv->running) {
+        if (pthread_create(&priv->thread, NULL, libmpsse_gpio_poll_thread, chip) != 0) {
+            MCUPR_ERR("%s: can't create poll thread", __func__);
+            res = MCUPR_RES_BACKEND_FAILURE;
+            goto wayout;
+        }
+        priv->running = 1;
+    }
+    struct libmpsse_gpio_line *line = &priv->lines[pin];
+    line->edge = edge;
+    line->callback = callback;
+    line->user_data = user_data;
+    line->queued = queued;
+    priv->armed |= (1 << pin);
+
+ wayout:
+    pthread_mutex_unlock(&priv->lock);
+    return res;
+}
+
+mcupr_result_t mcupr_gpio_attach_interrupt(mcupr_gpio_chip_t *chip, int pin,
+                                           mcupr_gpio_int_edge_t edge,
+                                           mcupr_gpio_isr_t callback,
+                                           void *user_data)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (callback == NULL) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    return libmpsse_gpio_attach(chip, pin, edge, callback, user_data, 0);
+}
+
+mcupr_result_t mcupr_gpio_attach_event(mcupr_gpio_chip_t *chip, int pin, mcupr_gpio_int_edge_t edge)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+
+    return libmpsse_gpio_attach(chip, pin, edge, NULL, NULL, 1);
+}
+
+int mcupr_gpio_drain_events(mcupr_gpio_chip_t *chip, mcupr_gpio_event_t *events, int max)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+    if (priv->events.buf == NULL || max <= 0) {
+        return 0;
+    }
+
+    return mcupr_ring_pop(&priv->events, events, max);
+}
+
+uint32_t mcupr_gpio_event_overflows(mcupr_gpio_chip_t *chip)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return 0;
+    }
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+    if (priv->events.buf == NULL) {
+        return 0;
+    }
+
+    return mcupr_ring_take_dropped(&priv->events);
+}
+
+/* The poll thread keeps running until the chip is released */
+void mcupr_gpio_detach_interrupt(mcupr_gpio_chip_t *chip, int pin)
+{
+    if (chip == NULL || chip->data == NULL || pin < 0 || MPSSE_GPIO_PINS <= pin) {
+        return;
+    }
+    struct libmpsse_gpio_data *priv = (struct libmpsse_gpio_data *)chip->data;
+
+    pthread_mutex_lock(&priv->lock);
+    struct libmpsse_gpio_line *line = &priv->lines[pin];
+    line->edge = MCUPR_GPIO_INT_NONE;
+    line->callback = NULL;
+    line->user_data = NULL;
+    line->queued = 0;
+    priv->armed &= ~(1 << pin);
+    pthread_mutex_unlock(&priv->lock);
+}
+
+/*=================================================================================================
+ * I2C API
+ */
+
+/*
+ * MPSSE command buffer
+ *
+ * A transaction is built into one buffer of MPSSE commands, which is sent with one USB write.
+ * The ACK bits and the data bytes clocked in are read back with one read. The commands are
+ * the ones libmpsse's Start(), Write(), Read() and Stop() send one call at a time, each call
+ * costing a USB round trip and Read() a malloc of its result.
+ */
+#define MPSSE_I2C_CMD_SIZE 4096
+#define MPSSE_I2C_RESP_SIZE 512  /* stay well below the receive buffer of the chip */
+
+struct mpsse_i2c_resp {
+    uint8_t *data;       /* destination of a data byte, NULL for an ACK bit */
+    int ignore_nak;
+};
+
+struct mpsse_i2c_batch {
+    uint8_t cmd[MPSSE_I2C_CMD_SIZE];
+    int ncmd;
+    struct mpsse_i2c_resp resp[MPSSE_I2C_RESP_SIZE];
+    int nresp;
+    int nak;             /* a byte was not acknowledged */
+};
+
 struct libmpsse_data {
     struct mpsse_context *mpsse;
     int rd_addr;
     int wr_addr;
     int clockspeed;
     int msblsb;
+    struct mpsse_i2c_batch batch;
 };
 
-int mcupr_i2c_open(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t *dev, int addr)
+static mcupr_result_t mpsse_i2c_flush(struct libmpsse_data *priv)
+{
+    struct mpsse_i2c_batch *b = &priv->batch;
+    uint8_t resp[MPSSE_I2C_RESP_SIZE];
+    mcupr_result_t res;
+    int i;
+
+    if (b->ncmd == 0) {
+        return MCUPR_RES_OK;
+    }
+    if (0 < b->nresp) {
+        b->cmd[b->ncmd++] = SEND_IMMEDIATE;
+    }
+    res = mpsse_raw_write(priv->mpsse, b->cmd, b->ncmd);
+    if (res == MCUPR_RES_OK && 0 < b->nresp) {
+        res = mpsse_raw_read(priv->mpsse, resp, b->nresp);
+    }
+    for (i = 0; res == MCUPR_RES_OK && i < b->nresp; i++) {
+        if (b->resp[i].data != NULL) {
+            *b->resp[i].data = resp[i];
+        } else if ((resp[i] & 0x01) && !b->resp[i].ignore_nak) {
+            b->nak = 1;
+        }
+    }
+    b->ncmd = 0;
+    b->nresp = 0;
+
+    return res;
+}
+
+/* Make room for the commands, one more byte is kept for SEND_IMMEDIATE */
+static mcupr_result_t mpsse_i2c_reserve(struct libmpsse_data *priv, int ncmd, int nresp)
+{
+    struct mpsse_i2c_batch *b = &priv->batch;
+
+    if (MPSSE_I2C_CMD_SIZE < b->ncmd + ncmd + 1 || MPSSE_I2C_RESP_SIZE < b->nresp + nresp) {
+        return mpsse_i2c_flush(priv);
+    }
+    return MCUPR_RES_OK;
+}
+
+static void mpsse_i2c_pins(struct mpsse_i2c_batch *b, uint8_t value, uint8_t dir)
+{
+    b->cmd[b->ncmd++] = SET_BITS_LOW;
+    b->cmd[b->ncmd++] = value;
+    b->cmd[b->ncmd++] = dir;
+}
+
+static mcupr_result_t mpsse_i2c_start(struct libmpsse_data *priv, int repeated)
+{
+    struct mpsse_context *m = priv->mpsse;
+    struct mpsse_i2c_batch *b = &priv->batch;
+    mcupr_result_t res;
+
+    res = mpsse_i2c_reserve(priv, 9, 0);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    if (repeated) {
+        /* release SDA while SCL is low, then SCL */
+        mpsse_i2c_pins(b, m->pidle & ~SK, m->tris);
+        mpsse_i2c_pins(b, m->pidle, m->tris);
+    }
+    mpsse_i2c_pins(b, m->pstart, m->tris);
+
+    return MCUPR_RES_OK;
+}
+
+static mcupr_result_t mpsse_i2c_stop(struct libmpsse_data *priv)
+{
+    struct mpsse_context *m = priv->mpsse;
+    struct mpsse_i2c_batch *b = &priv->batch;
+    mcupr_result_t res;
+
+    res = mpsse_i2c_reserve(priv, 9, 0);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    /* pull SDA low while SCL is low, raise SCL, then release SDA */
+    mpsse_i2c_pins(b, m->pstop & ~SK, m->tris);
+    mpsse_i2c_pins(b, m->pstop, m->tris);
+    mpsse_i2c_pins(b, m->pidle, m->tris);
+
+    return MCUPR_RES_OK;
+}
+
+/* Shift a byte out and clock in the ACK bit */
+static mcupr_result_t mpsse_i2c_put(struct libmpsse_data *priv, uint8_t byte, int ignore_nak)
+{
+    struct mpsse_context *m = priv->mpsse;
+    struct mpsse_i2c_batch *b = &priv->batch;
+    mcupr_result_t res;
+
+    res = mpsse_i2c_reserve(priv, 12, 1);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    mpsse_i2c_pins(b, m->pstart & ~SK, m->tris);
+    b->cmd[b->ncmd++] = m->tx;
+    b->cmd[b->ncmd++] = 0;  /* length - 1 */
+    b->cmd[b->ncmd++] = 0;
+    b->cmd[b->ncmd++] = byte;
+    /* SDA is an input while the slave drives the ACK bit */
+    mpsse_i2c_pins(b, m->pstart & ~SK, m->tris & ~DO);
+    b->cmd[b->ncmd++] = m->rx | MPSSE_BITMODE;
+    b->cmd[b->ncmd++] = 0;  /* one bit */
+    b->resp[b->nresp].data = NULL;
+    b->resp[b->nresp].ignore_nak = ignore_nak;
+    b->nresp++;
+
+    return MCUPR_RES_OK;
+}
+
+/* Shift a byte in and send ACK or NACK */
+static mcupr_result_t mpsse_i2c_get(struct libmpsse_data *priv, uint8_t *data, int ack)
+{
+    struct mpsse_context *m = priv->mpsse;
+    struct mpsse_i2c_batch *b = &priv->batch;
+    mcupr_result_t res;
+
+    res = mpsse_i2c_reserve(priv, 15, 1);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    mpsse_i2c_pins(b, m->pstart & ~SK, m->tris & ~DO);
+    b->cmd[b->ncmd++] = m->rx;
+    b->cmd[b->ncmd++] = 0;  /* length - 1 */
+    b->cmd[b->ncmd++] = 0;
+    mpsse_i2c_pins(b, m->pstart & ~SK, m->tris);
+    b->cmd[b->ncmd++] = m->tx | MPSSE_BITMODE;
+    b->cmd[b->ncmd++] = 0;  /* one bit */
+    b->cmd[b->ncmd++] = ack ? 0x00 : 0xff;
+    b->resp[b->nresp].data = data;
+    b->resp[b->nresp].ignore_nak = 0;
+    b->nresp++;
+
+    return MCUPR_RES_OK;
+}
+
+static mcupr_result_t libmpsse_i2c_open(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t *dev, int addr)
 {
     if (bus == NULL || bus->data == NULL) {
         return MCUPR_RES_INVALID_OBJ;
@@ -59,8 +818,67 @@ int mcupr_i2c_open(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t *dev, int addr)
     return MCUPR_RES_OK;
 }
 
-int mcupr_i2c_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, unsigned char *data, uint32_t size)
+/*
+ * Build the messages into the command buffer and run them. Bytes are not acknowledged one by
+ * one before the next is sent, so the remaining messages are still clocked out after a NAK and
+ * the error is reported at the end. Transactions ended by MCUPR_I2C_M_STOP share the buffer,
+ * a batch costs one USB write and one read however many transactions it holds.
+ */
+static int mpsse_i2c_run(struct libmpsse_data *priv, const mcupr_i2c_msg_t *msgs, int n)
 {
+    mcupr_result_t res = MCUPR_RES_OK;
+    int i, started = 0;
+    uint32_t j;
+
+    priv->batch.ncmd = 0;
+    priv->batch.nresp = 0;
+    priv->batch.nak = 0;
+    for (i = 0; res == MCUPR_RES_OK && i < n; i++) {
+        const mcupr_i2c_msg_t *msg = &msgs[i];
+        int rd = (msg->flags & MCUPR_I2C_M_RD) != 0;
+        int ignore_nak = (msg->flags & MCUPR_I2C_M_IGNORE_NAK) != 0;
+        int stop = (msg->flags & MCUPR_I2C_M_STOP) != 0;
+        int more = (!stop && i + 1 < n &&
+                    (msgs[i + 1].flags & (MCUPR_I2C_M_NOSTART | MCUPR_I2C_M_RD)) ==
+                    (MCUPR_I2C_M_NOSTART | MCUPR_I2C_M_RD));
+
+        if (!started || !(msg->flags & MCUPR_I2C_M_NOSTART)) {
+            res = mpsse_i2c_start(priv, started);
+            if (res == MCUPR_RES_OK) {
+                res = mpsse_i2c_put(priv, (msg->addr << 1) | rd, ignore_nak);
+            }
+            started = 1;
+        }
+        for (j = 0; res == MCUPR_RES_OK && j < msg->length; j++) {
+            if (rd) {
+                res = mpsse_i2c_get(priv, &msg->data[j], more || j + 1 < msg->length);
+            } else {
+                res = mpsse_i2c_put(priv, msg->data[j], ignore_nak);
+            }
+        }
+        if (res == MCUPR_RES_OK && stop && i + 1 < n) {
+            res = mpsse_i2c_stop(priv);
+            started = 0;
+        }
+    }
+    if (res == MCUPR_RES_OK) {
+        res = mpsse_i2c_stop(priv);
+    }
+    if (res == MCUPR_RES_OK) {
+        res = mpsse_i2c_flush(priv);
+    }
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+
+    return priv->batch.nak ? MCUPR_RES_COMMUNICATION_ERROR : n;
+}
+
+static int libmpsse_i2c_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t *data,
+                             uint32_t size)
+{
+    mcupr_i2c_msg_t msg = { dev >> 1, MCUPR_I2C_M_RD, size, data };
+
     if (bus == NULL || bus->data == NULL) {
         return MCUPR_RES_INVALID_OBJ;
     }
@@ -69,37 +887,16 @@ int mcupr_i2c_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, unsigned char *
         return MCUPR_RES_INVALID_HANDLE;
     }
 
-    int res;
-    char rd_addr = (dev | 0x01);
-    Start(priv->mpsse);
-    if (Write(priv->mpsse, &rd_addr, 1) != MPSSE_OK) {
-        res = MCUPR_RES_BACKEND_FAILURE;
-        goto wayout;
-    }
-    if (GetAck(priv->mpsse) != ACK) {
-        res = MCUPR_RES_COMMUNICATION_ERROR;
-        goto wayout;
-    }
-    char *read_data = Read(priv->mpsse, size);
-    if(read_data == NULL) {
-        res = MCUPR_RES_COMMUNICATION_ERROR;
-    } else {
-        memcpy(data, read_data, size);
-        free(read_data);
-        res = size;
-    }
-    SendNacks(priv->mpsse);
-    Read(priv->mpsse, 1);
-    SendAcks(priv->mpsse);
-
- wayout:
-    Stop(priv->mpsse);
+    int res = mpsse_i2c_run(priv, &msg, 1);
 
-    return res;
+    return res < 0 ? res : (int)size;
 }
 
-int mcupr_i2c_write(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, const uint8_t *data, uint32_t size)
+static int libmpsse_i2c_write(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, const uint8_t *data,
+                              uint32_t size)
 {
+    mcupr_i2c_msg_t msg = { dev >> 1, 0, size, (uint8_t *)data };
+
     if (bus == NULL || bus->data == NULL) {
         return MCUPR_RES_INVALID_OBJ;
     }
@@ -108,39 +905,39 @@ int mcupr_i2c_write(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, const uint8_t
         return MCUPR_RES_INVALID_HANDLE;
     }
 
-    int res;
-    char wr_addr = (dev | 0x00);
-    Start(priv->mpsse);
-    if (Write(priv->mpsse, &wr_addr, 1) != MPSSE_OK) {
-        res = MCUPR_RES_BACKEND_FAILURE;
-        goto wayout;
-    }
-    if (GetAck(priv->mpsse) != ACK) {
-        res = MCUPR_RES_COMMUNICATION_ERROR;
-        goto wayout;
-    }
+    int res = mpsse_i2c_run(priv, &msg, 1);
 
-    if (0 < size) {
-        Write(priv->mpsse, (char*)data, size);
-        if (GetAck(priv->mpsse) != ACK) {
-            res = MCUPR_RES_COMMUNICATION_ERROR;
-            goto wayout;
-        }
+    return res < 0 ? res : (int)size;
+}
+
+static int libmpsse_i2c_write_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                   const uint8_t *wdata, uint32_t wsize,
+                                   uint8_t *rdata, uint32_t rsize)
+{
+    mcupr_i2c_msg_t msgs[2] = {
+        { dev >> 1, 0, wsize, (uint8_t *)wdata },
+        { dev >> 1, MCUPR_I2C_M_RD, rsize, rdata },
+    };
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct libmpsse_data *priv = (struct libmpsse_data *)bus->data;
+    if (priv->mpsse == NULL || !priv->mpsse->open || !VALID_HANDLE(dev)) {
+        return MCUPR_RES_INVALID_HANDLE;
     }
-    res = size;
 
- wayout:
-    Stop(priv->mpsse);
+    int res = mpsse_i2c_run(priv, msgs, 2);
 
-    return res;
+    return res < 0 ? res : (int)rsize;
 }
 
-void mcupr_i2c_close(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev)
+static void libmpsse_i2c_close(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev)
 {
     /* nothing to do here */
 }
 
-void mcupr_i2c_bus_release(mcupr_i2c_bus_t *bus)
+static void libmpsse_i2c_bus_release(mcupr_i2c_bus_t *bus)
 {
     if (bus == NULL || bus->data == NULL) {
         return;
@@ -152,6 +949,36 @@ void mcupr_i2c_bus_release(mcupr_i2c_bus_t *bus)
     free(bus);
 }
 
+static int libmpsse_i2c_transfer(mcupr_i2c_bus_t *bus, const mcupr_i2c_msg_t *msgs, int n)
+{
+    int i;
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct libmpsse_data *priv = (struct libmpsse_data *)bus->data;
+    if (priv->mpsse == NULL || !priv->mpsse->open) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    for (i = 0; i < n; i++) {
+        if (!VALID_ADDR(msgs[i].addr)) {
+            return MCUPR_RES_INVALID_ARGUMENT;
+        }
+    }
+
+    return mpsse_i2c_run(priv, msgs, n);
+}
+
+static const struct mcupr_i2c_ops_s libmpsse_i2c_ops = {
+    .release = libmpsse_i2c_bus_release,
+    .open = libmpsse_i2c_open,
+    .close = libmpsse_i2c_close,
+    .read = libmpsse_i2c_read,
+    .write = libmpsse_i2c_write,
+    .write_read = libmpsse_i2c_write_read,
+    .transfer = libmpsse_i2c_transfer,
+};
+
 mcupr_result_t mcupr_i2c_bus_create(mcupr_i2c_bus_t **busp, const mcupr_i2c_bus_params_t *params)
 {
     int i;
@@ -166,6 +993,7 @@ mcupr_result_t mcupr_i2c_bus_create(mcupr_i2c_bus_t **busp, const mcupr_i2c_bus_
     }
 
     struct libmpsse_data *priv = (struct libmpsse_data *)&bus[1];
+    bus->ops = &libmpsse_i2c_ops;
     bus->data = priv;
 
     priv->clockspeed = params->freq;
@@ -185,3 +1013,270 @@ mcupr_result_t mcupr_i2c_bus_create(mcupr_i2c_bus_t **busp, const mcupr_i2c_bus_
 
     return MCUPR_RES_OK;
 }
+
+int mcupr_i2c_enumerate(int *busnums, int max)
+{
+    /* the FTDI device is the only bus */
+    if (max < 1) {
+        return 0;
+    }
+    busnums[0] = 0;
+
+    return 1;
+}
+
+/*=================================================================================================
+ * SPI API
+ *
+ * csnum 0 is the CS pin (ADBUS3) of the MPSSE, csnum 1-4 are GPIOL0-3 (ADBUS4-7). A transfer
+ * is streamed in chunks, the chip select command is put into the same USB write as the first
+ * and the last chunk. Transfers without rx_data never read anything back.
+ */
+
+#define MPSSE_SPI_MAX_CS 5
+#define MPSSE_SPI_CS_SHIFT 3       /* ADBUS bit of csnum 0 */
+#define MPSSE_SPI_TX_CHUNK 4096    /* bytes per write of a TX only transfer */
+#define MPSSE_SPI_RX_CHUNK 1024    /* bytes per round trip, the receive buffer of the FT232H */
+
+struct libmpsse_spi_data {
+    struct mpsse_context *mpsse;
+    uint8_t cs_pins;    /* ADBUS bits of the opened chip selects */
+    uint8_t cmd[MPSSE_SPI_TX_CHUNK + 16];
+};
+
+/* pin state with all chip selects inactive, or with the one of csnum active */
+static void mpsse_spi_pins(struct libmpsse_spi_data *priv, int csnum, uint8_t *cmd)
+{
+    struct mpsse_context *m = priv->mpsse;
+    uint8_t value = (m->pidle & ~priv->cs_pins) | priv->cs_pins | CS;
+
+    if (0 <= csnum) {
+        value &= ~(1 << (MPSSE_SPI_CS_SHIFT + csnum));
+    }
+    cmd[0] = SET_BITS_LOW;
+    cmd[1] = value;
+    cmd[2] = m->tris | priv->cs_pins;
+}
+
+static void libmpsse_spi_bus_release(mcupr_spi_bus_t *bus)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return;
+    }
+    struct libmpsse_spi_data *priv = (struct libmpsse_spi_data *)bus->data;
+    Close(priv->mpsse);
+    mcupr_release_object(bus);
+}
+
+static mcupr_result_t libmpsse_spi_open(mcupr_spi_bus_t *bus, mcupr_spi_device_t *dev, int csnum)
+{
+    uint8_t cmd[3];
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct libmpsse_spi_data *priv = (struct libmpsse_spi_data *)bus->data;
+    if (csnum == MCUPR_UNSPECIFIED) {
+        csnum = 0;
+    }
+    if (csnum < 0 || MPSSE_SPI_MAX_CS <= csnum) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    /* drive the new chip select inactive */
+    priv->cs_pins |= (1 << (MPSSE_SPI_CS_SHIFT + csnum));
+    mpsse_spi_pins(priv, -1, cmd);
+    if (mpsse_raw_write(priv->mpsse, cmd, sizeof(cmd)) != MCUPR_RES_OK) {
+        return MCUPR_RES_COMMUNICATION_ERROR;
+    }
+    *dev = csnum;
+
+    return MCUPR_RES_OK;
+}
+
+static void libmpsse_spi_close(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev)
+{
+    if (bus == NULL || bus->data == NULL || dev < 1 || MPSSE_SPI_MAX_CS <= dev) {
+        return;
+    }
+    struct libmpsse_spi_data *priv = (struct libmpsse_spi_data *)bus->data;
+
+    /* CS (ADBUS3) stays an output, GPIOL pins go back to inputs */
+    priv->cs_pins &= ~(1 << (MPSSE_SPI_CS_SHIFT + dev));
+}
+
+static int libmpsse_spi_transfer(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                                 const uint8_t *tx_data, uint8_t *rx_data, int length)
+{
+    mcupr_result_t res = MCUPR_RES_OK;
+    int done, chunk, n;
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct libmpsse_spi_data *priv = (struct libmpsse_spi_data *)bus->data;
+    struct mpsse_context *m = priv->mpsse;
+    if (dev < 0 || MPSSE_SPI_MAX_CS <= dev || !(priv->cs_pins & (1 << (MPSSE_SPI_CS_SHIFT + dev)))) {
+        return MCUPR_RES_INVALID_HANDLE;
+    }
+    if (length <= 0) {
+        return length == 0 ? 0 : MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    int max = (rx_data == NULL) ? MPSSE_SPI_TX_CHUNK : MPSSE_SPI_RX_CHUNK;
+    for (done = 0; res == MCUPR_RES_OK && done < length; done += chunk) {
+        chunk = (length - done < max) ? length - done : max;
+        n = 0;
+        if (done == 0) {
+            mpsse_spi_pins(priv, dev, &priv->cmd[n]);
+            n += 3;
+        }
+        if (tx_data == NULL && rx_data != NULL) {
+            priv->cmd[n++] = m->rx;
+        } else {
+            priv->cmd[n++] = (rx_data == NULL) ? m->tx : m->txrx;
+        }
+        priv->cmd[n++] = (chunk - 1) & 0xff;
+        priv->cmd[n++] = (chunk - 1) >> 8;
+        if (tx_data != NULL) {
+            memcpy(&priv->cmd[n], &tx_data[done], chunk);
+            n += chunk;
+        } else if (rx_data == NULL) {
+            /* neither buffer, clock out zeros */
+            memset(&priv->cmd[n], 0, chunk);
+            n += chunk;
+        }
+        if (length <= done + chunk) {
+            mpsse_spi_pins(priv, -1, &priv->cmd[n]);
+            n += 3;
+        }
+        if (rx_data != NULL) {
+            priv->cmd[n++] = SEND_IMMEDIATE;
+        }
+        res = mpsse_raw_write(m, priv->cmd, n);
+        if (res == MCUPR_RES_OK && rx_data != NULL) {
+            res = mpsse_raw_read(m, &rx_data[done], chunk);
+        }
+    }
+    if (res != MCUPR_RES_OK) {
+        /* don't leave the device selected */
+        mpsse_spi_pins(priv, -1, priv->cmd);
+        mpsse_raw_write(m, priv->cmd, 3);
+        return res;
+    }
+
+    return length;
+}
+
+static mcupr_result_t libmpsse_spi_set_speed(mcupr_spi_bus_t *bus, uint32_t speed)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct libmpsse_spi_data *priv = (struct libmpsse_spi_data *)bus->data;
+    if (SetClock(priv->mpsse, speed) != MPSSE_OK) {
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+    bus->params.speed = speed;
+
+    return MCUPR_RES_OK;
+}
+
+static mcupr_result_t libmpsse_spi_set_mode(mcupr_spi_bus_t *bus, mcupr_spi_mode_t mode)
+{
+    uint8_t cmd[3];
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct libmpsse_spi_data *priv = (struct libmpsse_spi_data *)bus->data;
+    if (mode < MCUPR_SPI_MODE0 || MCUPR_SPI_MODE3 < mode) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    /* SetMode() picks the clock edges and the idle clock level of priv->mpsse->mode */
+    priv->mpsse->mode = SPI0 + mode;
+    if (SetMode(priv->mpsse, MSB) != MPSSE_OK) {
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+    mpsse_spi_pins(priv, -1, cmd);
+    if (mpsse_raw_write(priv->mpsse, cmd, sizeof(cmd)) != MCUPR_RES_OK) {
+        return MCUPR_RES_COMMUNICATION_ERROR;
+    }
+    bus->params.mode = mode;
+
+    return MCUPR_RES_OK;
+}
+
+static const struct mcupr_spi_ops_s libmpsse_spi_ops = {
+    .release = libmpsse_spi_bus_release,
+    .open = libmpsse_spi_open,
+    .close = libmpsse_spi_close,
+    .transfer = libmpsse_spi_transfer,
+    .set_speed = libmpsse_spi_set_speed,
+    .set_mode = libmpsse_spi_set_mode,
+};
+
+mcupr_result_t mcupr_spi_bus_create(mcupr_spi_bus_t **busp, mcupr_spi_bus_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_spi_bus_t *bus;
+
+    if (params->mode < MCUPR_SPI_MODE0 || MCUPR_SPI_MODE3 < params->mode) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    res = MCUPR_ALLOC_OBJECT(bus, mcupr_spi_bus_t, data, struct libmpsse_spi_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct libmpsse_spi_data *priv = (struct libmpsse_spi_data *)bus->data;
+    bus->ops = &libmpsse_spi_ops;
+    bus->params = *params;
+
+    priv->mpsse = MPSSE(SPI0 + params->mode, params->speed, MSB);
+    if (priv->mpsse == NULL || !priv->mpsse->open) {
+        if (priv->mpsse) {
+            Close(priv->mpsse);
+        }
+        mcupr_release_object(bus);
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+
+    MCUPR_INF("%s: speed=%d mode=%d", __func__, params->speed, params->mode);
+    *busp = bus;
+
+    return MCUPR_RES_OK;
+}
+
+/*=================================================================================================
+ * Helper: raw MPSSE command access
+ */
+static mcupr_result_t mpsse_raw_write(struct mpsse_context *mpsse, uint8_t *buf, int size)
+{
+    if (ftdi_write_data(&mpsse->ftdi, buf, size) != size) {
+        MCUPR_ERR("%s: ftdi_write_data failed", __func__);
+        return MCUPR_RES_COMMUNICATION_ERROR;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+static mcupr_result_t mpsse_raw_read(struct mpsse_context *mpsse, uint8_t *buf, int size)
+{
+    int n = 0;
+    int retry = 0;
+
+    while (n < size) {
+        int res = ftdi_read_data(&mpsse->ftdi, &buf[n], size - n);
+        if (res < 0) {
+            MCUPR_ERR("%s: ftdi_read_data failed", __func__);
+            return MCUPR_RES_COMMUNICATION_ERROR;
+        }
+        if (res == 0 && FTDI_READ_RETRY < ++retry) {
+            MCUPR_ERR("%s: timeout (%d/%d bytes)", __func__, n, size);
+            return MCUPR_RES_COMMUNICATION_ERROR;
+        }
+        n += res;
+    }
+
+    return MCUPR_RES_OK;
+}
@@ -29,17 +29,26 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <linux/gpio.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include <linux/spi/spidev.h>
 
 #include "utils.h"
+#include "impl.h"
 #include <mcu_peripheral/mcu_peripheral.h>
 #include <mcu_peripheral/log.h>
 
 /*
  * Implementation for linux device interfaces:
- *  - GPIO via sysfs (/sys/class/gpio)
+ *  - GPIO via /dev/gpiochipN (character device, uAPI v2),
+ *    or via sysfs (/sys/class/gpio) if the character device is not available
  *  - I2C via /dev/i2c-N
  *  - SPI via /dev/spidevN.M
  *
@@ -51,19 +60,115 @@ static mcupr_result_t sysfs_gpio_set_dir(int pin, int is_output);
 static mcupr_result_t sysfs_gpio_write_value(int pin, int value);
 static mcupr_result_t sysfs_gpio_unexport(int pin);
 static int sysfs_gpio_read_value(int pin);
+static mcupr_result_t sysfs_gpio_set_edge(int pin, mcupr_gpio_int_edge_t edge);
+static int sysfs_gpio_open_value(int pin);
+static int cdev_gpio_open_chip(int chipnum, int *nlines);
+static int cdev_gpio_request_line(int chipfd, int pin, uint64_t flags);
+static int cdev_gpio_request_lines(int chipfd, const int *pins, int npins, uint64_t flags);
+static int cdev_gpio_request_line_ex(int chipfd, const int *pins, int npins, uint64_t flags,
+                                     uint32_t event_buffer_size);
+static mcupr_result_t cdev_gpio_set_config(int fd, uint64_t flags);
+static mcupr_result_t cdev_gpio_write_value(int fd, int value);
+static int cdev_gpio_read_value(int fd);
 
 /*=================================================================================================
  * GPIO API
  */
 
+struct linuxdev_gpio_line {
+    int fd;                     /* line request fd (sysfs: value fd), -1 if not requested */
+    int opened;                 /* requested by mcupr_gpio_open() */
+    uint64_t flags;             /* GPIO_V2_LINE_FLAG_* the line was requested with */
+    uint64_t open_flags;        /* GPIO_V2_LINE_FLAG_* of mcupr_gpio_open(), restored on detach */
+    mcupr_gpio_isr_t callback;  /* non-NULL while an interrupt is attached */
+    void *user_data;
+    int queued;                 /* edges are recorded in the event queue */
+    uint32_t seqno;             /* event sequence number for sysfs */
+};
+
+#define LINUXDEV_GPIO_ARMED(line) ((line)->callback != NULL || (line)->queued)
+
 struct linuxdev_gpio_data {
-    int dummy;
+    int chipnum;
+    int fd;          /* /dev/gpiochipN, or -1 if the sysfs interface is used */
+    int nlines;
+    struct linuxdev_gpio_line *lines;
+    pthread_mutex_t lock;
+    pthread_t thread;
+    int epfd;        /* epoll fd of the event thread, -1 until the first interrupt is attached */
+    int wakefd;      /* eventfd to stop the event thread */
+    uint32_t event_queue_size;
+    mcupr_ring_t events;  /* edge event queue, allocated by the first mcupr_gpio_attach_event() */
 };
 
+#define LINUXDEV_GPIO_WAKE_TOKEN UINT32_MAX
+#define LINUXDEV_GPIO_EVENT_BUFFER_SIZE 1024
+#define LINUXDEV_GPIO_EVENT_BATCH 64
+
+static uint64_t cdev_gpio_mode_flags(mcupr_gpio_mode_t mode)
+{
+    switch (mode) {
+    case MCUPR_GPIO_MODE_OUTPUT:
+        return GPIO_V2_LINE_FLAG_OUTPUT;
+    case MCUPR_GPIO_MODE_OUTPUT_OPEN_DRAIN:
+        return GPIO_V2_LINE_FLAG_OUTPUT | GPIO_V2_LINE_FLAG_OPEN_DRAIN;
+    case MCUPR_GPIO_MODE_INPUT_PULLUP:
+        return GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+    case MCUPR_GPIO_MODE_INPUT_PULLDOWN:
+        return GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+    case MCUPR_GPIO_MODE_INPUT:
+    default:
+        return GPIO_V2_LINE_FLAG_INPUT;
+    }
+}
+
+static uint64_t cdev_gpio_edge_flags(mcupr_gpio_int_edge_t edge)
+{
+    switch (edge) {
+    case MCUPR_GPIO_INT_RISING:
+        return GPIO_V2_LINE_FLAG_EDGE_RISING;
+    case MCUPR_GPIO_INT_FALLING:
+        return GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    case MCUPR_GPIO_INT_BOTH:
+        return GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    default:
+        return 0;
+    }
+}
+
+/* Make sure lines[pin] exists. The table is fixed for gpiochip and grows on demand for sysfs. */
+static mcupr_result_t linuxdev_gpio_get_line(struct linuxdev_gpio_data *priv, int pin)
+{
+    int i;
+
+    if (pin < 0) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    if (pin < priv->nlines) {
+        return MCUPR_RES_OK;
+    }
+    if (0 <= priv->fd) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    struct linuxdev_gpio_line *lines = realloc(priv->lines, sizeof(*lines) * (pin + 1));
+    if (lines == NULL) {
+        MCUPR_ERR("%s: memory allocation failed", __func__);
+        return MCUPR_RES_NOMEM;
+    }
+    for (i = priv->nlines; i <= pin; i++) {
+        memset(&lines[i], 0, sizeof(lines[i]));
+        lines[i].fd = -1;
+    }
+    priv->lines = lines;
+    priv->nlines = pin + 1;
+
+    return MCUPR_RES_OK;
+}
+
 mcupr_result_t mcupr_gpio_chip_create(mcupr_gpio_chip_t **chipp, mcupr_gpio_chip_params_t *params)
 {
     mcupr_gpio_chip_t *chip;
-    mcupr_result_t result = MCUPR_RES_UNKNOWN;
+    int i;
 
     /* Allocate chip object */
     chip = calloc(1, sizeof(mcupr_gpio_chip_t) + sizeof(struct linuxdev_gpio_data));
@@ -74,6 +179,31 @@ mcupr_result_t mcupr_gpio_chip_create(mcupr_gpio_chip_t **chipp, mcupr_gpio_chip
 
     struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)&chip[1];
     chip->data = priv;
+    priv->chipnum = params->chip;
+    if (priv->chipnum == MCUPR_UNSPECIFIED) {
+        priv->chipnum = 0;
+    }
+    pthread_mutex_init(&priv->lock, NULL);
+    priv->epfd = -1;
+    priv->wakefd = -1;
+    priv->event_queue_size = params->event_queue_size;
+
+    priv->fd = cdev_gpio_open_chip(priv->chipnum, &priv->nlines);
+    if (priv->fd < 0) {
+        MCUPR_INF("%s: gpiochip%d is not available, use sysfs", __func__, priv->chipnum);
+        priv->nlines = 0;
+    } else {
+        priv->lines = calloc(priv->nlines, sizeof(*priv->lines));
+        if (priv->lines == NULL) {
+            MCUPR_ERR("%s: memory allocation failed", __func__);
+            close(priv->fd);
+            free(chip);
+            return MCUPR_RES_NOMEM;
+        }
+        for (i = 0; i < priv->nlines; i++) {
+            priv->lines[i].fd = -1;
+        }
+    }
 
     *chipp = chip;
 
@@ -83,9 +213,52 @@ mcupr_result_t mcupr_gpio_chip_create(mcupr_gpio_chip_t **chipp, mcupr_gpio_chip
 mcupr_result_t mcupr_gpio_open(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t *dev, int pin,
                                mcupr_gpio_mode_t mode)
 {
-    (void)chip; // not used in sysfs example
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
     mcupr_result_t result = MCUPR_RES_UNKNOWN;
 
+    if (0 <= priv->fd) {
+        if (pin < 0 || priv->nlines <= pin) {
+            return MCUPR_RES_INVALID_ARGUMENT;
+        }
+        pthread_mutex_lock(&priv->lock);
+        struct linuxdev_gpio_line *line = &priv->lines[pin];
+        uint64_t flags = cdev_gpio_mode_flags(mode);
+        if (LINUXDEV_GPIO_ARMED(line)) {
+            if (flags & GPIO_V2_LINE_FLAG_OUTPUT) {
+                /* the kernel detects edges on inputs only */
+                pthread_mutex_unlock(&priv->lock);
+                return MCUPR_RES_BUSY;
+            }
+            /* keep edge detection of an attached interrupt */
+            flags |= (line->flags & (GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING));
+        }
+        if (0 <= line->fd) {
+            result = cdev_gpio_set_config(line->fd, flags);
+        } else {
+            line->fd = cdev_gpio_request_line(priv->fd, pin, flags);
+            result = (0 <= line->fd) ? MCUPR_RES_OK : MCUPR_RES_IO_ERROR;
+        }
+        if (result == MCUPR_RES_OK) {
+            line->flags = flags;
+            line->open_flags = cdev_gpio_mode_flags(mode);
+            line->opened = 1;
+        }
+        pthread_mutex_unlock(&priv->lock);
+        if (result != MCUPR_RES_OK) {
+            MCUPR_ERR("%s: failed to request line %d", __func__, pin);
+            return result;
+        }
+        *dev = pin;
+        return MCUPR_RES_OK;
+    }
+
+    if (mode == MCUPR_GPIO_MODE_OUTPUT_OPEN_DRAIN) {
+        /* sysfs has no open drain setting */
+        return MCUPR_RES_NOT_SUPPORTED;
+    }
     result = sysfs_gpio_export(pin);
     if (result != MCUPR_RES_OK) {
         MCUPR_ERR("%s: failed to export", __func__);
@@ -99,28 +272,562 @@ mcupr_result_t mcupr_gpio_open(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t *dev
 
 void mcupr_gpio_close(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev)
 {
-    (void)chip;
-    (void)dev;
+    if (chip == NULL || chip->data == NULL) {
+        return;
+    }
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+
+    if (priv->fd < 0 || dev < 0 || priv->nlines <= dev) {
+        return;
+    }
+    pthread_mutex_lock(&priv->lock);
+    struct linuxdev_gpio_line *line = &priv->lines[dev];
+    line->opened = 0;
+    line->open_flags = 0;
+    if (0 <= line->fd && !LINUXDEV_GPIO_ARMED(line)) {
+        /* the line stays requested while an interrupt is attached */
+        close(line->fd);
+        line->fd = -1;
+    }
+    pthread_mutex_unlock(&priv->lock);
 }
 
 /* Write value (0 or 1) */
 void mcupr_gpio_write(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev, int value)
 {
-    (void)chip; // not used
+    if (chip == NULL || chip->data == NULL) {
+        return;
+    }
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+
+    if (0 <= priv->fd) {
+        if (0 <= dev && dev < priv->nlines) {
+            /* the fd of the line changes when an interrupt is attached */
+            pthread_mutex_lock(&priv->lock);
+            cdev_gpio_write_value(priv->lines[dev].fd, value);
+            pthread_mutex_unlock(&priv->lock);
+        }
+        return;
+    }
     sysfs_gpio_write_value((int)dev, value);
 }
 
 /* Read the pin value (0 or 1, -1 on error) */
 int mcupr_gpio_read(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev)
 {
-    (void)chip; // not used
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+
+    if (0 <= priv->fd) {
+        if (dev < 0 || priv->nlines <= dev) {
+            return MCUPR_RES_INVALID_HANDLE;
+        }
+        pthread_mutex_lock(&priv->lock);
+        int value = cdev_gpio_read_value(priv->lines[dev].fd);
+        pthread_mutex_unlock(&priv->lock);
+        return value;
+    }
     return sysfs_gpio_read_value((int)dev);
 }
 
-/* Optionally unexport the pin if desired. */
+struct linuxdev_gpio_group_data {
+    int fd;  /* line request fd holding all lines of the group, -1 for sysfs */
+};
+
+mcupr_result_t mcupr_gpio_group_open(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t **groupp,
+                                     const int *pins, int npins, mcupr_gpio_mode_t mode)
+{
+    mcupr_result_t res;
+    mcupr_gpio_group_t *group;
+    int i;
+
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+    if (npins <= 0 || MCUPR_GPIO_GROUP_MAX < npins) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    for (i = 0; i < npins; i++) {
+        if (0 <= priv->fd && (pins[i] < 0 || priv->nlines <= pins[i])) {
+            return MCUPR_RES_INVALID_ARGUMENT;
+        }
+    }
+
+    res = MCUPR_ALLOC_OBJECT(group, mcupr_gpio_group_t, data, struct linuxdev_gpio_group_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct linuxdev_gpio_group_data *gpriv = (struct linuxdev_gpio_group_data *)group->data;
+    group->npins = npins;
+    memcpy(group->pins, pins, sizeof(*pins) * npins);
+    gpriv->fd = -1;
+
+    if (0 <= priv->fd) {
+        gpriv->fd = cdev_gpio_request_lines(priv->fd, pins, npins, cdev_gpio_mode_flags(mode));
+        if (gpriv->fd < 0) {
+            MCUPR_ERR("%s: failed to request %d lines", __func__, npins);
+            mcupr_release_object(group);
+            return MCUPR_RES_IO_ERROR;
+        }
+    } else if (mode == MCUPR_GPIO_MODE_OUTPUT_OPEN_DRAIN) {
+        mcupr_release_object(group);
+        return MCUPR_RES_NOT_SUPPORTED;
+    } else {
+        for (i = 0; i < npins; i++) {
+            res = sysfs_gpio_export(pins[i]);
+            if (res == MCUPR_RES_OK) {
+                res = sysfs_gpio_set_dir(pins[i], mode == MCUPR_GPIO_MODE_OUTPUT);
+            }
+            if (res != MCUPR_RES_OK) {
+                MCUPR_ERR("%s: failed to export %d", __func__, pins[i]);
+                mcupr_release_object(group);
+                return res;
+            }
+        }
+    }
+    *groupp = group;
+
+    return MCUPR_RES_OK;
+}
+
+void mcupr_gpio_group_close(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t *group)
+{
+    if (group == NULL || group->data == NULL) {
+        return;
+    }
+    struct linuxdev_gpio_group_data *gpriv = (struct linuxdev_gpio_group_data *)group->data;
+    if (0 <= gpriv->fd) {
+        close(gpriv->fd);
+    }
+    mcupr_release_object(group);
+}
+
+mcupr_result_t mcupr_gpio_group_read(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t *group,
+                                     uint32_t *values)
+{
+    int i;
+
+    if (group == NULL || group->data == NULL) {
+        return MCUPR_RES_INVALID_HANDLE;
+    }
+    struct linuxdev_gpio_group_data *gpriv = (struct linuxdev_gpio_group_data *)group->data;
+
+    if (0 <= gpriv->fd) {
+        struct gpio_v2_line_values lv;
+        lv.mask = ((uint64_t)1 << group->npins) - 1;
+        lv.bits = 0;
+        if (ioctl(gpriv->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &lv) < 0) {
+            MCUPR_DBG("%s: ioctl GPIO_V2_LINE_GET_VALUES_IOCTL, %s", __func__, strerror(errno));
+            return MCUPR_RES_IO_ERROR;
+        }
+        *values = (uint32_t)lv.bits;
+        return MCUPR_RES_OK;
+    }
+
+    /* sysfs has no way to access several pins at once */
+    *values = 0;
+    for (i = 0; i < group->npins; i++) {
+        int value = sysfs_gpio_read_value(group->pins[i]);
+        if (value < 0) {
+            return value;
+        }
+        *values |= ((uint32_t)value << i);
+    }
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_gpio_group_write(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t *group,
+                                      uint32_t mask, uint32_t values)
+{
+    int i;
+
+    if (group == NULL || group->data == NULL) {
+        return MCUPR_RES_INVALID_HANDLE;
+    }
+    struct linuxdev_gpio_group_data *gpriv = (struct linuxdev_gpio_group_data *)group->data;
+
+    if (0 <= gpriv->fd) {
+        struct gpio_v2_line_values lv;
+        lv.mask = mask;
+        lv.bits = values;
+        if (ioctl(gpriv->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &lv) < 0) {
+            MCUPR_DBG("%s: ioctl GPIO_V2_LINE_SET_VALUES_IOCTL, %s", __func__, strerror(errno));
+            return MCUPR_RES_IO_ERROR;
+        }
+        return MCUPR_RES_OK;
+    }
+
+    for (i = 0; i < group->npins; i++) {
+        if (mask & (1UL << i)) {
+            sysfs_gpio_write_value(group->pins[i], (values >> i) & 1);
+        }
+    }
+
+    return MCUPR_RES_OK;
+}
+
+/*
+ * GPIO interrupts
+ *
+ * All armed lines of a chip are watched by one event thread with epoll. Line events of
+ * the character device are read in bulk, so a burst of edges costs one read() and the
+ * callbacks are invoked back to back, or the whole batch is copied into the event queue.
+ * On sysfs the value file is polled with POLLPRI and the event is timestamped on wakeup.
+ */
+static void linuxdev_gpio_dispatch(mcupr_gpio_chip_t *chip, int pin)
+{
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+    struct gpio_v2_line_event events[LINUXDEV_GPIO_EVENT_BATCH];
+    mcupr_gpio_event_t queued[LINUXDEV_GPIO_EVENT_BATCH];
+    mcupr_gpio_isr_t callback;
+    void *user_data;
+    int i, n;
+
+    pthread_mutex_lock(&priv->lock);
+    if (priv->nlines <= pin || priv->lines[pin].fd < 0) {
+        pthread_mutex_unlock(&priv->lock);
+        return;
+    }
+    struct linuxdev_gpio_line *line = &priv->lines[pin];
+    if (0 <= priv->fd) {
+        ssize_t res = read(line->fd, events, sizeof(events));
+        n = (res < 0) ? 0 : res / sizeof(events[0]);
+        for (i = 0; i < n; i++) {
+            queued[i].pin = events[i].offset;
+            queued[i].edge = (events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE) ?
+                MCUPR_GPIO_INT_RISING : MCUPR_GPIO_INT_FALLING;
+            queued[i].seqno = events[i].line_seqno;
+            queued[i].timestamp_ns = events[i].timestamp_ns;
+        }
+    } else {
+        char buf[4] = { 0 };
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        lseek(line->fd, 0, SEEK_SET);
+        n = (read(line->fd, buf, sizeof(buf)) < 0) ? 0 : 1;
+        queued[0].pin = pin;
+        queued[0].edge = (buf[0] == '1') ? MCUPR_GPIO_INT_RISING : MCUPR_GPIO_INT_FALLING;
+        queued[0].seqno = ++line->seqno;
+        queued[0].timestamp_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+    callback = line->callback;
+    user_data = line->user_data;
+    if (line->queued) {
+        /* this thread is the only producer of the queue */
+        mcupr_ring_push(&priv->events, queued, n);
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    /* callbacks are called without the lock so that they can attach or detach */
+    for (i = 0; i < n && callback != NULL; i++) {
+        (*callback)(chip, pin, user_data);
+    }
+}
+
+static void *linuxdev_gpio_event_thread(void *arg)
+{
+    mcupr_gpio_chip_t *chip = (mcupr_gpio_chip_t *)arg;
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+    struct epoll_event evs[16];
+    int i, n;
+
+    while (1) {
+        n = epoll_wait(priv->epfd, evs, sizeof(evs) / sizeof(*evs), -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            MCUPR_ERR("%s: epoll_wait, %s", __func__, strerror(errno));
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (evs[i].data.u32 == LINUXDEV_GPIO_WAKE_TOKEN) {
+                return NULL;
+            }
+            linuxdev_gpio_dispatch(chip, (int)evs[i].data.u32);
+        }
+    }
+
+    return NULL;
+}
+
+static mcupr_result_t linuxdev_gpio_start_thread(mcupr_gpio_chip_t *chip)
+{
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+    struct epoll_event ev;
+
+    if (0 <= priv->epfd) {
+        return MCUPR_RES_OK;
+    }
+    priv->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (priv->epfd < 0) {
+        MCUPR_ERR("%s: epoll_create1, %s", __func__, strerror(errno));
+        return MCUPR_RES_IO_ERROR;
+    }
+    priv->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (priv->wakefd < 0) {
+        MCUPR_ERR("%s: eventfd, %s", __func__, strerror(errno));
+        goto fail;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = LINUXDEV_GPIO_WAKE_TOKEN;
+    if (epoll_ctl(priv->epfd, EPOLL_CTL_ADD, priv->wakefd, &ev) < 0) {
+        MCUPR_ERR("%s: epoll_ctl, %s", __func__, strerror(errno));
+        goto fail;
+    }
+    if (pthread_create(&priv->thread, NULL, linuxdev_gpio_event_thread, chip) != 0) {
+        MCUPR_ERR("%s: can't create event thread", __func__);
+        goto fail;
+    }
+
+    return MCUPR_RES_OK;
+
+ fail:
+    if (0 <= priv->wakefd) {
+        close(priv->wakefd);
+        priv->wakefd = -1;
+    }
+    close(priv->epfd);
+    priv->epfd = -1;
+    return MCUPR_RES_BACKEND_FAILURE;
+}
+
+static void linuxdev_gpio_stop_thread(mcupr_gpio_chip_t *chip)
+{
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+    uint64_t one = 1;
+
+    if (priv->epfd < 0) {
+        return;
+    }
+    if (write(priv->wakefd, &one, sizeof(one)) != sizeof(one)) {
+        MCUPR_ERR("%s: can't wake up event thread, %s", __func__, strerror(errno));
+    }
+    pthread_join(priv->thread, NULL);
+    close(priv->wakefd);
+    close(priv->epfd);
+    priv->wakefd = -1;
+    priv->epfd = -1;
+}
+
+/*
+ * Arm edge detection on a line and store the fd to be watched in line->fd, called with the
+ * lock held. On failure the line keeps its previous configuration.
+ */
+static mcupr_result_t linuxdev_gpio_arm_line(struct linuxdev_gpio_data *priv, int pin,
+                                             mcupr_gpio_int_edge_t edge)
+{
+    struct linuxdev_gpio_line *line = &priv->lines[pin];
+
+    if (priv->fd < 0) {
+        if (sysfs_gpio_export(pin) != MCUPR_RES_OK || sysfs_gpio_set_edge(pin, edge) != MCUPR_RES_OK) {
+            return MCUPR_RES_IO_ERROR;
+        }
+        if (line->fd < 0) {
+            line->fd = sysfs_gpio_open_value(pin);
+        }
+        return (0 <= line->fd) ? MCUPR_RES_OK : MCUPR_RES_IO_ERROR;
+    }
+
+    /*
+     * The line is requested again rather than reconfigured so that the kernel allocates
+     * a larger event buffer than the default of 16 events per line. The kernel doesn't
+     * hand out a line twice, so the old request has to go first and is restored if the
+     * new one fails.
+     */
+    uint64_t flags = GPIO_V2_LINE_FLAG_INPUT | cdev_gpio_edge_flags(edge);
+    flags |= (line->open_flags & (GPIO_V2_LINE_FLAG_BIAS_PULL_UP | GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN));
+    int requested = (0 <= line->fd);
+    if (requested) {
+        close(line->fd);
+    }
+    int fd = cdev_gpio_request_line_ex(priv->fd, &pin, 1, flags, LINUXDEV_GPIO_EVENT_BUFFER_SIZE);
+    if (fd < 0) {
+        line->fd = requested ? cdev_gpio_request_line(priv->fd, pin, line->flags) : -1;
+        if (requested && line->fd < 0) {
+            MCUPR_ERR("%s: can't restore line %d", __func__, pin);
+        }
+        return MCUPR_RES_IO_ERROR;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    line->fd = fd;
+    line->flags = flags;
+
+    return MCUPR_RES_OK;
+}
+
+static mcupr_result_t linuxdev_gpio_attach(mcupr_gpio_chip_t *chip, int pin,
+                                           mcupr_gpio_int_edge_t edge, mcupr_gpio_isr_t callback,
+                                           void *user_data, int queued)
+{
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+    struct epoll_event ev;
+    mcupr_result_t res;
+
+    if (cdev_gpio_edge_flags(edge) == 0) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&priv->lock);
+    res = linuxdev_gpio_get_line(priv, pin);
+    if (res != MCUPR_RES_OK) {
+        goto wayout;
+    }
+    if (queued && priv->events.buf == NULL) {
+        res = mcupr_ring_init(&priv->events, sizeof(mcupr_gpio_event_t), priv->event_queue_size);
+        if (res != MCUPR_RES_OK) {
+            goto wayout;
+        }
+    }
+    res = linuxdev_gpio_start_thread(chip);
+    if (res != MCUPR_RES_OK) {
+        goto wayout;
+    }
+    struct linuxdev_gpio_line *line = &priv->lines[pin];
+    if (LINUXDEV_GPIO_ARMED(line)) {
+        epoll_ctl(priv->epfd, EPOLL_CTL_DEL, line->fd, NULL);
+        line->callback = NULL;
+        line->queued = 0;
+    }
+    res = linuxdev_gpio_arm_line(priv, pin, edge);
+    if (res != MCUPR_RES_OK) {
+        MCUPR_ERR("%s: failed to arm line %d", __func__, pin);
+        goto wayout;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (0 <= priv->fd) ? EPOLLIN : (EPOLLPRI | EPOLLERR);
+    ev.data.u32 = pin;
+    if (epoll_ctl(priv->epfd, EPOLL_CTL_ADD, line->fd, &ev) < 0) {
+        MCUPR_ERR("%s: epoll_ctl, %s", __func__, strerror(errno));
+        res = MCUPR_RES_IO_ERROR;
+        goto wayout;
+    }
+    line->callback = callback;
+    line->user_data = user_data;
+    line->queued = queued;
+    res = MCUPR_RES_OK;
+
+ wayout:
+    pthread_mutex_unlock(&priv->lock);
+    return res;
+}
+
+mcupr_result_t mcupr_gpio_attach_interrupt(mcupr_gpio_chip_t *chip, int pin,
+                                           mcupr_gpio_int_edge_t edge,
+                                           mcupr_gpio_isr_t callback,
+                                           void *user_data)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (callback == NULL) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    return linuxdev_gpio_attach(chip, pin, edge, callback, user_data, 0);
+}
+
+mcupr_result_t mcupr_gpio_attach_event(mcupr_gpio_chip_t *chip, int pin, mcupr_gpio_int_edge_t edge)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+
+    return linuxdev_gpio_attach(chip, pin, edge, NULL, NULL, 1);
+}
+
+int mcupr_gpio_drain_events(mcupr_gpio_chip_t *chip, mcupr_gpio_event_t *events, int max)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+    if (priv->events.buf == NULL || max <= 0) {
+        return 0;
+    }
+
+    return mcupr_ring_pop(&priv->events, events, max);
+}
+
+uint32_t mcupr_gpio_event_overflows(mcupr_gpio_chip_t *chip)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return 0;
+    }
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+    if (priv->events.buf == NULL) {
+        return 0;
+    }
+
+    return mcupr_ring_take_dropped(&priv->events);
+}
+
+void mcupr_gpio_detach_interrupt(mcupr_gpio_chip_t *chip, int pin)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return;
+    }
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+
+    pthread_mutex_lock(&priv->lock);
+    if (pin < 0 || priv->nlines <= pin || !LINUXDEV_GPIO_ARMED(&priv->lines[pin])) {
+        pthread_mutex_unlock(&priv->lock);
+        return;
+    }
+    struct linuxdev_gpio_line *line = &priv->lines[pin];
+    epoll_ctl(priv->epfd, EPOLL_CTL_DEL, line->fd, NULL);
+    line->callback = NULL;
+    line->user_data = NULL;
+    line->queued = 0;
+    if (priv->fd < 0) {
+        sysfs_gpio_set_edge(pin, MCUPR_GPIO_INT_NONE);
+        close(line->fd);
+        line->fd = -1;
+    } else if (line->opened) {
+        /* back to the mode of mcupr_gpio_open(), an output starts low again */
+        if (cdev_gpio_set_config(line->fd, line->open_flags) == MCUPR_RES_OK) {
+            line->flags = line->open_flags;
+        }
+    } else {
+        close(line->fd);
+        line->fd = -1;
+    }
+    pthread_mutex_unlock(&priv->lock);
+}
+
+/* Release all lines still requested and the chip. Sysfs pins are left exported. */
 void mcupr_gpio_chip_release(mcupr_gpio_chip_t *chip)
 {
-    (void)chip; // not used
+    int i;
+
+    if (chip == NULL || chip->data == NULL) {
+        return;
+    }
+    struct linuxdev_gpio_data *priv = (struct linuxdev_gpio_data *)chip->data;
+
+    linuxdev_gpio_stop_thread(chip);
+    for (i = 0; i < priv->nlines; i++) {
+        if (0 <= priv->lines[i].fd) {
+            close(priv->lines[i].fd);
+        }
+    }
+    free(priv->lines);
+    if (priv->events.buf != NULL) {
+        mcupr_ring_free(&priv->events);
+    }
+    if (0 <= priv->fd) {
+        close(priv->fd);
+    }
+    pthread_mutex_destroy(&priv->lock);
+    memset(priv, 0, sizeof(*priv));
+    memset(chip, 0, sizeof(*chip));
+    free(chip);
 }
 
 /*=================================================================================================
@@ -129,8 +836,359 @@ void mcupr_gpio_chip_release(mcupr_gpio_chip_t *chip)
 
 struct linuxdev_i2c_data {
     int busnum;
+    int fd;      /* /dev/i2c-X shared by all devices on the bus */
+    int slave;   /* address last set by I2C_SLAVE for I2C_SMBUS, -1 if none */
+    unsigned long funcs;  /* I2C_FUNCS of the adapter */
 };
 
+/*
+ * The device handle is the 7-bit slave address itself. Every transfer names its
+ * address in struct i2c_msg, so opening a device costs neither an fd nor a syscall.
+ */
+
+static int linuxdev_i2c_rdwr(struct linuxdev_i2c_data *priv, struct i2c_msg *msgs, int n)
+{
+    struct i2c_rdwr_ioctl_data rdwr;
+
+    rdwr.msgs = msgs;
+    rdwr.nmsgs = n;
+    if (ioctl(priv->fd, I2C_RDWR, &rdwr) < 0) {
+        MCUPR_DBG("%s: ioctl I2C_RDWR, %s", __func__, strerror(errno));
+        return MCUPR_RES_IO_ERROR;
+    }
+    return n;
+}
+
+/* I2C_SMBUS has no address of its own, retarget the shared fd only when it changes */
+static mcupr_result_t linuxdev_i2c_set_slave(struct linuxdev_i2c_data *priv, int addr)
+{
+    if (priv->slave == addr) {
+        return MCUPR_RES_OK;
+    }
+    if (ioctl(priv->fd, I2C_SLAVE, addr) < 0) {
+        MCUPR_DBG("%s: ioctl I2C_SLAVE 0x%02x, %s", __func__, addr, strerror(errno));
+        priv->slave = -1;
+        /* EBUSY means a kernel driver has claimed the address */
+        return (errno == EBUSY) ? MCUPR_RES_BUSY : MCUPR_RES_IO_ERROR;
+    }
+    priv->slave = addr;
+
+    return MCUPR_RES_OK;
+}
+
+static void linuxdev_i2c_bus_release(mcupr_i2c_bus_t *bus)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return;
+    }
+    struct linuxdev_i2c_data *priv = (struct linuxdev_i2c_data *)bus->data;
+
+    if (0 <= priv->fd) {
+        close(priv->fd);
+    }
+    memset(priv, 0, sizeof(*priv));
+    memset(bus, 0, sizeof(*bus));
+    free(bus);
+}
+
+static mcupr_result_t linuxdev_i2c_open(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t *dev, int addr)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+
+    if (addr < 0 || 0x7f < addr) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    *dev = addr;
+
+    return MCUPR_RES_OK;
+}
+
+static void linuxdev_i2c_close(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev)
+{
+    /* nothing to release, the fd belongs to the bus */
+}
+
+static int linuxdev_i2c_write(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, const uint8_t *data,
+                              uint32_t size)
+{
+    struct i2c_msg msg;
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct linuxdev_i2c_data *priv = (struct linuxdev_i2c_data *)bus->data;
+    if (dev < 0) {
+        return MCUPR_RES_IO_ERROR;
+    }
+
+    msg.addr = dev;
+    msg.flags = 0;
+    msg.len = size;
+    msg.buf = (uint8_t *)data;
+    if (linuxdev_i2c_rdwr(priv, &msg, 1) < 0) {
+        return MCUPR_RES_IO_ERROR;
+    }
+    return (int)size;
+}
+
+static int linuxdev_i2c_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t *data, uint32_t size)
+{
+    struct i2c_msg msg;
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct linuxdev_i2c_data *priv = (struct linuxdev_i2c_data *)bus->data;
+    if (dev < 0) {
+        return MCUPR_RES_IO_ERROR;
+    }
+
+    msg.addr = dev;
+    msg.flags = I2C_M_RD;
+    msg.len = size;
+    msg.buf = data;
+    if (linuxdev_i2c_rdwr(priv, &msg, 1) < 0) {
+        return MCUPR_RES_IO_ERROR;
+    }
+    return (int)size;
+}
+
+static int linuxdev_i2c_write_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                   const uint8_t *wdata, uint32_t wsize,
+                                   uint8_t *rdata, uint32_t rsize)
+{
+    struct i2c_msg msgs[2];
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct linuxdev_i2c_data *priv = (struct linuxdev_i2c_data *)bus->data;
+    if (dev < 0) {
+        return MCUPR_RES_IO_ERROR;
+    }
+
+    /* one ioctl, the adapter issues a repeated start between the messages */
+    msgs[0].addr = dev;
+    msgs[0].flags = 0;
+    msgs[0].len = wsize;
+    msgs[0].buf = (uint8_t *)wdata;
+    msgs[1].addr = dev;
+    msgs[1].flags = I2C_M_RD;
+    msgs[1].len = rsize;
+    msgs[1].buf = rdata;
+    if (linuxdev_i2c_rdwr(priv, msgs, 2) < 0) {
+        return MCUPR_RES_IO_ERROR;
+    }
+    return (int)rsize;
+}
+
+static int linuxdev_i2c_transfer(mcupr_i2c_bus_t *bus, const mcupr_i2c_msg_t *msgs, int n)
+{
+    struct i2c_msg kmsgs[I2C_RDWR_IOCTL_MAX_MSGS];
+    int i, done, count;
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct linuxdev_i2c_data *priv = (struct linuxdev_i2c_data *)bus->data;
+
+    /* refuse up front rather than send part of the messages, most adapters lack NOSTART */
+    if (!(priv->funcs & I2C_FUNC_NOSTART)) {
+        for (i = 0; i < n; i++) {
+            if (msgs[i].flags & MCUPR_I2C_M_NOSTART) {
+                return MCUPR_RES_NOT_SUPPORTED;
+            }
+        }
+    }
+
+    /*
+     * Each ioctl is one transaction ended by a stop, so a message with MCUPR_I2C_M_STOP ends
+     * the ioctl rather than passing I2C_M_STOP, which most adapters ignore. The kernel takes
+     * at most I2C_RDWR_IOCTL_MAX_MSGS messages per ioctl.
+     */
+    for (done = 0; done < n; done += count) {
+        count = n - done;
+        if (I2C_RDWR_IOCTL_MAX_MSGS < count) {
+            count = I2C_RDWR_IOCTL_MAX_MSGS;
+        }
+        for (i = 0; i < count; i++) {
+            const mcupr_i2c_msg_t *msg = &msgs[done + i];
+            if (msg->flags & MCUPR_I2C_M_STOP) {
+                count = i + 1;
+            }
+            kmsgs[i].addr = msg->addr;
+            kmsgs[i].flags = 0;
+            if (msg->flags & MCUPR_I2C_M_RD) {
+                kmsgs[i].flags |= I2C_M_RD;
+            }
+            if (msg->flags & MCUPR_I2C_M_NOSTART) {
+                kmsgs[i].flags |= I2C_M_NOSTART;
+            }
+            if (msg->flags & MCUPR_I2C_M_IGNORE_NAK) {
+                kmsgs[i].flags |= I2C_M_IGNORE_NAK;
+            }
+            kmsgs[i].len = msg->length;
+            kmsgs[i].buf = msg->data;
+        }
+        if (linuxdev_i2c_rdwr(priv, kmsgs, count) < 0) {
+            return MCUPR_RES_IO_ERROR;
+        }
+    }
+
+    return n;
+}
+
+static int linuxdev_i2c_smbus(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, int read, uint8_t reg,
+                              mcupr_smbus_type_t type, uint8_t *data, uint32_t length)
+{
+    static const struct {
+        int size;
+        unsigned long rfunc, wfunc;
+    } smbus_types[] = {
+        [MCUPR_SMBUS_BYTE_DATA] = { I2C_SMBUS_BYTE_DATA, I2C_FUNC_SMBUS_READ_BYTE_DATA,
+                                    I2C_FUNC_SMBUS_WRITE_BYTE_DATA },
+        [MCUPR_SMBUS_WORD_DATA] = { I2C_SMBUS_WORD_DATA, I2C_FUNC_SMBUS_READ_WORD_DATA,
+                                    I2C_FUNC_SMBUS_WRITE_WORD_DATA },
+        [MCUPR_SMBUS_BLOCK_DATA] = { I2C_SMBUS_BLOCK_DATA, I2C_FUNC_SMBUS_READ_BLOCK_DATA,
+                                     I2C_FUNC_SMBUS_WRITE_BLOCK_DATA },
+        [MCUPR_SMBUS_I2C_BLOCK_DATA] = { I2C_SMBUS_I2C_BLOCK_DATA, I2C_FUNC_SMBUS_READ_I2C_BLOCK,
+                                         I2C_FUNC_SMBUS_WRITE_I2C_BLOCK },
+    };
+    union i2c_smbus_data smbus_data;
+    struct i2c_smbus_ioctl_data args;
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct linuxdev_i2c_data *priv = (struct linuxdev_i2c_data *)bus->data;
+    if (dev < 0) {
+        return MCUPR_RES_IO_ERROR;
+    }
+
+    if (!(priv->funcs & (read ? smbus_types[type].rfunc : smbus_types[type].wfunc))) {
+        /* the adapter can't do it, use plain I2C messages */
+        return mcupr_i2c_smbus_emulate(bus, dev, read, reg, type, data, length);
+    }
+
+    switch (type) {
+    case MCUPR_SMBUS_BYTE_DATA:
+        smbus_data.byte = data[0];
+        break;
+    case MCUPR_SMBUS_WORD_DATA:
+        smbus_data.word = data[0] | (data[1] << 8);
+        break;
+    default:
+        smbus_data.block[0] = (uint8_t)length;
+        memcpy(&smbus_data.block[1], data, read ? 0 : length);
+        break;
+    }
+    if (linuxdev_i2c_set_slave(priv, dev) != MCUPR_RES_OK) {
+        return MCUPR_RES_IO_ERROR;
+    }
+    args.read_write = read ? I2C_SMBUS_READ : I2C_SMBUS_WRITE;
+    args.command = reg;
+    args.size = smbus_types[type].size;
+    args.data = &smbus_data;
+    if (ioctl(priv->fd, I2C_SMBUS, &args) < 0) {
+        MCUPR_DBG("%s: ioctl I2C_SMBUS, %s", __func__, strerror(errno));
+        return MCUPR_RES_IO_ERROR;
+    }
+    if (!read) {
+        return (int)length;
+    }
+
+    switch (type) {
+    case MCUPR_SMBUS_BYTE_DATA:
+        data[0] = smbus_data.byte;
+        return 1;
+    case MCUPR_SMBUS_WORD_DATA:
+        data[0] = smbus_data.word & 0xff;
+        data[1] = smbus_data.word >> 8;
+        return 2;
+    default:
+        if (length < smbus_data.block[0]) {
+            return MCUPR_RES_COMMUNICATION_ERROR;
+        }
+        memcpy(data, &smbus_data.block[1], smbus_data.block[0]);
+        return smbus_data.block[0];
+    }
+}
+
+static int linuxdev_i2c_probe(mcupr_i2c_bus_t *bus, int addr, int quick)
+{
+    struct i2c_smbus_ioctl_data args;
+    union i2c_smbus_data smbus_data;
+    mcupr_result_t res;
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct linuxdev_i2c_data *priv = (struct linuxdev_i2c_data *)bus->data;
+
+    res = linuxdev_i2c_set_slave(priv, addr);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    if (quick && !(priv->funcs & I2C_FUNC_SMBUS_QUICK)) {
+        quick = 0;
+    }
+    if (!quick && !(priv->funcs & I2C_FUNC_SMBUS_READ_BYTE)) {
+        uint8_t tmp;
+        return (linuxdev_i2c_read(bus, addr, &tmp, 1) < 0) ? 0 : 1;
+    }
+    args.read_write = quick ? I2C_SMBUS_WRITE : I2C_SMBUS_READ;
+    args.command = 0;
+    args.size = quick ? I2C_SMBUS_QUICK : I2C_SMBUS_BYTE;
+    args.data = quick ? NULL : &smbus_data;
+
+    return (ioctl(priv->fd, I2C_SMBUS, &args) < 0) ? 0 : 1;
+}
+
+static const struct mcupr_i2c_ops_s linuxdev_i2c_ops = {
+    .release = linuxdev_i2c_bus_release,
+    .open = linuxdev_i2c_open,
+    .close = linuxdev_i2c_close,
+    .read = linuxdev_i2c_read,
+    .write = linuxdev_i2c_write,
+    .write_read = linuxdev_i2c_write_read,
+    .transfer = linuxdev_i2c_transfer,
+    .smbus = linuxdev_i2c_smbus,
+    .probe = linuxdev_i2c_probe,
+};
+
+static int linuxdev_i2c_compare(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+int mcupr_i2c_enumerate(int *busnums, int max)
+{
+    struct dirent *ent;
+    int n = 0;
+    char *end;
+
+    DIR *dir = opendir("/dev");
+    if (dir == NULL) {
+        MCUPR_ERR("%s: Can't open /dev, %s", __func__, strerror(errno));
+        return MCUPR_RES_NODEV;
+    }
+    while (n < max && (ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "i2c-", 4) != 0) {
+            continue;
+        }
+        long busnum = strtol(&ent->d_name[4], &end, 10);
+        if (end != &ent->d_name[4] && *end == '\0') {
+            busnums[n++] = (int)busnum;
+        }
+    }
+    closedir(dir);
+    qsort(busnums, n, sizeof(*busnums), linuxdev_i2c_compare);
+
+    return n;
+}
+
 mcupr_result_t mcupr_i2c_bus_create(mcupr_i2c_bus_t **busp, const mcupr_i2c_bus_params_t *params)
 {
     int i;
@@ -144,196 +1202,609 @@ mcupr_result_t mcupr_i2c_bus_create(mcupr_i2c_bus_t **busp, const mcupr_i2c_bus_
     }
 
     struct linuxdev_i2c_data *priv = (struct linuxdev_i2c_data *)&bus[1];
+    bus->ops = &linuxdev_i2c_ops;
     bus->data = priv;
     priv->busnum = params->busnum;
     if (priv->busnum == MCUPR_UNSPECIFIED) {
         priv->busnum = 0;
     }
+    priv->slave = -1;
+
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/i2c-%d", priv->busnum);
+    priv->fd = open(path, O_RDWR);
+    if (priv->fd < 0) {
+        MCUPR_ERR("%s: Can't open i2c device %s", __func__, path);
+        free(bus);
+        return MCUPR_RES_NODEV;
+    }
+    if (ioctl(priv->fd, I2C_FUNCS, &priv->funcs) < 0) {
+        MCUPR_DBG("%s: ioctl I2C_FUNCS, %s", __func__, strerror(errno));
+        priv->funcs = I2C_FUNC_I2C;
+    }
     *busp = bus;
 
     return MCUPR_RES_OK;
 }
 
-void mcupr_i2c_bus_release(mcupr_i2c_bus_t *bus)
+/*=================================================================================================
+ * SPI API (via /dev/spidevX.Y)
+ */
+
+#define LINUXDEV_SPI_MAX_DEVICES 16
+
+struct linuxdev_spi_device {
+    int opened;
+    int fd;
+    int csnum;
+    int own;                    /* configured with mcupr_spi_configure() */
+    mcupr_spi_config_t config;
+    uint32_t mode32;            /* SPI_IOC_WR_MODE32 value last applied to the spidev device */
+    uint32_t bad_bits;          /* word sizes the controller rejected, bit n for n + 1 bits */
+};
+
+struct linuxdev_spi_data {
+    struct linuxdev_spi_device devs[LINUXDEV_SPI_MAX_DEVICES];
+};
+
+static void linuxdev_spi_bus_release(mcupr_spi_bus_t *bus)
+{
+    mcupr_release_object(bus);
+}
+
+static struct linuxdev_spi_device *linuxdev_spi_lookup(mcupr_spi_bus_t *bus, int fd)
+{
+    struct linuxdev_spi_data *priv = (struct linuxdev_spi_data *)bus->data;
+    int i;
+
+    for (i = 0; i < LINUXDEV_SPI_MAX_DEVICES; i++) {
+        if (priv->devs[i].opened && priv->devs[i].fd == fd) {
+            return &priv->devs[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Settings of the device for the next transfer. The mode has no per-transfer field, so it is
+ * written to the spidev device when it differs from the one applied last. Speed and word size
+ * go into each spi_ioc_transfer and cost no ioctl.
+ */
+static mcupr_result_t linuxdev_spi_apply(mcupr_spi_bus_t *bus, int fd, uint32_t *speed,
+                                         uint8_t *bits)
+{
+    struct linuxdev_spi_data *priv = (struct linuxdev_spi_data *)bus->data;
+    struct linuxdev_spi_device *d = linuxdev_spi_lookup(bus, fd);
+    mcupr_spi_mode_t mode = bus->params.mode;
+    uint32_t mode32;
+    int i;
+
+    *speed = bus->params.speed;
+    *bits = 0;
+    if (d == NULL) {
+        return MCUPR_RES_OK;
+    }
+    if (d->own) {
+        if (d->config.speed != 0) {
+            *speed = d->config.speed;
+        }
+        *bits = d->config.bits_per_word;
+        mode = d->config.mode;
+    }
+    mode32 = (d->mode32 & ~(uint32_t)SPI_MODE_3) | (uint32_t)mode;
+    if (mode32 != d->mode32) {
+        if (ioctl(fd, SPI_IOC_WR_MODE32, &mode32) < 0) {
+            MCUPR_ERR("%s: ioctl SPI_IOC_WR_MODE32, %s", __func__, strerror(errno));
+            return MCUPR_RES_IO_ERROR;
+        }
+        /* other handles of the same chip select share the mode */
+        for (i = 0; i < LINUXDEV_SPI_MAX_DEVICES; i++) {
+            if (priv->devs[i].opened && priv->devs[i].csnum == d->csnum) {
+                priv->devs[i].mode32 = mode32;
+            }
+        }
+    }
+
+    return MCUPR_RES_OK;
+}
+
+static mcupr_result_t linuxdev_spi_open(mcupr_spi_bus_t *bus, mcupr_spi_device_t *dev, int csnum)
+{
+    if (csnum == MCUPR_UNSPECIFIED) {
+        char *env = getenv("MCUPR_SPI_BUSNUM");
+        if (env != NULL) {
+            MCUPR_INF("%s: cs number is \"%s\"", __func__, env);
+            csnum = strtol(env, NULL, 0);
+        }
+    }
+
+    int fd, i;
+    struct linuxdev_spi_data *priv = (struct linuxdev_spi_data *)bus->data;
+    struct linuxdev_spi_device *d = NULL;
+    uint8_t spi_bits;
+    char path[32];
+
+    for (i = 0; i < LINUXDEV_SPI_MAX_DEVICES; i++) {
+        if (!priv->devs[i].opened) {
+            d = &priv->devs[i];
+            break;
+        }
+    }
+    if (d == NULL) {
+        MCUPR_ERR("%s: too many devices", __func__);
+        return MCUPR_RES_NOMEM;
+    }
+
+    snprintf(path, sizeof(path), "/dev/spidev%d.%d", bus->params.busnum, csnum);
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        MCUPR_ERR("%s: Can' open %s, %s", __func__, path, strerror(errno));
+        return MCUPR_RES_IO_ERROR;
+    }
+
+    /* keep the flags of the device such as SPI_CS_HIGH, only the clock mode is ours */
+    uint32_t spi_mode;
+    if (ioctl(fd, SPI_IOC_RD_MODE32, &spi_mode) < 0) {
+        MCUPR_ERR("%s: ioctl SPI_IOC_RD_MODE32, %s", __func__, strerror(errno));
+        close(fd);
+        return MCUPR_RES_IO_ERROR;
+    }
+
+    uint32_t spi_speed = (uint32_t)bus->params.speed;
+    if (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &spi_speed) < 0) {
+        MCUPR_ERR("%s: ioctl SPI_IOC_WR_MAX_SPEED_HZ, %s", __func__, strerror(errno));
+        close(fd);
+        return MCUPR_RES_IO_ERROR;
+    }
+
+    memset(d, 0, sizeof(*d));
+    d->opened = 1;
+    d->fd = fd;
+    d->csnum = csnum;
+    d->mode32 = spi_mode;
+    if (linuxdev_spi_apply(bus, fd, &spi_speed, &spi_bits) != MCUPR_RES_OK) {
+        d->opened = 0;
+        close(fd);
+        return MCUPR_RES_IO_ERROR;
+    }
+
+    *dev  = fd;
+
+    return MCUPR_RES_OK;
+}
+
+static void linuxdev_spi_close(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev)
 {
-    if (bus == NULL || bus->data == NULL) {
-        return;
-    }
-    struct linuxdev_i2c_data *priv = (struct linuxdev_i2c_data *)bus->data;
+    struct linuxdev_spi_device *d = linuxdev_spi_lookup(bus, dev);
 
-    memset(priv, 0, sizeof(*priv));
-    memset(bus, 0, sizeof(*bus));
-    free(bus);
+    if (d != NULL) {
+        d->opened = 0;
+    }
+    close(dev);
 }
 
-mcupr_result_t mcupr_i2c_open(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t *dev, int addr)
+static mcupr_result_t linuxdev_spi_configure(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                                             const mcupr_spi_config_t *config)
 {
-    if (bus == NULL || bus->data == NULL) {
-        return MCUPR_RES_INVALID_OBJ;
-    }
-
-    struct linuxdev_i2c_data *priv = (struct linuxdev_i2c_data *)bus->data;
-    char path[32];
-    snprintf(path, sizeof(path), "/dev/i2c-%d", priv->busnum);
+    struct linuxdev_spi_device *d = linuxdev_spi_lookup(bus, dev);
 
-    int fd = open(path, O_RDWR);
-    if (fd < 0) {
-        MCUPR_ERR("%s: Can't open i2c device %s", __func__, path);
-        return MCUPR_RES_NODEV;
+    if (d == NULL) {
+        return MCUPR_RES_INVALID_ARGUMENT;
     }
-    if (ioctl(fd, I2C_SLAVE, addr) < 0) {
-        MCUPR_ERR("%s: ioctl I2C_SLAVE failed", __func__);
-        close(fd);
-        return MCUPR_RES_IO_ERROR;
+    d->own = (config != NULL);
+    if (config != NULL) {
+        d->config = *config;
     }
-    *dev = fd;
 
     return MCUPR_RES_OK;
 }
 
-void mcupr_i2c_close(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev)
+/* applied to the devices on their next transfer */
+static mcupr_result_t linuxdev_spi_set_speed(mcupr_spi_bus_t *bus, uint32_t speed)
 {
-    if (bus == NULL || bus->data == NULL) {
+    bus->params.speed = speed;
+    return MCUPR_RES_OK;
+}
+
+static mcupr_result_t linuxdev_spi_set_mode(mcupr_spi_bus_t *bus, mcupr_spi_mode_t mode)
+{
+    bus->params.mode = mode;
+    return MCUPR_RES_OK;
+}
+
+/* segments of a message on the stack, longer messages are allocated */
+#define LINUXDEV_SPI_MESSAGE_STACK 16
+#define LINUXDEV_SPI_BUFSIZ_DEFAULT 4096
+
+static pthread_once_t linuxdev_spi_once = PTHREAD_ONCE_INIT;
+static uint32_t linuxdev_spi_bufsiz_value = LINUXDEV_SPI_BUFSIZ_DEFAULT;
+
+static void linuxdev_spi_read_bufsiz(void)
+{
+    char buf[16];
+    ssize_t n;
+    long val;
+
+    int fd = open("/sys/module/spidev/parameters/bufsiz", O_RDONLY);
+    if (fd < 0) {
         return;
     }
-    if (0 <= dev) {
-        close(dev);
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (0 < n) {
+        buf[n] = '\0';
+        val = strtol(buf, NULL, 0);
+        if (0 < val) {
+            linuxdev_spi_bufsiz_value = (uint32_t)val;
+        }
     }
+    MCUPR_DBG("%s: spidev bufsiz is %u", __func__, linuxdev_spi_bufsiz_value);
 }
 
-int mcupr_i2c_write(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, const uint8_t *data, uint32_t size)
+/* largest number of bytes spidev accepts in one message */
+static uint32_t linuxdev_spi_bufsiz(void)
 {
-    if (bus == NULL || bus->data == NULL) {
-        return MCUPR_RES_INVALID_OBJ;
+    pthread_once(&linuxdev_spi_once, linuxdev_spi_read_bufsiz);
+    return linuxdev_spi_bufsiz_value;
+}
+
+/*
+ * Submit transfers as few SPI_IOC_MESSAGE(n) calls as the buffer of spidev allows. Messages
+ * longer than the buffer are split, and large transfers are cut into chunks. cs_change of the
+ * last transfer of a message keeps the device selected for the next message, so it is set at
+ * the splits unless the transfer there asked for the device to be deselected.
+ */
+static int linuxdev_spi_submit(int fd, const struct spi_ioc_transfer *tr, int n)
+{
+    struct spi_ioc_transfer part[LINUXDEV_SPI_MESSAGE_STACK];
+    uint32_t bufsiz = linuxdev_spi_bufsiz();
+    uint32_t room, len, off = 0, total = 0;
+    int i, np, ret;
+
+    for (i = 0; i < n; i++) {
+        total += tr[i].len;
     }
-    struct linuxdev_i2c_data *priv = (struct linuxdev_i2c_data *)bus->data;
-    if (dev < 0) {
-        return MCUPR_RES_IO_ERROR;
+    if (total <= bufsiz && n < (1 << _IOC_SIZEBITS) / (int)sizeof(*tr)) {
+        ret = ioctl(fd, SPI_IOC_MESSAGE(n), tr);
+        if (ret < 0) {
+            int err = errno;
+            MCUPR_ERR("%s: ioctl SPI_IOC_MESSAGE(%d), %s", __func__, n, strerror(err));
+            errno = err;  /* for the caller to tell unsupported settings */
+            return MCUPR_RES_IO_ERROR;
+        }
+        return ret;
     }
-    ssize_t ret = write(dev, data, size);
-    if (ret < 0) {
-        MCUPR_DBG("%s: write failed", __func__);
-        return MCUPR_RES_IO_ERROR;
+
+    total = 0;
+    i = 0;
+    while (i < n) {
+        room = bufsiz;
+        np = 0;
+        while (i < n && np < LINUXDEV_SPI_MESSAGE_STACK && (0 < room || tr[i].len == off)) {
+            len = tr[i].len - off;
+            if (room < len) {
+                len = room;
+            }
+            part[np] = tr[i];
+            if (tr[i].tx_buf != 0) {
+                part[np].tx_buf += off;
+            }
+            if (tr[i].rx_buf != 0) {
+                part[np].rx_buf += off;
+            }
+            part[np].len = len;
+            room -= len;
+            off += len;
+            np++;
+            if (off < tr[i].len) {
+                /* the rest of the transfer goes to the next message */
+                part[np - 1].cs_change = 0;
+                part[np - 1].delay_usecs = 0;
+                break;
+            }
+            off = 0;
+            i++;
+        }
+        if (i < n) {
+            part[np - 1].cs_change = (off != 0) ? 1 : !part[np - 1].cs_change;
+        }
+        ret = ioctl(fd, SPI_IOC_MESSAGE(np), part);
+        if (ret < 0) {
+            int err = errno;
+            MCUPR_ERR("%s: ioctl SPI_IOC_MESSAGE(%d), %s", __func__, np, strerror(err));
+            errno = err;
+            return MCUPR_RES_IO_ERROR;
+        }
+        total += ret;
     }
-    return (int)ret;
+
+    return total;
 }
 
-int mcupr_i2c_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t *data, uint32_t size)
+static int linuxdev_spi_transfer(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                                 const uint8_t *tx_data, uint8_t *rx_data, int length)
 {
-    if (bus == NULL || bus->data == NULL) {
-        return MCUPR_RES_INVALID_OBJ;
-    }
-    struct linuxdev_i2c_data *priv = (struct linuxdev_i2c_data *)bus->data;
-    if (dev < 0) {
-        return MCUPR_RES_IO_ERROR;
-    }
+    struct spi_ioc_transfer tr;
+    uint32_t speed;
+    uint8_t bits;
+    memset(&tr, 0, sizeof(tr));
 
-    ssize_t ret = read(dev, data, size);
-    if (ret < 0) {
-        MCUPR_DBG("%s: read failed", __func__);
+    if (linuxdev_spi_apply(bus, dev, &speed, &bits) != MCUPR_RES_OK) {
         return MCUPR_RES_IO_ERROR;
     }
-    return (int)ret;
+    tr.tx_buf = (unsigned long)tx_data;  // cast if needed for 32-bit
+    tr.rx_buf = (unsigned long)rx_data;
+    tr.len    = length;
+    tr.speed_hz = speed;
+    tr.bits_per_word = bits;
+
+    // returns the total # of bytes transferred
+    return linuxdev_spi_submit(dev, &tr, 1);
 }
 
-/*=================================================================================================
- * SPI API (via /dev/spidevX.Y)
+/*
+ * Words of 9 to 16 bits are kept in u16 and larger ones in u32 of host byte order by the SPI
+ * core, which is the layout of the buffers of the caller, so they are passed as they are.
  */
+static int linuxdev_spi_transfer_words(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                                       const void *tx_data, void *rx_data, int count, int size,
+                                       int bits)
+{
+    struct linuxdev_spi_device *d = linuxdev_spi_lookup(bus, dev);
+    struct spi_ioc_transfer tr;
+    uint32_t speed;
+    uint8_t dev_bits;
+    int ret;
 
-struct linuxdev_spi_data {
-    int dummy;
-};
+    if (d == NULL || (d->bad_bits & (1UL << (bits - 1))) || (size == 2 && bits <= 8) ||
+        (size == 4 && bits <= 16)) {
+        return MCUPR_RES_NOT_SUPPORTED;
+    }
+    if (linuxdev_spi_apply(bus, dev, &speed, &dev_bits) != MCUPR_RES_OK) {
+        return MCUPR_RES_IO_ERROR;
+    }
+    memset(&tr, 0, sizeof(tr));
+    tr.tx_buf = (unsigned long)tx_data;
+    tr.rx_buf = (unsigned long)rx_data;
+    tr.len = count * size;
+    tr.speed_hz = speed;
+    tr.bits_per_word = bits;
+
+    ret = linuxdev_spi_submit(dev, &tr, 1);
+    if (ret == MCUPR_RES_IO_ERROR && errno == EINVAL) {
+        MCUPR_INF("%s: %d bits per word not supported, sending bytes", __func__, bits);
+        d->bad_bits |= (1UL << (bits - 1));
+        return MCUPR_RES_NOT_SUPPORTED;
+    }
 
-mcupr_result_t mcupr_spi_bus_create(mcupr_spi_bus_t **busp, mcupr_spi_bus_params_t *params)
+    return ret;
+}
+
+static int linuxdev_spi_message(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                                const mcupr_spi_segment_t *segs, int n)
 {
-    mcupr_result_t res;
-    mcupr_spi_bus_t *bus;
+    struct spi_ioc_transfer stack[LINUXDEV_SPI_MESSAGE_STACK];
+    struct spi_ioc_transfer *tr = stack;
+    uint32_t speed;
+    uint8_t bits;
+    int i, ret;
 
-    /* Allocate bus object */
-    res = MCUPR_ALLOC_OBJECT(bus, mcupr_spi_bus_t, data, mcupr_spi_bus_t);
-    if (res != MCUPR_RES_OK) {
-        return res;
+    if (linuxdev_spi_apply(bus, dev, &speed, &bits) != MCUPR_RES_OK) {
+        return MCUPR_RES_IO_ERROR;
+    }
+    if (LINUXDEV_SPI_MESSAGE_STACK < n) {
+        tr = calloc(n, sizeof(*tr));
+        if (tr == NULL) {
+            MCUPR_ERR("%s: memory allocation failed", __func__);
+            return MCUPR_RES_NOMEM;
+        }
+    } else {
+        memset(tr, 0, n * sizeof(*tr));
+    }
+    for (i = 0; i < n; i++) {
+        tr[i].tx_buf = (unsigned long)segs[i].tx_data;
+        tr[i].rx_buf = (unsigned long)segs[i].rx_data;
+        tr[i].len = segs[i].length;
+        tr[i].speed_hz = (segs[i].speed_hz != 0) ? segs[i].speed_hz : speed;
+        tr[i].delay_usecs = segs[i].delay_usecs;
+        tr[i].bits_per_word = (segs[i].bits_per_word != 0) ? segs[i].bits_per_word : bits;
+        tr[i].cs_change = segs[i].cs_change;
     }
 
-    bus->params = *params;
-    struct linuxdev_spi_data *priv = (struct linuxdev_spi_data *)bus->data;
-    if (bus->params.busnum == MCUPR_UNSPECIFIED) {
-        bus->params.busnum = 0;
+    ret = linuxdev_spi_submit(dev, tr, n);
+    if (tr != stack) {
+        free(tr);
     }
-    *busp = bus;
 
-    return MCUPR_RES_OK;
+    return ret;
 }
 
-void mcupr_spi_bus_release(mcupr_spi_bus_t *bus)
-{
-    mcupr_release_object(bus);
-}
+/*
+ * Double buffered stream. A helper thread keeps one chunk on the wire while the calling thread
+ * drains the previous chunk and fills the next one.
+ */
+struct linuxdev_spi_stream {
+    int fd;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct spi_ioc_transfer tr;
+    int pending;                /* tr is waiting for or on the wire */
+    int stop;
+    int result;
+};
 
-mcupr_result_t mcupr_spi_open(mcupr_spi_bus_t *bus, mcupr_spi_device_t *dev, int csnum)
+static void *linuxdev_spi_stream_thread(void *arg)
 {
-    if (csnum == MCUPR_UNSPECIFIED) {
-        char *env = getenv("MCUPR_SPI_BUSNUM");
-        if (env != NULL) {
-            MCUPR_INF("%s: cs number is \"%s\"", __func__, env);
-            csnum = strtol(env, NULL, 0);
+    struct linuxdev_spi_stream *st = (struct linuxdev_spi_stream *)arg;
+    struct spi_ioc_transfer tr;
+    int ret;
+
+    pthread_mutex_lock(&st->lock);
+    for (;;) {
+        while (!st->pending && !st->stop) {
+            pthread_cond_wait(&st->cond, &st->lock);
+        }
+        if (!st->pending) {
+            break;
+        }
+        tr = st->tr;
+        pthread_mutex_unlock(&st->lock);
+        ret = ioctl(st->fd, SPI_IOC_MESSAGE(1), &tr);
+        if (ret < 0) {
+            MCUPR_ERR("%s: ioctl SPI_IOC_MESSAGE(1), %s", __func__, strerror(errno));
+            ret = MCUPR_RES_IO_ERROR;
         }
+        pthread_mutex_lock(&st->lock);
+        st->result = ret;
+        st->pending = 0;
+        pthread_cond_broadcast(&st->cond);
     }
+    pthread_mutex_unlock(&st->lock);
 
-    int fd;
-    struct linuxdev_spi_data *priv = (struct linuxdev_spi_data *)bus->data;
-    char path[32];
+    return NULL;
+}
 
-    snprintf(path, sizeof(path), "/dev/spidev%d.%d", bus->params.busnum, csnum);
-    fd = open(path, O_RDWR);
-    if (fd < 0) {
-        MCUPR_ERR("%s: Can' open %s, %s", __func__, path, strerror(errno));
-        return MCUPR_RES_IO_ERROR;
+static int linuxdev_spi_stream_wait(struct linuxdev_spi_stream *st)
+{
+    pthread_mutex_lock(&st->lock);
+    while (st->pending) {
+        pthread_cond_wait(&st->cond, &st->lock);
     }
+    int ret = st->result;
+    pthread_mutex_unlock(&st->lock);
 
-    uint8_t spi_mode = (uint8_t)bus->params.mode;
-    if (ioctl(fd, SPI_IOC_WR_MODE, &spi_mode) < 0) {
-        MCUPR_ERR("%s: ioctl SPI_IOC_WR_MODE, %s", __func__, strerror(errno));
-        close(fd);
+    return ret;
+}
+
+static int linuxdev_spi_stream(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, uint32_t length,
+                               mcupr_spi_fill_t fill, mcupr_spi_drain_t drain, void *user_data)
+{
+    struct linuxdev_spi_stream st;
+    struct spi_ioc_transfer tr;
+    pthread_t thread;
+    uint32_t chunk = linuxdev_spi_bufsiz();
+    uint32_t offset, len, next, speed;
+    uint8_t *buf, *tx[2], *rx[2], bits;
+    int k, ret = 0;
+
+    if (length == 0) {
+        return 0;
+    }
+    if (linuxdev_spi_apply(bus, dev, &speed, &bits) != MCUPR_RES_OK) {
         return MCUPR_RES_IO_ERROR;
     }
+    if (length < chunk) {
+        chunk = length;
+    }
+    buf = malloc(4 * chunk);
+    if (buf == NULL) {
+        MCUPR_ERR("%s: memory allocation failed", __func__);
+        return MCUPR_RES_NOMEM;
+    }
+    for (k = 0; k < 2; k++) {
+        tx[k] = &buf[k * chunk];
+        rx[k] = &buf[(2 + k) * chunk];
+    }
+    memset(&st, 0, sizeof(st));
+    st.fd = dev;
+    pthread_mutex_init(&st.lock, NULL);
+    pthread_cond_init(&st.cond, NULL);
+    if (pthread_create(&thread, NULL, linuxdev_spi_stream_thread, &st) != 0) {
+        MCUPR_ERR("%s: pthread_create failed", __func__);
+        ret = MCUPR_RES_NOMEM;
+        goto out_free;
+    }
 
-    uint32_t spi_speed = (uint32_t)bus->params.speed;
-    if (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &spi_speed) < 0) {
-        MCUPR_ERR("%s: ioctl SPI_IOC_WR_MAX_SPEED_HZ, %s", __func__, strerror(errno));
-        close(fd);
-        return MCUPR_RES_IO_ERROR;
+    len = (length < chunk) ? length : chunk;
+    if (fill != NULL) {
+        ret = (*fill)(user_data, tx[0], 0, len);
     }
+    for (k = 0, offset = 0; 0 <= ret && offset < length; k ^= 1, offset = next) {
+        next = offset + len;
+
+        /* put this chunk on the wire, the device stays selected unless it is the last one */
+        memset(&tr, 0, sizeof(tr));
+        tr.tx_buf = (fill != NULL) ? (unsigned long)tx[k] : 0;
+        tr.rx_buf = (drain != NULL) ? (unsigned long)rx[k] : 0;
+        tr.len = len;
+        tr.speed_hz = speed;
+        tr.bits_per_word = bits;
+        tr.cs_change = (next < length);
+        pthread_mutex_lock(&st.lock);
+        st.tr = tr;
+        st.pending = 1;
+        pthread_cond_broadcast(&st.cond);
+        pthread_mutex_unlock(&st.lock);
+
+        /* meanwhile drain the previous chunk and fill the next one in the other buffers */
+        if (0 < offset && drain != NULL) {
+            ret = (*drain)(user_data, rx[k ^ 1], offset - chunk, chunk);
+        }
+        len = (length - next < chunk) ? length - next : chunk;
+        if (0 <= ret && next < length && fill != NULL) {
+            ret = (*fill)(user_data, tx[k ^ 1], next, len);
+        }
 
-    *dev  = fd;
+        int res = linuxdev_spi_stream_wait(&st);
+        if (res < 0) {
+            ret = res;
+        } else if (0 <= ret && next == length && drain != NULL) {
+            ret = (*drain)(user_data, rx[k], offset, tr.len);
+        }
+    }
+    if (ret < 0 && 0 < offset && offset < length) {
+        /* aborted with the device left selected, deselect it with an empty transfer */
+        memset(&tr, 0, sizeof(tr));
+        ioctl(dev, SPI_IOC_MESSAGE(1), &tr);
+    }
 
-    return MCUPR_RES_OK;
+    pthread_mutex_lock(&st.lock);
+    st.stop = 1;
+    pthread_cond_broadcast(&st.cond);
+    pthread_mutex_unlock(&st.lock);
+    pthread_join(thread, NULL);
+ out_free:
+    pthread_cond_destroy(&st.cond);
+    pthread_mutex_destroy(&st.lock);
+    free(buf);
+
+    return (ret < 0) ? ret : (int)length;
 }
 
-void mcupr_spi_close(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev)
-{
-    close(dev);
-}
+static const struct mcupr_spi_ops_s linuxdev_spi_ops = {
+    .release = linuxdev_spi_bus_release,
+    .open = linuxdev_spi_open,
+    .close = linuxdev_spi_close,
+    .transfer = linuxdev_spi_transfer,
+    .transfer_words = linuxdev_spi_transfer_words,
+    .message = linuxdev_spi_message,
+    .stream = linuxdev_spi_stream,
+    .configure = linuxdev_spi_configure,
+    .set_speed = linuxdev_spi_set_speed,
+    .set_mode = linuxdev_spi_set_mode,
+};
 
-int mcupr_spi_transfer(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
-                       const uint8_t *tx_data, uint8_t *rx_data, int length)
+mcupr_result_t mcupr_spi_bus_create(mcupr_spi_bus_t **busp, mcupr_spi_bus_params_t *params)
 {
-    struct spi_ioc_transfer tr;
-    memset(&tr, 0, sizeof(tr));
+    mcupr_result_t res;
+    mcupr_spi_bus_t *bus;
 
-    tr.tx_buf = (unsigned long)tx_data;  // cast if needed for 32-bit
-    tr.rx_buf = (unsigned long)rx_data;
-    tr.len    = length;
-    // Other fields default to current mode, bits, speed, etc.
+    /* Allocate bus object */
+    res = MCUPR_ALLOC_OBJECT(bus, mcupr_spi_bus_t, data, struct linuxdev_spi_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
 
-    int ret = ioctl(dev, SPI_IOC_MESSAGE(1), &tr);
-    if (ret < 0) {
-        MCUPR_ERR("%s: ioctl SPI_IOC_MESSAGE(1), %s", __func__, strerror(errno));
-        return MCUPR_RES_IO_ERROR;
+    bus->ops = &linuxdev_spi_ops;
+    bus->params = *params;
+    struct linuxdev_spi_data *priv = (struct linuxdev_spi_data *)bus->data;
+    if (bus->params.busnum == MCUPR_UNSPECIFIED) {
+        bus->params.busnum = 0;
     }
+    *busp = bus;
 
-    // ret is typically the total # of bytes transferred
-    return ret;
+    return MCUPR_RES_OK;
 }
 
 /*=================================================================================================
@@ -443,3 +1914,148 @@ static int sysfs_gpio_read_value(int pin) {
     close(fd);
     return (buf[0] == '1') ? 1 : 0;
 }
+
+static mcupr_result_t sysfs_gpio_set_edge(int pin, mcupr_gpio_int_edge_t edge)
+{
+    static char *edges[] = {
+        [MCUPR_GPIO_INT_NONE] = "none",
+        [MCUPR_GPIO_INT_RISING] = "rising",
+        [MCUPR_GPIO_INT_FALLING] = "falling",
+        [MCUPR_GPIO_INT_BOTH] = "both",
+    };
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/edge", pin);
+
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        MCUPR_ERR("%s: Can't open %s, %s", __func__, path, strerror(errno));
+        return MCUPR_RES_IO_ERROR;
+    }
+    MCUPR_DBG("%s: %s %s", __func__, path, edges[edge]);
+    if (write(fd, edges[edge], strlen(edges[edge])) < 0) {
+        MCUPR_ERR("%s: Can't write %s, %s", __func__, path, strerror(errno));
+        close(fd);
+        return MCUPR_RES_IO_ERROR;
+    }
+    close(fd);
+    return MCUPR_RES_OK;
+}
+
+/* Open the value file to be polled, with the initial state already consumed */
+static int sysfs_gpio_open_value(int pin)
+{
+    char path[64];
+    char buf[4];
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/value", pin);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        MCUPR_ERR("%s: Can't open %s, %s", __func__, path, strerror(errno));
+        return -1;
+    }
+    if (read(fd, buf, sizeof(buf)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*=================================================================================================
+ * Helper: GPIO character device (/dev/gpiochipN)
+ */
+static int cdev_gpio_open_chip(int chipnum, int *nlines)
+{
+    char path[32];
+    struct gpiochip_info info;
+
+    snprintf(path, sizeof(path), "/dev/gpiochip%d", chipnum);
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        MCUPR_DBG("%s: Can't open %s, %s", __func__, path, strerror(errno));
+        return -1;
+    }
+    memset(&info, 0, sizeof(info));
+    if (ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info) < 0) {
+        MCUPR_ERR("%s: ioctl GPIO_GET_CHIPINFO_IOCTL, %s", __func__, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    MCUPR_DBG("%s: %s %s (%s), %u lines", __func__, path, info.name, info.label, info.lines);
+    *nlines = info.lines;
+
+    return fd;
+}
+
+static int cdev_gpio_request_line(int chipfd, int pin, uint64_t flags)
+{
+    return cdev_gpio_request_lines(chipfd, &pin, 1, flags);
+}
+
+static int cdev_gpio_request_lines(int chipfd, const int *pins, int npins, uint64_t flags)
+{
+    return cdev_gpio_request_line_ex(chipfd, pins, npins, flags, 0);
+}
+
+static int cdev_gpio_request_line_ex(int chipfd, const int *pins, int npins, uint64_t flags,
+                                     uint32_t event_buffer_size)
+{
+    struct gpio_v2_line_request req;
+    int i;
+
+    memset(&req, 0, sizeof(req));
+    for (i = 0; i < npins; i++) {
+        req.offsets[i] = pins[i];
+    }
+    req.num_lines = npins;
+    req.config.flags = flags;
+    req.event_buffer_size = event_buffer_size;
+    snprintf(req.consumer, sizeof(req.consumer), "mcupr");
+    if (ioctl(chipfd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+        MCUPR_ERR("%s: ioctl GPIO_V2_GET_LINE_IOCTL, %s", __func__, strerror(errno));
+        return -1;
+    }
+
+    return req.fd;
+}
+
+static mcupr_result_t cdev_gpio_set_config(int fd, uint64_t flags)
+{
+    struct gpio_v2_line_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.flags = flags;
+    if (ioctl(fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0) {
+        MCUPR_ERR("%s: ioctl GPIO_V2_LINE_SET_CONFIG_IOCTL, %s", __func__, strerror(errno));
+        return MCUPR_RES_IO_ERROR;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+static mcupr_result_t cdev_gpio_write_value(int fd, int value)
+{
+    struct gpio_v2_line_values values;
+
+    values.mask = 1;
+    values.bits = value ? 1 : 0;
+    if (ioctl(fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0) {
+        MCUPR_DBG("%s: ioctl GPIO_V2_LINE_SET_VALUES_IOCTL, %s", __func__, strerror(errno));
+        return MCUPR_RES_IO_ERROR;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+static int cdev_gpio_read_value(int fd)
+{
+    struct gpio_v2_line_values values;
+
+    values.mask = 1;
+    values.bits = 0;
+    if (ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+        MCUPR_DBG("%s: ioctl GPIO_V2_LINE_GET_VALUES_IOCTL, %s", __func__, strerror(errno));
+        return MCUPR_RES_IO_ERROR;
+    }
+
+    return (values.bits & 1) ? 1 : 0;
+}
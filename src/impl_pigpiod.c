@@ -24,65 +24,1254 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <endian.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <mcu_peripheral/mcu_peripheral.h>
 #include <mcu_peripheral/log.h>
 #include <pigpiod_if2.h>
 
-struct pigpiod_i2c_data {
+#include "utils.h"
+#include "impl.h"
+
+#define PIGPIOD_PIPE_MAX 16  /* requests sent before the responses are read */
+
+/* one command of the pigpiod socket protocol */
+struct pigpiod_req {
+    uint32_t cmd;        /* PI_CMD_*, 0 to skip the request and keep res */
+    uint32_t p1;
+    uint32_t p2;
+    const void *ext;     /* extension sent after the command */
+    uint32_t ext_len;
+    void *rdata;         /* buffer of the extended response, NULL to discard it */
+    uint32_t rlength;    /* expected size of the extended response */
+    int res;             /* result of the daemon */
+};
+
+/* pigpiod_if2 connection of a pool, checked out by one thread at a time */
+struct pigpiod_conn {
+    pthread_mutex_t lock;
     int pi;
+};
+
+struct pigpiod_pool;
+
+static struct pigpiod_pool *pigpiod_pool_get(void);
+static void pigpiod_pool_put(struct pigpiod_pool *pool);
+static struct pigpiod_conn *pigpiod_pool_checkout(struct pigpiod_pool *pool);
+static void pigpiod_pool_checkin(struct pigpiod_conn *conn);
+static int pigpiod_pool_home(struct pigpiod_pool *pool);
+static int pigpiod_pipe_connect(void);
+static mcupr_result_t pigpiod_pipe_run(int fd, struct pigpiod_req *reqs, int n);
+
+/*=================================================================================================
+ * GPIO API
+ */
+
+#define PIGPIOD_GPIO_PINS 54
+#define PIGPIOD_GPIO_USER_PINS (PI_MAX_USER_GPIO + 1)  /* pins callback_ex() can watch */
+
+struct pigpiod_gpio_line {
+    int cbid;                   /* callback_ex() id while armed */
+    mcupr_gpio_isr_t callback;  /* non-NULL while an interrupt is attached */
+    void *user_data;
+    int queued;                 /* edges are recorded in the event queue */
+    uint32_t seqno;
+};
+
+#define PIGPIOD_GPIO_ARMED(line) ((line)->callback != NULL || (line)->queued)
+
+struct pigpiod_gpio_data {
+    struct pigpiod_pool *pool;
+    mcupr_gpio_chip_t *chip;
+    pthread_mutex_t lock;
+    struct pigpiod_gpio_line lines[PIGPIOD_GPIO_USER_PINS];
+    uint32_t event_queue_size;
+    mcupr_ring_t events;  /* edge event queue, allocated by the first mcupr_gpio_attach_event() */
+    uint32_t last_tick;   /* pigpio tick of the last event */
+    uint64_t tick_ns;     /* CLOCK_MONOTONIC time of last_tick */
+};
+
+static unsigned pigpiod_gpio_mode(mcupr_gpio_mode_t mode)
+{
+    return mode == MCUPR_GPIO_MODE_OUTPUT ? PI_OUTPUT : PI_INPUT;
+}
+
+static unsigned pigpiod_gpio_pud(mcupr_gpio_mode_t mode)
+{
+    switch (mode) {
+    case MCUPR_GPIO_MODE_INPUT_PULLUP:
+        return PI_PUD_UP;
+    case MCUPR_GPIO_MODE_INPUT_PULLDOWN:
+        return PI_PUD_DOWN;
+    default:
+        return PI_PUD_OFF;
+    }
+}
+
+mcupr_result_t mcupr_gpio_chip_create(mcupr_gpio_chip_t **chipp, mcupr_gpio_chip_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_gpio_chip_t *chip;
+
+    res = MCUPR_ALLOC_OBJECT(chip, mcupr_gpio_chip_t, data, struct pigpiod_gpio_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+
+    priv->pool = pigpiod_pool_get();
+    if (priv->pool == NULL) {
+        mcupr_release_object(chip);
+        return MCUPR_RES_NODEV;
+    }
+
+    priv->chip = chip;
+    pthread_mutex_init(&priv->lock, NULL);
+    priv->event_queue_size = params->event_queue_size;
+
+    *chipp = chip;
+
+    return MCUPR_RES_OK;
+}
+
+/* Cancel the callbacks still attached and release the chip */
+void mcupr_gpio_chip_release(mcupr_gpio_chip_t *chip)
+{
+    int i;
+
+    if (chip == NULL || chip->data == NULL) {
+        return;
+    }
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+    for (i = 0; i < PIGPIOD_GPIO_USER_PINS; i++) {
+        if (PIGPIOD_GPIO_ARMED(&priv->lines[i])) {
+            callback_cancel(priv->lines[i].cbid);
+        }
+    }
+    pigpiod_pool_put(priv->pool);
+    if (priv->events.buf != NULL) {
+        mcupr_ring_free(&priv->events);
+    }
+    pthread_mutex_destroy(&priv->lock);
+    mcupr_release_object(chip);
+}
+
+mcupr_result_t mcupr_gpio_open(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t *dev, int pin,
+                               mcupr_gpio_mode_t mode)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+    if (pin < 0 || PIGPIOD_GPIO_PINS <= pin) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    if (mode == MCUPR_GPIO_MODE_OUTPUT_OPEN_DRAIN) {
+        /* pigpio has no open drain output */
+        return MCUPR_RES_NOT_SUPPORTED;
+    }
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    if (set_mode(conn->pi, pin, pigpiod_gpio_mode(mode)) != 0 ||
+        set_pull_up_down(conn->pi, pin, pigpiod_gpio_pud(mode)) != 0) {
+        pigpiod_pool_checkin(conn);
+        MCUPR_ERR("%s: failed to set mode of GPIO%d", __func__, pin);
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+    pigpiod_pool_checkin(conn);
+    *dev = pin;
+
+    return MCUPR_RES_OK;
+}
+
+void mcupr_gpio_close(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev)
+{
+    /* pigpio has nothing to release, the pin keeps its mode */
+}
+
+/* Write value (0 or 1) */
+void mcupr_gpio_write(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev, int value)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return;
+    }
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    gpio_write(conn->pi, dev, value ? 1 : 0);
+    pigpiod_pool_checkin(conn);
+}
+
+/* Read the pin value (0 or 1, negative on error) */
+int mcupr_gpio_read(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+    if (dev < 0 || PIGPIOD_GPIO_PINS <= dev) {
+        return MCUPR_RES_INVALID_HANDLE;
+    }
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    int level = gpio_read(conn->pi, dev);
+    pigpiod_pool_checkin(conn);
+
+    return (level < 0) ? MCUPR_RES_BACKEND_FAILURE : level;
+}
+
+/*
+ * The pads of the BCM283x set the drive strength of a whole bank, GPIO 0-27, 28-45 or 46-53.
+ */
+void mcupr_gpio_set_drive_strength(mcupr_gpio_chip_t *chip, mcupr_gpio_device_t dev,
+                                   mcupr_gpio_drive_t drive)
+{
+    static const unsigned ma[] = { 8, 2, 8, 16 };  /* indexed by mcupr_gpio_drive_t */
+
+    if (chip == NULL || chip->data == NULL || dev < 0 || PIGPIOD_GPIO_PINS <= dev ||
+        drive < MCUPR_GPIO_DRIVE_DEFAULT || MCUPR_GPIO_DRIVE_HIGH < drive) {
+        return;
+    }
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+    unsigned pad = (dev < 28) ? 0 : (dev < 46) ? 1 : 2;
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    if (set_pad_strength(conn->pi, pad, ma[drive]) != 0) {
+        MCUPR_ERR("%s: failed to set pad %u to %umA", __func__, pad, ma[drive]);
+    }
+    pigpiod_pool_checkin(conn);
+}
+
+/*
+ * Pins of a group are mapped onto bank 1 (GPIO 0-31) so that a whole group is read
+ * with one read_bank_1. pigpio has no masked write, so a write is one set_bank_1 for
+ * the pins going high and one clear_bank_1 for the pins going low.
+ */
+mcupr_result_t mcupr_gpio_group_open(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t **groupp,
+                                     const int *pins, int npins, mcupr_gpio_mode_t mode)
+{
+    mcupr_result_t res;
+    mcupr_gpio_group_t *group;
+    int i;
+
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+    if (npins <= 0 || MCUPR_GPIO_GROUP_MAX < npins) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    if (mode == MCUPR_GPIO_MODE_OUTPUT_OPEN_DRAIN) {
+        /* pigpio has no open drain output */
+        return MCUPR_RES_NOT_SUPPORTED;
+    }
+    for (i = 0; i < npins; i++) {
+        if (pins[i] < 0 || 31 < pins[i]) {
+            return MCUPR_RES_INVALID_ARGUMENT;
+        }
+    }
+
+    res = mcupr_alloc_object((void**)&group, sizeof(*group), 0, 0);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    group->npins = npins;
+    memcpy(group->pins, pins, sizeof(*pins) * npins);
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    for (i = 0; i < npins; i++) {
+        if (set_mode(conn->pi, pins[i], pigpiod_gpio_mode(mode)) != 0 ||
+            set_pull_up_down(conn->pi, pins[i], pigpiod_gpio_pud(mode)) != 0) {
+            pigpiod_pool_checkin(conn);
+            MCUPR_ERR("%s: failed to set mode of GPIO%d", __func__, pins[i]);
+            mcupr_release_object(group);
+            return MCUPR_RES_BACKEND_FAILURE;
+        }
+    }
+    pigpiod_pool_checkin(conn);
+    *groupp = group;
+
+    return MCUPR_RES_OK;
+}
+
+void mcupr_gpio_group_close(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t *group)
+{
+    mcupr_release_object(group);
+}
+
+mcupr_result_t mcupr_gpio_group_read(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t *group,
+                                     uint32_t *values)
+{
+    int i;
+
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    uint32_t bank = read_bank_1(conn->pi);
+    pigpiod_pool_checkin(conn);
+    *values = 0;
+    for (i = 0; i < group->npins; i++) {
+        if (bank & (1UL << group->pins[i])) {
+            *values |= (1UL << i);
+        }
+    }
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_gpio_group_write(mcupr_gpio_chip_t *chip, mcupr_gpio_group_t *group,
+                                      uint32_t mask, uint32_t values)
+{
+    uint32_t set = 0, clear = 0;
+    int i;
+
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+
+    for (i = 0; i < group->npins; i++) {
+        if (!(mask & (1UL << i))) {
+            continue;
+        }
+        if (values & (1UL << i)) {
+            set |= (1UL << group->pins[i]);
+        } else {
+            clear |= (1UL << group->pins[i]);
+        }
+    }
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    mcupr_result_t res = MCUPR_RES_OK;
+    if ((set && set_bank_1(conn->pi, set) != 0) || (clear && clear_bank_1(conn->pi, clear) != 0)) {
+        res = MCUPR_RES_BACKEND_FAILURE;
+    }
+    pigpiod_pool_checkin(conn);
+
+    return res;
+}
+
+/*
+ * GPIO interrupts
+ *
+ * Edges are reported by the daemon over the notification socket and dispatched by the
+ * thread of pigpiod_if2 to callback_ex(). The timestamp of an event is the pigpio tick of
+ * the edge, a 32 bit microsecond counter of the Pi, carried into CLOCK_MONOTONIC of this
+ * host from the first event on. Watchdog timeouts are not reported.
+ */
+static uint64_t pigpiod_gpio_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void pigpiod_gpio_dispatch(int pi, unsigned pin, unsigned level, uint32_t tick, void *arg)
+{
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)arg;
+    mcupr_gpio_event_t event;
+    mcupr_gpio_isr_t callback;
+    void *user_data;
+
+    if (PIGPIOD_GPIO_USER_PINS <= pin || 1 < level) {
+        return;
+    }
+    pthread_mutex_lock(&priv->lock);
+    struct pigpiod_gpio_line *line = &priv->lines[pin];
+    if (!PIGPIOD_GPIO_ARMED(line)) {
+        pthread_mutex_unlock(&priv->lock);
+        return;
+    }
+    if (priv->tick_ns == 0) {
+        priv->tick_ns = pigpiod_gpio_now();
+    } else {
+        priv->tick_ns += (uint64_t)(uint32_t)(tick - priv->last_tick) * 1000;
+    }
+    priv->last_tick = tick;
+    callback = line->callback;
+    user_data = line->user_data;
+    if (line->queued) {
+        event.pin = pin;
+        event.edge = level ? MCUPR_GPIO_INT_RISING : MCUPR_GPIO_INT_FALLING;
+        event.seqno = ++line->seqno;
+        event.timestamp_ns = priv->tick_ns;
+        /* the thread of pigpiod_if2 is the only producer of the queue */
+        mcupr_ring_push(&priv->events, &event, 1);
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    /* callbacks are called without the lock so that they can attach or detach */
+    if (callback != NULL) {
+        (*callback)(priv->chip, pin, user_data);
+    }
+}
+
+static mcupr_result_t pigpiod_gpio_attach(mcupr_gpio_chip_t *chip, int pin,
+                                          mcupr_gpio_int_edge_t edge, mcupr_gpio_isr_t callback,
+                                          void *user_data, int queued)
+{
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+    mcupr_result_t res = MCUPR_RES_OK;
+    unsigned pi_edge;
+
+    switch (edge) {
+    case MCUPR_GPIO_INT_RISING:
+        pi_edge = RISING_EDGE;
+        break;
+    case MCUPR_GPIO_INT_FALLING:
+        pi_edge = FALLING_EDGE;
+        break;
+    case MCUPR_GPIO_INT_BOTH:
+        pi_edge = EITHER_EDGE;
+        break;
+    default:
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    if (pin < 0 || PIGPIOD_GPIO_USER_PINS <= pin) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&priv->lock);
+    if (queued && priv->events.buf == NULL) {
+        res = mcupr_ring_init(&priv->events, sizeof(mcupr_gpio_event_t), priv->event_queue_size);
+        if (res != MCUPR_RES_OK) {
+            goto wayout;
+        }
+    }
+    struct pigpiod_gpio_line *line = &priv->lines[pin];
+    if (PIGPIOD_GPIO_ARMED(line)) {
+        callback_cancel(line->cbid);
+        line->callback = NULL;
+        line->queued = 0;
+    }
+    /* edges are notified on the socket of the connection the callback is registered on */
+    line->cbid = callback_ex(pigpiod_pool_home(priv->pool), pin, pi_edge, pigpiod_gpio_dispatch,
+                             priv);
+    if (line->cbid < 0) {
+        MCUPR_ERR("%s: callback_ex(GPIO%d), %s", __func__, pin, pigpio_error(line->cbid));
+        res = MCUPR_RES_BACKEND_FAILURE;
+        goto wayout;
+    }
+    line->callback = callback;
+    line->user_data = user_data;
+    line->queued = queued;
+
+ wayout:
+    pthread_mutex_unlock(&priv->lock);
+    return res;
+}
+
+mcupr_result_t mcupr_gpio_attach_interrupt(mcupr_gpio_chip_t *chip, int pin,
+                                           mcupr_gpio_int_edge_t edge,
+                                           mcupr_gpio_isr_t callback,
+                                           void *user_data)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (callback == NULL) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    return pigpiod_gpio_attach(chip, pin, edge, callback, user_data, 0);
+}
+
+mcupr_result_t mcupr_gpio_attach_event(mcupr_gpio_chip_t *chip, int pin, mcupr_gpio_int_edge_t edge)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+
+    return pigpiod_gpio_attach(chip, pin, edge, NULL, NULL, 1);
+}
+
+int mcupr_gpio_drain_events(mcupr_gpio_chip_t *chip, mcupr_gpio_event_t *events, int max)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+    if (priv->events.buf == NULL || max <= 0) {
+        return 0;
+    }
+
+    return mcupr_ring_pop(&priv->events, events, max);
+}
+
+uint32_t mcupr_gpio_event_overflows(mcupr_gpio_chip_t *chip)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return 0;
+    }
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+    if (priv->events.buf == NULL) {
+        return 0;
+    }
+
+    return mcupr_ring_take_dropped(&priv->events);
+}
+
+void mcupr_gpio_detach_interrupt(mcupr_gpio_chip_t *chip, int pin)
+{
+    if (chip == NULL || chip->data == NULL) {
+        return;
+    }
+    struct pigpiod_gpio_data *priv = (struct pigpiod_gpio_data *)chip->data;
+
+    pthread_mutex_lock(&priv->lock);
+    if (0 <= pin && pin < PIGPIOD_GPIO_USER_PINS && PIGPIOD_GPIO_ARMED(&priv->lines[pin])) {
+        struct pigpiod_gpio_line *line = &priv->lines[pin];
+        callback_cancel(line->cbid);
+        line->callback = NULL;
+        line->user_data = NULL;
+        line->queued = 0;
+    }
+    pthread_mutex_unlock(&priv->lock);
+}
+
+/*
+ * Waveforms are generated by pigpio itself: PWM with set_PWM_dutycycle() and pulse trains
+ * with the DMA timed wave_* functions, so there is no engine thread on this side.
+ */
+#define PIGPIOD_PWM_RANGE 40000
+
+struct pigpiod_wave_data {
+    int pi;       /* home connection of the pool of the chip */
+    int wave_id;  /* pigpio wave being transmitted, -1 if none */
+    int pwm;      /* PWM is running on the pins of the group */
+};
+
+mcupr_result_t mcupr_gpio_wave_create(mcupr_gpio_wave_t **wavep, mcupr_gpio_chip_t *chip,
+                                      mcupr_gpio_group_t *group,
+                                      const mcupr_gpio_wave_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_gpio_wave_t *wave;
+
+    if (chip == NULL || chip->data == NULL || group == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    res = MCUPR_ALLOC_OBJECT(wave, mcupr_gpio_wave_t, data, struct pigpiod_wave_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct pigpiod_wave_data *priv = (struct pigpiod_wave_data *)wave->data;
+    wave->chip = chip;
+    wave->group = group;
+    priv->pi = pigpiod_pool_home(((struct pigpiod_gpio_data *)chip->data)->pool);
+    priv->wave_id = -1;
+    *wavep = wave;
+
+    return MCUPR_RES_OK;
+}
+
+void mcupr_gpio_wave_stop(mcupr_gpio_wave_t *wave)
+{
+    int i;
+
+    if (wave == NULL || wave->data == NULL) {
+        return;
+    }
+    struct pigpiod_wave_data *priv = (struct pigpiod_wave_data *)wave->data;
+
+    if (0 <= priv->wave_id) {
+        wave_tx_stop(priv->pi);
+        wave_delete(priv->pi, priv->wave_id);
+        priv->wave_id = -1;
+    }
+    if (priv->pwm) {
+        for (i = 0; i < wave->group->npins; i++) {
+            set_PWM_dutycycle(priv->pi, wave->group->pins[i], 0);
+        }
+        priv->pwm = 0;
+    }
+}
+
+void mcupr_gpio_wave_release(mcupr_gpio_wave_t *wave)
+{
+    if (wave == NULL || wave->data == NULL) {
+        return;
+    }
+    mcupr_gpio_wave_stop(wave);
+    mcupr_release_object(wave);
+}
+
+mcupr_result_t mcupr_gpio_wave_pwm(mcupr_gpio_wave_t *wave, uint32_t frequency, const uint32_t *duty)
+{
+    int i;
+
+    if (wave == NULL || wave->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_wave_data *priv = (struct pigpiod_wave_data *)wave->data;
+    if (frequency == 0) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    if (0 <= priv->wave_id) {
+        wave_tx_stop(priv->pi);
+        wave_delete(priv->pi, priv->wave_id);
+        priv->wave_id = -1;
+    }
+    for (i = 0; i < wave->group->npins; i++) {
+        unsigned gpio = wave->group->pins[i];
+        uint64_t value = (uint64_t)duty[i] * PIGPIOD_PWM_RANGE / MCUPR_GPIO_PWM_DUTY_MAX;
+        if (set_PWM_frequency(priv->pi, gpio, frequency) < 0 ||
+            set_PWM_range(priv->pi, gpio, PIGPIOD_PWM_RANGE) < 0 ||
+            set_PWM_dutycycle(priv->pi, gpio, (unsigned)value) != 0) {
+            MCUPR_ERR("%s: failed to start PWM on GPIO%u", __func__, gpio);
+            return MCUPR_RES_BACKEND_FAILURE;
+        }
+    }
+    priv->pwm = 1;
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_gpio_wave_pulses(mcupr_gpio_wave_t *wave, const mcupr_gpio_pulse_t *pulses,
+                                      int npulses, int repeat)
+{
+    gpioPulse_t *gpio_pulses;
+    int i, j, res;
+
+    if (wave == NULL || wave->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_wave_data *priv = (struct pigpiod_wave_data *)wave->data;
+    if (npulses <= 0) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    gpio_pulses = calloc(npulses, sizeof(*gpio_pulses));
+    if (gpio_pulses == NULL) {
+        MCUPR_ERR("%s: memory allocation failed", __func__);
+        return MCUPR_RES_NOMEM;
+    }
+    for (i = 0; i < npulses; i++) {
+        for (j = 0; j < wave->group->npins; j++) {
+            if (pulses[i].set & (1UL << j)) {
+                gpio_pulses[i].gpioOn |= (1UL << wave->group->pins[j]);
+            }
+            if (pulses[i].clear & (1UL << j)) {
+                gpio_pulses[i].gpioOff |= (1UL << wave->group->pins[j]);
+            }
+        }
+        gpio_pulses[i].usDelay = (pulses[i].delay_ns + 500) / 1000;
+    }
+
+    mcupr_gpio_wave_stop(wave);
+    wave_add_new(priv->pi);
+    res = wave_add_generic(priv->pi, npulses, gpio_pulses);
+    free(gpio_pulses);
+    if (res < 0) {
+        MCUPR_ERR("%s: wave_add_generic failed (%d)", __func__, res);
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+    priv->wave_id = wave_create(priv->pi);
+    if (priv->wave_id < 0) {
+        MCUPR_ERR("%s: wave_create failed (%d)", __func__, priv->wave_id);
+        priv->wave_id = -1;
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+    if (repeat) {
+        res = wave_send_repeat(priv->pi, priv->wave_id);
+    } else {
+        res = wave_send_once(priv->pi, priv->wave_id);
+    }
+    if (res < 0) {
+        MCUPR_ERR("%s: failed to send wave (%d)", __func__, res);
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+/* Timing is done by the DMA engine of the Raspberry Pi, no jitter is measured here */
+mcupr_result_t mcupr_gpio_wave_get_stats(mcupr_gpio_wave_t *wave, mcupr_gpio_wave_stats_t *stats)
+{
+    if (wave == NULL || wave->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    return MCUPR_RES_OK;
+}
+
+/*=================================================================================================
+ * I2C API
+ */
+
+#define PIGPIOD_I2C_BLOCK_MAX 32  /* I2C_SMBUS_BLOCK_MAX */
+#define PIGPIOD_I2C_ZIP_MAX 512
+#define PIGPIOD_I2C_M_IGNORE_NAK 0x1000  /* i2c_msg flag of the Flags command */
+
+struct pigpiod_i2c_data {
+    struct pigpiod_pool *pool;  /* pigpiod_if2 connections, NULL in pipeline mode */
+    int pipe;    /* command socket in pipeline mode, -1 otherwise */
     int busnum;
+    int handle;  /* handle for mcupr_i2c_transfer(), opened on first use */
+    char zip[PIGPIOD_PIPE_MAX][PIGPIOD_I2C_ZIP_MAX];    /* i2c_zip() commands of a batch */
+    char rbuf[PIGPIOD_PIPE_MAX][PIGPIOD_I2C_ZIP_MAX];   /* data read by the transfers of a batch */
 };
 
-mcupr_result_t mcupr_i2c_open(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t *dev, int addr)
+/* Append a read or write command of i2c_zip(), lengths over 255 need an escape */
+static int pigpiod_i2c_zip_cmd(char *buf, int n, char cmd, uint32_t len)
+{
+    if (len <= 0xff) {
+        buf[n++] = cmd;
+        buf[n++] = (char)len;
+    } else {
+        buf[n++] = PI_I2C_ESC;
+        buf[n++] = cmd;
+        buf[n++] = (char)(len & 0xff);
+        buf[n++] = (char)(len >> 8);
+    }
+    return n;
+}
+
+/* Build the i2c_zip() commands of a write followed by a read with a repeated start */
+static int pigpiod_i2c_zip_write_read(char *cmd, const uint8_t *wdata, uint32_t wsize,
+                                      uint32_t rsize)
+{
+    int n = 0;
+
+    /* combined on, two commands of up to 4 bytes each and the end */
+    if (PIGPIOD_I2C_ZIP_MAX < wsize + 10) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    /* without combined mode pigpio would put a stop between the write and the read */
+    cmd[n++] = PI_I2C_COMBINED_ON;
+    n = pigpiod_i2c_zip_cmd(cmd, n, PI_I2C_WRITE, wsize);
+    memcpy(&cmd[n], wdata, wsize);
+    n += wsize;
+    n = pigpiod_i2c_zip_cmd(cmd, n, PI_I2C_READ, rsize);
+    cmd[n++] = PI_I2C_END;
+
+    return n;
+}
+
+/*
+ * Build the i2c_zip() commands of the messages, switching the address with the Address command.
+ * pigpio executes each message by itself, so MCUPR_I2C_M_NOSTART can't be supported.
+ * Returns: length of the commands, the number of bytes read is stored in *rsizep
+ */
+static int pigpiod_i2c_zip_msgs(char *cmd, const mcupr_i2c_msg_t *msgs, int n, uint32_t *rsizep)
+{
+    uint32_t rsize = 0;
+    int i, len = 0;
+    int addr = -1, flags = 0;
+
+    /* without combined mode every segment would be a transaction of its own */
+    cmd[len++] = PI_I2C_COMBINED_ON;
+    for (i = 0; i < n; i++) {
+        const mcupr_i2c_msg_t *msg = &msgs[i];
+        int msg_flags = (msg->flags & MCUPR_I2C_M_IGNORE_NAK) ? PIGPIOD_I2C_M_IGNORE_NAK : 0;
+        if (msg->flags & MCUPR_I2C_M_NOSTART) {
+            return MCUPR_RES_NOT_SUPPORTED;
+        }
+        if (PIGPIOD_I2C_ZIP_MAX < len + 12 + ((msg->flags & MCUPR_I2C_M_RD) ? 0 : msg->length)) {
+            return MCUPR_RES_INVALID_ARGUMENT;
+        }
+        if (msg->addr != addr) {
+            addr = msg->addr;
+            cmd[len++] = PI_I2C_ADDR;
+            cmd[len++] = (char)addr;
+        }
+        if (msg_flags != flags) {
+            flags = msg_flags;
+            cmd[len++] = PI_I2C_FLAGS;
+            cmd[len++] = (char)(flags & 0xff);
+            cmd[len++] = (char)(flags >> 8);
+        }
+        if (msg->flags & MCUPR_I2C_M_RD) {
+            len = pigpiod_i2c_zip_cmd(cmd, len, PI_I2C_READ, msg->length);
+            rsize += msg->length;
+        } else {
+            len = pigpiod_i2c_zip_cmd(cmd, len, PI_I2C_WRITE, msg->length);
+            memcpy(&cmd[len], msg->data, msg->length);
+            len += msg->length;
+        }
+        if (msg->flags & MCUPR_I2C_M_STOP) {
+            /* the daemon runs the combined segments collected so far as one transaction */
+            cmd[len++] = PI_I2C_COMBINED_OFF;
+            cmd[len++] = PI_I2C_COMBINED_ON;
+        }
+    }
+    cmd[len++] = PI_I2C_END;
+    if (PIGPIOD_I2C_ZIP_MAX < rsize) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    *rsizep = rsize;
+
+    return len;
+}
+
+/* scatter the bytes read by a transfer */
+static void pigpiod_i2c_scatter(const char *rbuf, const mcupr_i2c_msg_t *msgs, int n)
+{
+    uint32_t rsize = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (msgs[i].flags & MCUPR_I2C_M_RD) {
+            memcpy(msgs[i].data, &rbuf[rsize], msgs[i].length);
+            rsize += msgs[i].length;
+        }
+    }
+}
+
+static mcupr_result_t pigpiod_i2c_open(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t *dev, int addr)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)bus->data;
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    int handle = i2c_open(conn->pi, priv->busnum, addr, 0);
+    pigpiod_pool_checkin(conn);
+    if (handle < 0) {
+        MCUPR_ERR("%s: i2c_open failed, %s", __func__, pigpio_error(handle));
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+    *dev = handle;
+    return MCUPR_RES_OK;
+}
+
+static int pigpiod_i2c_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t *data,
+                            uint32_t size)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)bus->data;
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    int ret = i2c_read_device(conn->pi, dev, (char *)data, size);
+    pigpiod_pool_checkin(conn);
+    return ret;
+}
+
+static int pigpiod_i2c_write(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, const uint8_t *data,
+                             uint32_t size)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)bus->data;
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    int ret = i2c_write_device(conn->pi, dev, (char *)data, size);
+    pigpiod_pool_checkin(conn);
+    return ret;
+}
+
+static void pigpiod_i2c_close(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return;
+    }
+    struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)bus->data;
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    i2c_close(conn->pi, dev);
+    pigpiod_pool_checkin(conn);
+}
+
+static void pigpiod_i2c_bus_release(mcupr_i2c_bus_t *bus)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return;
+    }
+    struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)bus->data;
+    if (0 <= priv->handle) {
+        pigpiod_i2c_close(bus, priv->handle);
+    }
+    pigpiod_pool_put(priv->pool);
+    memset(priv, 0, sizeof(*priv));
+    memset(bus, 0, sizeof(*bus));
+    free(bus);
+}
+
+static int pigpiod_i2c_write_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                  const uint8_t *wdata, uint32_t wsize,
+                                  uint8_t *rdata, uint32_t rsize)
 {
+    char cmd[PIGPIOD_I2C_ZIP_MAX];
+    int n, ret;
+
     if (bus == NULL || bus->data == NULL) {
         return MCUPR_RES_INVALID_OBJ;
     }
     struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)bus->data;
-    int handle = i2c_open(priv->pi, priv->busnum, addr, 0);
-    *dev = handle;
-    return MCUPR_RES_OK;
+
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    if (wsize == 1 && 0 < rsize && rsize <= PIGPIOD_I2C_BLOCK_MAX) {
+        /* register read, issued by the adapter with a repeated start */
+        ret = i2c_read_i2c_block_data(conn->pi, dev, wdata[0], (char *)rdata, rsize);
+        pigpiod_pool_checkin(conn);
+        return ret < 0 ? MCUPR_RES_IO_ERROR : ret;
+    }
+
+    /* otherwise send both messages to the daemon in one request */
+    n = pigpiod_i2c_zip_write_read(cmd, wdata, wsize, rsize);
+    ret = (n < 0) ? n : i2c_zip(conn->pi, dev, cmd, n, (char *)rdata, rsize);
+    pigpiod_pool_checkin(conn);
+    if (n < 0) {
+        return n;
+    }
+
+    return ret < 0 ? MCUPR_RES_IO_ERROR : ret;
+}
+
+/*
+ * All messages are sent to the daemon as one i2c_zip() request.
+ */
+static int pigpiod_i2c_transfer(mcupr_i2c_bus_t *bus, const mcupr_i2c_msg_t *msgs, int n)
+{
+    char cmd[PIGPIOD_I2C_ZIP_MAX];
+    char rbuf[PIGPIOD_I2C_ZIP_MAX];
+    uint32_t rsize;
+    int len, ret;
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)bus->data;
+
+    len = pigpiod_i2c_zip_msgs(cmd, msgs, n, &rsize);
+    if (len < 0) {
+        return len;
+    }
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    if (priv->handle < 0) {
+        priv->handle = i2c_open(conn->pi, priv->busnum, 0, 0);
+        if (priv->handle < 0) {
+            pigpiod_pool_checkin(conn);
+            MCUPR_ERR("%s: i2c_open failed, %s", __func__, pigpio_error(priv->handle));
+            priv->handle = -1;
+            return MCUPR_RES_BACKEND_FAILURE;
+        }
+    }
+    ret = i2c_zip(conn->pi, priv->handle, cmd, len, rbuf, rsize);
+    pigpiod_pool_checkin(conn);
+    if (ret < 0) {
+        MCUPR_DBG("%s: i2c_zip, %s", __func__, pigpio_error(ret));
+        return MCUPR_RES_IO_ERROR;
+    }
+    pigpiod_i2c_scatter(rbuf, msgs, n);
+
+    return n;
 }
 
-int mcupr_i2c_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t *data, uint32_t size)
+static int pigpiod_i2c_smbus(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, int read, uint8_t reg,
+                             mcupr_smbus_type_t type, uint8_t *data, uint32_t length)
 {
+    int ret;
+
     if (bus == NULL || bus->data == NULL) {
         return MCUPR_RES_INVALID_OBJ;
     }
     struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)bus->data;
-    return i2c_read_device(priv->pi, dev, (char *)data, size);
+
+    if (MCUPR_SMBUS_I2C_BLOCK_DATA < type) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    struct pigpiod_conn *conn = pigpiod_pool_checkout(priv->pool);
+    int pi = conn->pi;
+    switch (type) {
+    case MCUPR_SMBUS_BYTE_DATA:
+        if (read) {
+            ret = i2c_read_byte_data(pi, dev, reg);
+            if (0 <= ret) {
+                data[0] = (uint8_t)ret;
+                ret = 1;
+            }
+        } else {
+            ret = i2c_write_byte_data(pi, dev, reg, data[0]);
+        }
+        break;
+    case MCUPR_SMBUS_WORD_DATA:
+        if (read) {
+            ret = i2c_read_word_data(pi, dev, reg);
+            if (0 <= ret) {
+                data[0] = ret & 0xff;
+                data[1] = (ret >> 8) & 0xff;
+                ret = 2;
+            }
+        } else {
+            ret = i2c_write_word_data(pi, dev, reg, data[0] | (data[1] << 8));
+        }
+        break;
+    case MCUPR_SMBUS_BLOCK_DATA:
+        if (read) {
+            ret = i2c_read_block_data(pi, dev, reg, (char *)data);
+        } else {
+            ret = i2c_write_block_data(pi, dev, reg, (char *)data, length);
+        }
+        break;
+    case MCUPR_SMBUS_I2C_BLOCK_DATA:
+        if (read) {
+            ret = i2c_read_i2c_block_data(pi, dev, reg, (char *)data, length);
+        } else {
+            ret = i2c_write_i2c_block_data(pi, dev, reg, (char *)data, length);
+        }
+        break;
+    }
+    pigpiod_pool_checkin(conn);
+    if (ret < 0) {
+        MCUPR_DBG("%s: %s", __func__, pigpio_error(ret));
+        return MCUPR_RES_IO_ERROR;
+    }
+
+    /* writes return 0 on success */
+    return read ? ret : (int)length;
+}
+
+static const struct mcupr_i2c_ops_s pigpiod_i2c_ops = {
+    .release = pigpiod_i2c_bus_release,
+    .open = pigpiod_i2c_open,
+    .close = pigpiod_i2c_close,
+    .read = pigpiod_i2c_read,
+    .write = pigpiod_i2c_write,
+    .write_read = pigpiod_i2c_write_read,
+    .transfer = pigpiod_i2c_transfer,
+    .smbus = pigpiod_i2c_smbus,
+};
+
+/*
+ * Pipeline mode (MCUPR_IMPL_PIGPIOD_PIPELINE=1)
+ *
+ * The bus talks to the daemon over a command socket of its own instead of pigpiod_if2. Each
+ * transfer is packed into one command, a write followed by a read or a whole message list into
+ * an I2CZ, and the batch operation writes the commands of up to PIGPIOD_PIPE_MAX queued
+ * transfers before reading their responses, so a batch costs one network round trip.
+ * SMBus transactions are built from write and write_read.
+ */
+static mcupr_result_t pigpiod_i2c_pipe_handle(struct pigpiod_i2c_data *priv)
+{
+    uint32_t flags = 0;
+    struct pigpiod_req req = { PI_CMD_I2CO, priv->busnum, 0, &flags, sizeof(flags) };
+
+    if (0 <= priv->handle) {
+        return MCUPR_RES_OK;
+    }
+    if (pigpiod_pipe_run(priv->pipe, &req, 1) != MCUPR_RES_OK) {
+        return MCUPR_RES_COMMUNICATION_ERROR;
+    }
+    if (req.res < 0) {
+        MCUPR_ERR("%s: i2c_open failed, %s", __func__, pigpio_error(req.res));
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+    priv->handle = req.res;
+
+    return MCUPR_RES_OK;
+}
+
+/* Convert a transfer to a command, slot selects the buffers of the batch */
+static mcupr_result_t pigpiod_i2c_pipe_prepare(struct pigpiod_i2c_data *priv, mcupr_xfer_t *xfer,
+                                               struct pigpiod_req *req, int slot)
+{
+    uint32_t rsize;
+    int len;
+
+    memset(req, 0, sizeof(*req));
+    req->p1 = xfer->dev;
+    switch (xfer->type) {
+    case MCUPR_XFER_I2C_READ:
+        req->cmd = PI_CMD_I2CRD;
+        req->p2 = xfer->rlength;
+        req->rdata = xfer->rdata;
+        req->rlength = xfer->rlength;
+        break;
+    case MCUPR_XFER_I2C_WRITE:
+        req->cmd = PI_CMD_I2CWD;
+        req->ext = xfer->wdata;
+        req->ext_len = xfer->wlength;
+        break;
+    case MCUPR_XFER_I2C_WRITE_READ:
+        len = pigpiod_i2c_zip_write_read(priv->zip[slot], xfer->wdata, xfer->wlength,
+                                         xfer->rlength);
+        if (len < 0) {
+            return len;
+        }
+        req->cmd = PI_CMD_I2CZ;
+        req->ext = priv->zip[slot];
+        req->ext_len = len;
+        req->rdata = xfer->rdata;
+        req->rlength = xfer->rlength;
+        break;
+    case MCUPR_XFER_I2C_TRANSFER:
+        len = pigpiod_i2c_zip_msgs(priv->zip[slot], xfer->msgs, xfer->nmsgs, &rsize);
+        if (len < 0) {
+            return len;
+        }
+        if (pigpiod_i2c_pipe_handle(priv) != MCUPR_RES_OK) {
+            return MCUPR_RES_BACKEND_FAILURE;
+        }
+        req->cmd = PI_CMD_I2CZ;
+        req->p1 = priv->handle;
+        req->ext = priv->zip[slot];
+        req->ext_len = len;
+        req->rdata = priv->rbuf[slot];
+        req->rlength = rsize;
+        break;
+    default:
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+static int pigpiod_i2c_pipe_result(struct pigpiod_i2c_data *priv, mcupr_xfer_t *xfer,
+                                   struct pigpiod_req *req, int slot)
+{
+    if (req->res < 0) {
+        MCUPR_DBG("%s: %s", __func__, pigpio_error(req->res));
+        return MCUPR_RES_IO_ERROR;
+    }
+    switch (xfer->type) {
+    case MCUPR_XFER_I2C_WRITE:
+        return xfer->wlength;
+    case MCUPR_XFER_I2C_TRANSFER:
+        pigpiod_i2c_scatter(priv->rbuf[slot], xfer->msgs, xfer->nmsgs);
+        return xfer->nmsgs;
+    default:
+        return req->res;
+    }
+}
+
+static void pigpiod_i2c_batch(mcupr_i2c_bus_t *bus, mcupr_xfer_t **xfers, int n)
+{
+    struct pigpiod_req reqs[PIGPIOD_PIPE_MAX];
+    mcupr_result_t res;
+    int i, k, m;
+
+    struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)bus->data;
+    for (i = 0; i < n; i += m) {
+        m = (n - i < PIGPIOD_PIPE_MAX) ? n - i : PIGPIOD_PIPE_MAX;
+        for (k = 0; k < m; k++) {
+            res = pigpiod_i2c_pipe_prepare(priv, xfers[i + k], &reqs[k], k);
+            if (res != MCUPR_RES_OK) {
+                reqs[k].cmd = 0;
+                reqs[k].res = res;
+            }
+        }
+        res = pigpiod_pipe_run(priv->pipe, reqs, m);
+        for (k = 0; k < m; k++) {
+            if (res != MCUPR_RES_OK) {
+                xfers[i + k]->result = res;
+            } else if (reqs[k].cmd == 0) {
+                xfers[i + k]->result = reqs[k].res;
+            } else {
+                xfers[i + k]->result = pigpiod_i2c_pipe_result(priv, xfers[i + k], &reqs[k], k);
+            }
+        }
+    }
+}
+
+/* run one transfer as a batch of its own */
+static int pigpiod_i2c_pipe_run(mcupr_i2c_bus_t *bus, mcupr_xfer_t *xfer)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    pigpiod_i2c_batch(bus, &xfer, 1);
+
+    return xfer->result;
 }
 
-int mcupr_i2c_write(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, const uint8_t *data, uint32_t size)
+static mcupr_result_t pigpiod_i2c_pipe_open(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t *dev,
+                                            int addr)
 {
+    uint32_t flags = 0;
+
     if (bus == NULL || bus->data == NULL) {
         return MCUPR_RES_INVALID_OBJ;
     }
     struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)bus->data;
-    return i2c_write_device(priv->pi, dev, (char *)data, size);
+    struct pigpiod_req req = { PI_CMD_I2CO, priv->busnum, addr, &flags, sizeof(flags) };
+    if (pigpiod_pipe_run(priv->pipe, &req, 1) != MCUPR_RES_OK) {
+        return MCUPR_RES_COMMUNICATION_ERROR;
+    }
+    if (req.res < 0) {
+        MCUPR_ERR("%s: i2c_open failed, %s", __func__, pigpio_error(req.res));
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+    *dev = req.res;
+
+    return MCUPR_RES_OK;
 }
 
-void mcupr_i2c_close(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev)
+static void pigpiod_i2c_pipe_close(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev)
 {
     if (bus == NULL || bus->data == NULL) {
         return;
     }
     struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)bus->data;
-    i2c_close(priv->pi, dev);
+    struct pigpiod_req req = { PI_CMD_I2CC, dev };
+    pigpiod_pipe_run(priv->pipe, &req, 1);
+}
+
+static int pigpiod_i2c_pipe_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev, uint8_t *data,
+                                 uint32_t size)
+{
+    mcupr_xfer_t xfer = { .type = MCUPR_XFER_I2C_READ, .dev = dev, .rdata = data,
+                          .rlength = size };
+    return pigpiod_i2c_pipe_run(bus, &xfer);
+}
+
+static int pigpiod_i2c_pipe_write(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                  const uint8_t *data, uint32_t size)
+{
+    mcupr_xfer_t xfer = { .type = MCUPR_XFER_I2C_WRITE, .dev = dev, .wdata = data,
+                          .wlength = size };
+    return pigpiod_i2c_pipe_run(bus, &xfer);
 }
 
-void mcupr_i2c_bus_release(mcupr_i2c_bus_t *bus)
+static int pigpiod_i2c_pipe_write_read(mcupr_i2c_bus_t *bus, mcupr_i2c_device_t dev,
+                                       const uint8_t *wdata, uint32_t wsize,
+                                       uint8_t *rdata, uint32_t rsize)
+{
+    mcupr_xfer_t xfer = { .type = MCUPR_XFER_I2C_WRITE_READ, .dev = dev, .wdata = wdata,
+                          .wlength = wsize, .rdata = rdata, .rlength = rsize };
+    return pigpiod_i2c_pipe_run(bus, &xfer);
+}
+
+static int pigpiod_i2c_pipe_transfer(mcupr_i2c_bus_t *bus, const mcupr_i2c_msg_t *msgs, int n)
+{
+    mcupr_xfer_t xfer = { .type = MCUPR_XFER_I2C_TRANSFER, .msgs = msgs, .nmsgs = n };
+    return pigpiod_i2c_pipe_run(bus, &xfer);
+}
+
+static void pigpiod_i2c_pipe_release(mcupr_i2c_bus_t *bus)
 {
     if (bus == NULL || bus->data == NULL) {
         return;
     }
     struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)bus->data;
-    pigpio_stop(priv->pi);
+    if (0 <= priv->handle) {
+        pigpiod_i2c_pipe_close(bus, priv->handle);
+    }
+    close(priv->pipe);
     memset(priv, 0, sizeof(*priv));
     memset(bus, 0, sizeof(*bus));
     free(bus);
 }
 
+static const struct mcupr_i2c_ops_s pigpiod_i2c_pipe_ops = {
+    .release = pigpiod_i2c_pipe_release,
+    .open = pigpiod_i2c_pipe_open,
+    .close = pigpiod_i2c_pipe_close,
+    .read = pigpiod_i2c_pipe_read,
+    .write = pigpiod_i2c_pipe_write,
+    .write_read = pigpiod_i2c_pipe_write_read,
+    .transfer = pigpiod_i2c_pipe_transfer,
+    .batch = pigpiod_i2c_batch,
+};
+
 mcupr_result_t mcupr_i2c_bus_create(mcupr_i2c_bus_t **busp, const mcupr_i2c_bus_params_t *params)
 {
     int i;
@@ -97,6 +1286,7 @@ mcupr_result_t mcupr_i2c_bus_create(mcupr_i2c_bus_t **busp, const mcupr_i2c_bus_
     }
 
     struct pigpiod_i2c_data *priv = (struct pigpiod_i2c_data *)&bus[1];
+    bus->ops = &pigpiod_i2c_ops;
     bus->data = priv;
 
     if (params->busnum == MCUPR_UNSPECIFIED) {
@@ -104,18 +1294,570 @@ mcupr_result_t mcupr_i2c_bus_create(mcupr_i2c_bus_t **busp, const mcupr_i2c_bus_
     } else {
         priv->busnum = params->busnum;
     }
+    priv->handle = -1;
+    priv->pipe = -1;
 
     char *addr = getenv("MCUPR_IMPL_PIGPIOD_ADDR");
     char *port = getenv("MCUPR_IMPL_PIGPIOD_PORT");
+    char *pipeline = getenv("MCUPR_IMPL_PIGPIOD_PIPELINE");
+
+    if (pipeline != NULL && strtol(pipeline, NULL, 0) != 0) {
+        bus->ops = &pigpiod_i2c_pipe_ops;
+        priv->pipe = pigpiod_pipe_connect();
+        if (priv->pipe < 0) {
+            free(bus);
+            return MCUPR_RES_NODEV;
+        }
+    } else {
+        priv->pool = pigpiod_pool_get();
+        if (priv->pool == NULL) {
+            free(bus);
+            return MCUPR_RES_NODEV;
+        }
+    }
+
+    MCUPR_INF("%s: addr=%s, port=%s, bus=%d%s", __func__, addr, port, priv->busnum,
+              (0 <= priv->pipe) ? ", pipelined" : "");
+    *busp = bus;
+
+    return MCUPR_RES_OK;
+}
+
+int mcupr_i2c_enumerate(int *busnums, int max)
+{
+    mcupr_i2c_bus_params_t params;
+
+    /* pigpiod can't list the adapters, offer the bus mcupr_i2c_bus_create() would open */
+    mcupr_i2c_init_params(&params);
+    if (max < 1) {
+        return 0;
+    }
+    busnums[0] = (params.busnum == MCUPR_UNSPECIFIED) ? 1 : params.busnum;
+
+    return 1;
+}
+
+/*=================================================================================================
+ * SPI API
+ *
+ * SPI always uses a command socket of the bus. A transfer is one SPIX, or SPIW without
+ * rx_data so that nothing is sent back, and queued transfers are pipelined like I2C transfers
+ * in pipeline mode. busnum 0 is the main SPI, 1 the auxiliary SPI. A transfer is limited to
+ * PIGPIOD_SPI_MAX_LENGTH as the daemon releases the chip select after each command.
+ */
+
+#define PIGPIOD_SPI_MAX_LENGTH 65536
+#define PIGPIOD_SPI_FLAG_AUX (1 << 8)
+
+struct pigpiod_spi_data {
+    int pipe;
+};
+
+static mcupr_result_t pigpiod_spi_open(mcupr_spi_bus_t *bus, mcupr_spi_device_t *dev, int csnum)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct pigpiod_spi_data *priv = (struct pigpiod_spi_data *)bus->data;
+    uint32_t flags = bus->params.mode | ((bus->params.busnum == 1) ? PIGPIOD_SPI_FLAG_AUX : 0);
+    struct pigpiod_req req = { PI_CMD_SPIO, (csnum == MCUPR_UNSPECIFIED) ? 0 : csnum,
+                               bus->params.speed, &flags, sizeof(flags) };
+
+    if (pigpiod_pipe_run(priv->pipe, &req, 1) != MCUPR_RES_OK) {
+        return MCUPR_RES_COMMUNICATION_ERROR;
+    }
+    if (req.res < 0) {
+        MCUPR_ERR("%s: spi_open failed, %s", __func__, pigpio_error(req.res));
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+    *dev = req.res;
+
+    return MCUPR_RES_OK;
+}
+
+static void pigpiod_spi_close(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return;
+    }
+    struct pigpiod_spi_data *priv = (struct pigpiod_spi_data *)bus->data;
+    struct pigpiod_req req = { PI_CMD_SPIC, dev };
+    pigpiod_pipe_run(priv->pipe, &req, 1);
+}
+
+static void pigpiod_spi_batch(mcupr_spi_bus_t *bus, mcupr_xfer_t **xfers, int n)
+{
+    struct pigpiod_req reqs[PIGPIOD_PIPE_MAX];
+    mcupr_result_t res;
+    int i, k, m;
 
-    priv->pi = pigpio_start(addr, port);
-    if (priv->pi < 0) {
-        free(bus);
+    struct pigpiod_spi_data *priv = (struct pigpiod_spi_data *)bus->data;
+    for (i = 0; i < n; i += m) {
+        m = (n - i < PIGPIOD_PIPE_MAX) ? n - i : PIGPIOD_PIPE_MAX;
+        for (k = 0; k < m; k++) {
+            mcupr_xfer_t *xfer = xfers[i + k];
+            struct pigpiod_req *req = &reqs[k];
+            memset(req, 0, sizeof(*req));
+            if (xfer->type != MCUPR_XFER_SPI_TRANSFER || PIGPIOD_SPI_MAX_LENGTH < xfer->wlength) {
+                req->res = MCUPR_RES_INVALID_ARGUMENT;
+                continue;
+            }
+            req->p1 = xfer->dev;
+            if (xfer->wdata == NULL) {
+                req->cmd = PI_CMD_SPIR;
+                req->p2 = xfer->wlength;
+            } else {
+                req->cmd = (xfer->rdata == NULL) ? PI_CMD_SPIW : PI_CMD_SPIX;
+                req->ext = xfer->wdata;
+                req->ext_len = xfer->wlength;
+            }
+            req->rdata = xfer->rdata;
+            /* SPIR returns its data even when nobody wants it */
+            req->rlength = (req->cmd == PI_CMD_SPIW) ? 0 : xfer->wlength;
+        }
+        res = pigpiod_pipe_run(priv->pipe, reqs, m);
+        for (k = 0; k < m; k++) {
+            if (res != MCUPR_RES_OK) {
+                xfers[i + k]->result = res;
+            } else if (reqs[k].cmd == 0) {
+                xfers[i + k]->result = reqs[k].res;
+            } else if (reqs[k].res < 0) {
+                MCUPR_DBG("%s: %s", __func__, pigpio_error(reqs[k].res));
+                xfers[i + k]->result = MCUPR_RES_IO_ERROR;
+            } else {
+                xfers[i + k]->result = xfers[i + k]->wlength;
+            }
+        }
+    }
+}
+
+static int pigpiod_spi_transfer(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                                const uint8_t *tx_data, uint8_t *rx_data, int length)
+{
+    mcupr_xfer_t xfer = { .type = MCUPR_XFER_SPI_TRANSFER, .dev = dev, .wdata = tx_data,
+                          .rdata = rx_data, .wlength = length };
+    mcupr_xfer_t *xferp = &xfer;
+
+    if (bus == NULL || bus->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (length < 0) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    if (length == 0) {
+        return 0;
+    }
+    pigpiod_spi_batch(bus, &xferp, 1);
+
+    return xfer.result;
+}
+
+static void pigpiod_spi_bus_release(mcupr_spi_bus_t *bus)
+{
+    if (bus == NULL || bus->data == NULL) {
+        return;
+    }
+    struct pigpiod_spi_data *priv = (struct pigpiod_spi_data *)bus->data;
+    close(priv->pipe);
+    mcupr_release_object(bus);
+}
+
+static const struct mcupr_spi_ops_s pigpiod_spi_ops = {
+    .release = pigpiod_spi_bus_release,
+    .open = pigpiod_spi_open,
+    .close = pigpiod_spi_close,
+    .transfer = pigpiod_spi_transfer,
+    .batch = pigpiod_spi_batch,
+};
+
+mcupr_result_t mcupr_spi_bus_create(mcupr_spi_bus_t **busp, mcupr_spi_bus_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_spi_bus_t *bus;
+
+    if (params->mode < MCUPR_SPI_MODE0 || MCUPR_SPI_MODE3 < params->mode) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    res = MCUPR_ALLOC_OBJECT(bus, mcupr_spi_bus_t, data, struct pigpiod_spi_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct pigpiod_spi_data *priv = (struct pigpiod_spi_data *)bus->data;
+    bus->ops = &pigpiod_spi_ops;
+    bus->params = *params;
+    if (bus->params.busnum == MCUPR_UNSPECIFIED) {
+        bus->params.busnum = 0;
+    }
+
+    priv->pipe = pigpiod_pipe_connect();
+    if (priv->pipe < 0) {
+        mcupr_release_object(bus);
         return MCUPR_RES_NODEV;
     }
 
-    MCUPR_INF("%s: addr=%s, port=%s, bus=%d", __func__, addr, port, priv->busnum);
+    MCUPR_INF("%s: bus=%d speed=%d mode=%d", __func__, bus->params.busnum, params->speed,
+              params->mode);
     *busp = bus;
 
     return MCUPR_RES_OK;
 }
+
+/*=================================================================================================
+ * Helper: pigpiod connection pool
+ *
+ * pigpiod runs the commands of a socket one at a time, so buses and chips sharing a daemon get
+ * their pigpiod_if2 connections from one pool per address and port. Each transaction checks out
+ * a connection. A thread goes back to the connection it used last, takes any idle one if that
+ * is busy and waits for its own only if all are busy. Connections are opened on first use, up
+ * to MCUPR_IMPL_PIGPIOD_POOL (default PIGPIOD_POOL_DEFAULT) of them. GPIO callbacks are
+ * registered on the first connection, whose notification thread delivers them.
+ */
+
+#define PIGPIOD_POOL_DEFAULT 4
+#define PIGPIOD_POOL_MAX 16
+
+struct pigpiod_pool {
+    struct pigpiod_pool *next;
+    char *addr;      /* NULL for the pigpiod_if2 default */
+    char *port;
+    int refs;
+    int size;
+    struct pigpiod_conn conns[PIGPIOD_POOL_MAX];  /* pi is -1 until opened */
+};
+
+static pthread_mutex_t pigpiod_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pigpiod_pool *pigpiod_pools;
+static uint32_t pigpiod_pool_seq;
+static __thread int pigpiod_pool_affinity = -1;
+
+static int pigpiod_pool_match(const char *a, const char *b)
+{
+    return (a == NULL || b == NULL) ? a == b : strcmp(a, b) == 0;
+}
+
+static void pigpiod_pool_free(struct pigpiod_pool *pool)
+{
+    int i;
+
+    for (i = 0; i < pool->size; i++) {
+        if (0 <= pool->conns[i].pi) {
+            /* this also stops the notification thread of the connection */
+            pigpio_stop(pool->conns[i].pi);
+        }
+        pthread_mutex_destroy(&pool->conns[i].lock);
+    }
+    free(pool->addr);
+    free(pool->port);
+    free(pool);
+}
+
+/* Take a reference to the pool of the daemon, NULL if it can't be reached */
+static struct pigpiod_pool *pigpiod_pool_get(void)
+{
+    struct pigpiod_pool *pool;
+    int i;
+
+    char *addr = getenv("MCUPR_IMPL_PIGPIOD_ADDR");
+    char *port = getenv("MCUPR_IMPL_PIGPIOD_PORT");
+    char *size = getenv("MCUPR_IMPL_PIGPIOD_POOL");
+
+    pthread_mutex_lock(&pigpiod_pools_lock);
+    for (pool = pigpiod_pools; pool != NULL; pool = pool->next) {
+        if (pigpiod_pool_match(pool->addr, addr) && pigpiod_pool_match(pool->port, port)) {
+            pool->refs++;
+            pthread_mutex_unlock(&pigpiod_pools_lock);
+            return pool;
+        }
+    }
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        pthread_mutex_unlock(&pigpiod_pools_lock);
+        MCUPR_ERR("%s: memory allocation failed", __func__);
+        return NULL;
+    }
+    pool->size = (size != NULL) ? strtol(size, NULL, 0) : PIGPIOD_POOL_DEFAULT;
+    if (pool->size < 1) {
+        pool->size = 1;
+    }
+    if (PIGPIOD_POOL_MAX < pool->size) {
+        pool->size = PIGPIOD_POOL_MAX;
+    }
+    for (i = 0; i < pool->size; i++) {
+        pthread_mutex_init(&pool->conns[i].lock, NULL);
+        pool->conns[i].pi = -1;
+    }
+    pool->addr = (addr != NULL) ? strdup(addr) : NULL;
+    pool->port = (port != NULL) ? strdup(port) : NULL;
+    pool->conns[0].pi = pigpio_start(addr, port);
+    if (pool->conns[0].pi < 0) {
+        pthread_mutex_unlock(&pigpiod_pools_lock);
+        pigpiod_pool_free(pool);
+        return NULL;
+    }
+    pool->refs = 1;
+    pool->next = pigpiod_pools;
+    pigpiod_pools = pool;
+    pthread_mutex_unlock(&pigpiod_pools_lock);
+
+    MCUPR_INF("%s: addr=%s, port=%s, connections=%d", __func__, addr, port, pool->size);
+
+    return pool;
+}
+
+static void pigpiod_pool_put(struct pigpiod_pool *pool)
+{
+    struct pigpiod_pool **pp;
+
+    pthread_mutex_lock(&pigpiod_pools_lock);
+    if (0 < --pool->refs) {
+        pthread_mutex_unlock(&pigpiod_pools_lock);
+        return;
+    }
+    for (pp = &pigpiod_pools; *pp != pool; pp = &(*pp)->next) {
+    }
+    *pp = pool->next;
+    pthread_mutex_unlock(&pigpiod_pools_lock);
+
+    pigpiod_pool_free(pool);
+}
+
+static struct pigpiod_conn *pigpiod_pool_checkout(struct pigpiod_pool *pool)
+{
+    struct pigpiod_conn *conn = NULL;
+    int i, home;
+
+    if (pigpiod_pool_affinity < 0) {
+        /* spread the threads over the pool */
+        pigpiod_pool_affinity = __atomic_fetch_add(&pigpiod_pool_seq, 1, __ATOMIC_RELAXED);
+    }
+    home = pigpiod_pool_affinity % pool->size;
+    for (i = 0; i < pool->size; i++) {
+        int k = (home + i) % pool->size;
+        if (pthread_mutex_trylock(&pool->conns[k].lock) == 0) {
+            conn = &pool->conns[k];
+            pigpiod_pool_affinity = k;
+            break;
+        }
+    }
+    if (conn == NULL) {
+        conn = &pool->conns[home];
+        pthread_mutex_lock(&conn->lock);
+    }
+    if (conn->pi < 0) {
+        conn->pi = pigpio_start(pool->addr, pool->port);
+        if (conn->pi < 0) {
+            /* the daemon refused another connection, share the first one */
+            MCUPR_WRN("%s: can't open connection %d", __func__, (int)(conn - pool->conns));
+            pthread_mutex_unlock(&conn->lock);
+            pigpiod_pool_affinity = 0;
+            conn = &pool->conns[0];
+            pthread_mutex_lock(&conn->lock);
+        }
+    }
+
+    return conn;
+}
+
+static void pigpiod_pool_checkin(struct pigpiod_conn *conn)
+{
+    pthread_mutex_unlock(&conn->lock);
+}
+
+static int pigpiod_pool_home(struct pigpiod_pool *pool)
+{
+    return pool->conns[0].pi;
+}
+
+/*=================================================================================================
+ * Helper: pigpiod command socket
+ *
+ * The socket protocol of pigpiod: a command is four 32 bit words, cmd, p1, p2 and the length
+ * of the extension which follows. The response echoes cmd, p1 and p2 and has the result in the
+ * last word, commands returning data send that many bytes after it. The daemon handles the
+ * commands of a socket in order, so several may be written before the responses are read.
+ */
+
+#define PIGPIOD_PIPE_WINDOW 32768  /* response bytes outstanding before the rest is sent */
+
+static int pigpiod_pipe_connect(void)
+{
+    struct addrinfo hints, *res, *ai;
+    int fd = -1, one = 1, err;
+
+    char *addr = getenv("MCUPR_IMPL_PIGPIOD_ADDR");
+    char *port = getenv("MCUPR_IMPL_PIGPIOD_PORT");
+    if (addr == NULL && (addr = getenv("PIGPIO_ADDR")) == NULL) {
+        addr = "localhost";
+    }
+    if (port == NULL && (port = getenv("PIGPIO_PORT")) == NULL) {
+        port = "8888";
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    err = getaddrinfo(addr, port, &hints, &res);
+    if (err != 0) {
+        MCUPR_ERR("%s: %s:%s, %s", __func__, addr, port, gai_strerror(err));
+        return -1;
+    }
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        MCUPR_ERR("%s: can't connect to %s:%s", __func__, addr, port);
+        return -1;
+    }
+    /* commands are small, don't let Nagle hold them back */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return fd;
+}
+
+static mcupr_result_t pigpiod_pipe_send(int fd, struct iovec *iov, int cnt)
+{
+    struct msghdr msg;
+    ssize_t n;
+
+    while (0 < cnt) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            MCUPR_ERR("%s: %s", __func__, strerror(errno));
+            return MCUPR_RES_COMMUNICATION_ERROR;
+        }
+        while (0 < cnt && iov->iov_len <= (size_t)n) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (0 < cnt) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return MCUPR_RES_OK;
+}
+
+/* receive size bytes, discarded if buf is NULL */
+static mcupr_result_t pigpiod_pipe_recv(int fd, void *buf, uint32_t size)
+{
+    char discard[256];
+    ssize_t n;
+
+    while (0 < size) {
+        if (buf == NULL) {
+            n = recv(fd, discard, (size < sizeof(discard)) ? size : sizeof(discard), 0);
+        } else {
+            n = recv(fd, buf, size, 0);
+        }
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            MCUPR_ERR("%s: %s", __func__, (n == 0) ? "connection closed" : strerror(errno));
+            return MCUPR_RES_COMMUNICATION_ERROR;
+        }
+        if (buf != NULL) {
+            buf = (char *)buf + n;
+        }
+        size -= n;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+/* commands whose positive result is followed by as many data bytes */
+static int pigpiod_cmd_has_data(uint32_t cmd)
+{
+    switch (cmd) {
+    case PI_CMD_I2CRD:
+    case PI_CMD_I2CZ:
+    case PI_CMD_SPIR:
+    case PI_CMD_SPIX:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Send the requests and read their responses. Requests are written ahead of the responses
+ * as long as the data they return stays within PIGPIOD_PIPE_WINDOW, so that the daemon never
+ * blocks on a full socket while this side is still writing.
+ */
+static mcupr_result_t pigpiod_pipe_run(int fd, struct pigpiod_req *reqs, int n)
+{
+    struct iovec iov[PIGPIOD_PIPE_MAX * 2];
+    uint32_t hdr[PIGPIOD_PIPE_MAX][4];
+    uint32_t window;
+    int first, last, i, cnt;
+
+    for (first = 0; first < n; first = last) {
+        cnt = 0;
+        window = 0;
+        for (last = first; last < n && last - first < PIGPIOD_PIPE_MAX; last++) {
+            struct pigpiod_req *req = &reqs[last];
+            if (req->cmd == 0) {
+                continue;
+            }
+            if (last != first && PIGPIOD_PIPE_WINDOW < window + req->rlength) {
+                break;
+            }
+            window += req->rlength;
+            hdr[cnt / 2][0] = htole32(req->cmd);
+            hdr[cnt / 2][1] = htole32(req->p1);
+            hdr[cnt / 2][2] = htole32(req->p2);
+            hdr[cnt / 2][3] = htole32(req->ext_len);
+            iov[cnt].iov_base = hdr[cnt / 2];
+            iov[cnt].iov_len = sizeof(hdr[0]);
+            iov[cnt + 1].iov_base = (void *)req->ext;
+            iov[cnt + 1].iov_len = req->ext_len;
+            cnt += 2;
+        }
+        if (pigpiod_pipe_send(fd, iov, cnt) != MCUPR_RES_OK) {
+            return MCUPR_RES_COMMUNICATION_ERROR;
+        }
+        for (i = first; i < last; i++) {
+            struct pigpiod_req *req = &reqs[i];
+            uint32_t res[4], len;
+            if (req->cmd == 0) {
+                continue;
+            }
+            if (pigpiod_pipe_recv(fd, res, sizeof(res)) != MCUPR_RES_OK) {
+                return MCUPR_RES_COMMUNICATION_ERROR;
+            }
+            req->res = (int32_t)le32toh(res[3]);
+            if (!pigpiod_cmd_has_data(req->cmd) || req->res <= 0) {
+                continue;
+            }
+            /* the daemon sends res bytes whether or not there is a buffer for them */
+            len = 0;
+            if (req->rdata != NULL) {
+                len = ((uint32_t)req->res < req->rlength) ? (uint32_t)req->res : req->rlength;
+            }
+            if (pigpiod_pipe_recv(fd, req->rdata, len) != MCUPR_RES_OK ||
+                pigpiod_pipe_recv(fd, NULL, req->res - len) != MCUPR_RES_OK) {
+                return MCUPR_RES_COMMUNICATION_ERROR;
+            }
+        }
+    }
+
+    return MCUPR_RES_OK;
+}
@@ -35,6 +35,21 @@ void mcupr_initialize(void)
 void mcupr_gpio_init_params(mcupr_gpio_chip_params_t *params)
 {
     memset(params, 0, sizeof(*params));
+    params->event_queue_size = 1024;
+
+    char *chip = getenv("MCUPR_GPIO_CHIP");
+    if (chip != NULL) {
+        MCUPR_INF("%s: chip number is \"%s\"", __func__, chip);
+        params->chip = strtol(chip, NULL, 0);
+    } else {
+        params->chip = MCUPR_UNSPECIFIED;
+    }
+}
+
+void mcupr_gpio_wave_init_params(mcupr_gpio_wave_params_t *params)
+{
+    memset(params, 0, sizeof(*params));
+    params->cpu = -1;
 }
 
 void mcupr_i2c_init_params(mcupr_i2c_bus_params_t *params)
@@ -64,3 +79,48 @@ void mcupr_spi_init_params(mcupr_spi_bus_params_t *params)
         params->busnum = MCUPR_UNSPECIFIED;
     }
 }
+
+void mcupr_spi_sampler_init_params(mcupr_spi_sampler_params_t *params)
+{
+    memset(params, 0, sizeof(*params));
+    params->rate = 1000;
+    params->batch = 1;
+    params->count = 1000;
+    params->nbuffers = 2;
+    params->length = 2;
+    params->cpu = -1;
+}
+
+void mcupr_i2c_bitbang_init_params(mcupr_i2c_bitbang_params_t *params)
+{
+    memset(params, 0, sizeof(*params));
+    params->scl = -1;
+    params->sda = -1;
+    params->freq = 100000; /* 100 KHz */
+    params->stretch_timeout_us = 10000;
+}
+
+void mcupr_spi_bitbang_init_params(mcupr_spi_bitbang_params_t *params)
+{
+    int i;
+
+    memset(params, 0, sizeof(*params));
+    params->sclk = -1;
+    params->mosi = -1;
+    params->miso = -1;
+    for (i = 0; i < MCUPR_SPI_BITBANG_MAX_CS; i++) {
+        params->cs[i] = -1;
+    }
+    params->speed = 1000000;
+}
+
+void mcupr_regmap_init_params(mcupr_regmap_params_t *params)
+{
+    memset(params, 0, sizeof(*params));
+}
+
+void mcupr_queue_init_params(mcupr_queue_params_t *params)
+{
+    memset(params, 0, sizeof(*params));
+    params->depth = 16;
+}
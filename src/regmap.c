@@ -0,0 +1,486 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 hanyazou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <mcu_peripheral/mcu_peripheral.h>
+#include <mcu_peripheral/log.h>
+#include "utils.h"
+
+/*
+ * Register map
+ * The cache holds one entry per described register, sorted by address so that
+ * mcupr_regmap_sync() can merge neighbouring registers into bursts.
+ */
+
+#define REGMAP_WIDTH_MAX 4
+
+struct regmap_reg {
+    mcupr_reg_desc_t desc;
+    uint32_t value;
+    uint8_t valid;
+    uint8_t dirty;
+};
+
+struct regmap_data {
+    mcupr_regmap_params_t params;
+    struct regmap_reg *regs;
+    int16_t index[256];      /* register address to regs[], -1 if not described */
+    int cache_only;
+    int close_dev;           /* the I2C device was opened by the map */
+    uint8_t *buf;            /* addresses and values of all registers for bursts */
+    mcupr_i2c_msg_t *msgs;
+    mcupr_spi_regdev_t spi;  /* address format of SPI reads */
+    mcupr_regmap_stats_t stats;
+};
+
+static int regmap_compare(const void *a, const void *b)
+{
+    return ((const struct regmap_reg *)a)->desc.reg - ((const struct regmap_reg *)b)->desc.reg;
+}
+
+static uint32_t regmap_width_mask(const struct regmap_reg *r)
+{
+    return r->desc.width < 4 ? (1UL << (r->desc.width * 8)) - 1 : 0xffffffff;
+}
+
+static void regmap_pack(struct regmap_data *priv, const struct regmap_reg *r, uint32_t value,
+                        uint8_t *buf)
+{
+    int i, w = r->desc.width;
+
+    for (i = 0; i < w; i++) {
+        buf[i] = value >> ((priv->params.big_endian ? w - 1 - i : i) * 8);
+    }
+}
+
+static uint32_t regmap_unpack(struct regmap_data *priv, const struct regmap_reg *r,
+                              const uint8_t *buf)
+{
+    uint32_t value = 0;
+    int i, w = r->desc.width;
+
+    for (i = 0; i < w; i++) {
+        value |= (uint32_t)buf[i] << ((priv->params.big_endian ? w - 1 - i : i) * 8);
+    }
+    return value;
+}
+
+static struct regmap_reg *regmap_lookup(struct regmap_data *priv, uint8_t reg)
+{
+    int i = priv->index[reg];
+
+    return (i < 0) ? NULL : &priv->regs[i];
+}
+
+static uint8_t regmap_address(struct regmap_data *priv, uint8_t reg, int read, uint32_t length)
+{
+    reg |= read ? priv->params.read_mask : priv->params.write_mask;
+    if (1 < length) {
+        reg |= priv->params.burst_mask;
+    }
+    return reg;
+}
+
+static mcupr_result_t regmap_bus_read(mcupr_regmap_t *map, uint8_t reg, uint8_t *data,
+                                      uint32_t length)
+{
+    struct regmap_data *priv = (struct regmap_data *)map->data;
+    uint8_t addr = regmap_address(priv, reg, 1, length);
+    int res;
+
+    if (map->i2c_bus != NULL) {
+        res = mcupr_i2c_write_read(map->i2c_bus, map->dev, &addr, 1, data, length);
+        if (res < 0) {
+            return res;
+        }
+        return (res == (int)length) ? MCUPR_RES_OK : MCUPR_RES_COMMUNICATION_ERROR;
+    }
+
+    /* SPI clocks the address out first, the data follows it in the same transfer */
+    return mcupr_spi_reg_read(&priv->spi, reg, data, length);
+}
+
+/* buf holds the register address at buf[0] followed by length bytes of data */
+static mcupr_result_t regmap_bus_write(mcupr_regmap_t *map, uint8_t *buf, uint32_t length)
+{
+    int res;
+
+    if (map->i2c_bus != NULL) {
+        res = mcupr_i2c_write(map->i2c_bus, map->dev, buf, length + 1);
+    } else {
+        res = mcupr_spi_transfer(map->spi_bus, map->dev, buf, NULL, length + 1);
+    }
+    if (res < 0) {
+        return res;
+    }
+    return (res == (int)length + 1) ? MCUPR_RES_OK : MCUPR_RES_COMMUNICATION_ERROR;
+}
+
+static mcupr_result_t regmap_create(mcupr_regmap_t **mapp, const mcupr_regmap_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_regmap_t *map;
+    int i, size = 0;
+
+    if (params == NULL || params->regs == NULL || params->nregs <= 0 || 256 < params->nregs) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    res = MCUPR_ALLOC_OBJECT(map, mcupr_regmap_t, data, struct regmap_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct regmap_data *priv = (struct regmap_data *)map->data;
+    priv->params = *params;
+    priv->regs = calloc(params->nregs, sizeof(*priv->regs));
+    priv->msgs = calloc(params->nregs, sizeof(*priv->msgs));
+    for (i = 0; i < params->nregs; i++) {
+        size += 1 + params->regs[i].width;
+    }
+    priv->buf = malloc(size);
+    if (priv->regs == NULL || priv->msgs == NULL || priv->buf == NULL) {
+        MCUPR_ERR("%s: memory allocation failed", __func__);
+        res = MCUPR_RES_NOMEM;
+        goto error;
+    }
+
+    for (i = 0; i < params->nregs; i++) {
+        priv->regs[i].desc = params->regs[i];
+    }
+    qsort(priv->regs, params->nregs, sizeof(*priv->regs), regmap_compare);
+    memset(priv->index, 0xff, sizeof(priv->index));
+    for (i = 0; i < params->nregs; i++) {
+        struct regmap_reg *r = &priv->regs[i];
+        if (r->desc.width < 1 || REGMAP_WIDTH_MAX < r->desc.width ||
+            256 < r->desc.reg + r->desc.width ||
+            (0 < i && r->desc.reg < priv->regs[i - 1].desc.reg + priv->regs[i - 1].desc.width)) {
+            MCUPR_ERR("%s: bad descriptor of register 0x%02x", __func__, r->desc.reg);
+            res = MCUPR_RES_INVALID_ARGUMENT;
+            goto error;
+        }
+        priv->index[r->desc.reg] = i;
+        if (params->use_defaults && !(r->desc.flags & MCUPR_REG_VOLATILE)) {
+            r->value = r->desc.def & regmap_width_mask(r);
+            r->valid = 1;
+        }
+    }
+    *mapp = map;
+
+    return MCUPR_RES_OK;
+
+ error:
+    free(priv->buf);
+    free(priv->msgs);
+    free(priv->regs);
+    mcupr_release_object(map);
+    return res;
+}
+
+mcupr_result_t mcupr_regmap_create_i2c(mcupr_regmap_t **mapp, mcupr_i2c_bus_t *bus, int address,
+                                       const mcupr_regmap_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_regmap_t *map;
+
+    if (bus == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    res = regmap_create(&map, params);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct regmap_data *priv = (struct regmap_data *)map->data;
+    map->i2c_bus = bus;
+    map->address = address;
+    res = mcupr_i2c_open(bus, &map->dev, address);
+    if (res != MCUPR_RES_OK) {
+        mcupr_regmap_release(map);
+        return res;
+    }
+    priv->close_dev = 1;
+    *mapp = map;
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_regmap_create_spi(mcupr_regmap_t **mapp, mcupr_spi_bus_t *bus,
+                                       mcupr_spi_device_t dev, const mcupr_regmap_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_regmap_t *map;
+
+    if (bus == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    res = regmap_create(&map, params);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct regmap_data *priv = (struct regmap_data *)map->data;
+    map->spi_bus = bus;
+    map->dev = dev;
+    priv->spi.bus = bus;
+    priv->spi.dev = dev;
+    priv->spi.addr_width = 1;
+    priv->spi.dummy = params->spi_dummy;
+    priv->spi.read_mask = params->read_mask;
+    priv->spi.burst_mask = params->burst_mask;
+    *mapp = map;
+
+    return MCUPR_RES_OK;
+}
+
+void mcupr_regmap_release(mcupr_regmap_t *map)
+{
+    if (map == NULL || map->data == NULL) {
+        return;
+    }
+    struct regmap_data *priv = (struct regmap_data *)map->data;
+
+    if (priv->close_dev) {
+        mcupr_i2c_close(map->i2c_bus, map->dev);
+    }
+    free(priv->buf);
+    free(priv->msgs);
+    free(priv->regs);
+    mcupr_release_object(map);
+}
+
+mcupr_result_t mcupr_regmap_read(mcupr_regmap_t *map, uint8_t reg, uint32_t *value)
+{
+    mcupr_result_t res;
+    uint8_t buf[REGMAP_WIDTH_MAX];
+
+    if (map == NULL || map->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct regmap_data *priv = (struct regmap_data *)map->data;
+    struct regmap_reg *r = regmap_lookup(priv, reg);
+    if (r == NULL) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+
+    if (r->valid) {
+        priv->stats.cache_hits++;
+        *value = r->value;
+        return MCUPR_RES_OK;
+    }
+    if (r->desc.flags & MCUPR_REG_WRITE_ONLY) {
+        return MCUPR_RES_NOT_SUPPORTED;
+    }
+    res = regmap_bus_read(map, reg, buf, r->desc.width);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    priv->stats.bus_reads++;
+    *value = regmap_unpack(priv, r, buf);
+    if (!(r->desc.flags & MCUPR_REG_VOLATILE)) {
+        r->value = *value;
+        r->valid = 1;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_regmap_write(mcupr_regmap_t *map, uint8_t reg, uint32_t value)
+{
+    mcupr_result_t res;
+    uint8_t buf[1 + REGMAP_WIDTH_MAX];
+
+    if (map == NULL || map->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct regmap_data *priv = (struct regmap_data *)map->data;
+    struct regmap_reg *r = regmap_lookup(priv, reg);
+    if (r == NULL || (r->desc.flags & MCUPR_REG_READ_ONLY)) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    value &= regmap_width_mask(r);
+    if ((r->desc.flags & MCUPR_REG_VOLATILE) && priv->cache_only) {
+        /* there is no cache to record it in, and the device may be off */
+        return MCUPR_RES_BUSY;
+    }
+
+    if (!(r->desc.flags & MCUPR_REG_VOLATILE)) {
+        if (r->valid && r->value == value) {
+            priv->stats.skipped_writes++;
+            return MCUPR_RES_OK;
+        }
+        if (priv->cache_only) {
+            r->value = value;
+            r->valid = 1;
+            r->dirty = 1;
+            return MCUPR_RES_OK;
+        }
+    }
+
+    buf[0] = regmap_address(priv, reg, 0, r->desc.width);
+    regmap_pack(priv, r, value, &buf[1]);
+    res = regmap_bus_write(map, buf, r->desc.width);
+    if (res != MCUPR_RES_OK) {
+        r->valid = 0;
+        return res;
+    }
+    priv->stats.bus_writes++;
+    if (!(r->desc.flags & MCUPR_REG_VOLATILE)) {
+        r->value = value;
+        r->valid = 1;
+        r->dirty = 0;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+mcupr_result_t mcupr_regmap_update_bits(mcupr_regmap_t *map, uint8_t reg, uint32_t mask,
+                                        uint32_t value)
+{
+    mcupr_result_t res;
+    uint32_t old;
+
+    res = mcupr_regmap_read(map, reg, &old);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    return mcupr_regmap_write(map, reg, (old & ~mask) | (value & mask));
+}
+
+mcupr_result_t mcupr_regmap_bulk_read(mcupr_regmap_t *map, uint8_t reg, uint8_t *data,
+                                      uint32_t length)
+{
+    if (map == NULL || map->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (length == 0) {
+        return MCUPR_RES_OK;
+    }
+    return regmap_bus_read(map, reg, data, length);
+}
+
+void mcupr_regmap_set_cache_only(mcupr_regmap_t *map, int enable)
+{
+    if (map == NULL || map->data == NULL) {
+        return;
+    }
+    struct regmap_data *priv = (struct regmap_data *)map->data;
+    priv->cache_only = enable;
+}
+
+/* a clean register may be rewritten with its cached value to join two dirty neighbours */
+static int regmap_can_bridge(const struct regmap_reg *r)
+{
+    return r->dirty ||
+        (r->valid && !(r->desc.flags & (MCUPR_REG_VOLATILE | MCUPR_REG_READ_ONLY)));
+}
+
+mcupr_result_t mcupr_regmap_sync(mcupr_regmap_t *map)
+{
+    mcupr_result_t res;
+    int i, j, last, nmsgs = 0;
+
+    if (map == NULL || map->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct regmap_data *priv = (struct regmap_data *)map->data;
+    int nregs = priv->params.nregs;
+    uint8_t *p = priv->buf;
+
+    /* collect runs of registers at consecutive addresses which start and end dirty */
+    for (i = 0; i < nregs; i = last + 1) {
+        last = i;
+        if (!priv->regs[i].dirty) {
+            continue;
+        }
+        for (j = i + 1; j < nregs && regmap_can_bridge(&priv->regs[j]) &&
+                 priv->regs[j].desc.reg ==
+                 priv->regs[j - 1].desc.reg + priv->regs[j - 1].desc.width; j++) {
+            if (priv->regs[j].dirty) {
+                last = j;
+            }
+        }
+
+        uint8_t *start = p;
+        uint32_t length = 0;
+        p++;
+        for (j = i; j <= last; j++) {
+            regmap_pack(priv, &priv->regs[j], priv->regs[j].value, p);
+            p += priv->regs[j].desc.width;
+            length += priv->regs[j].desc.width;
+        }
+        start[0] = regmap_address(priv, priv->regs[i].desc.reg, 0, length);
+        priv->msgs[nmsgs].addr = map->address;
+        /* each burst is a transaction of its own, the address pointer must restart */
+        priv->msgs[nmsgs].flags = MCUPR_I2C_M_STOP;
+        priv->msgs[nmsgs].length = length + 1;
+        priv->msgs[nmsgs].data = start;
+        nmsgs++;
+    }
+    if (nmsgs == 0) {
+        return MCUPR_RES_OK;
+    }
+
+    if (map->i2c_bus != NULL) {
+        /* one batch for the whole sync, the bursts separated by stops */
+        res = mcupr_i2c_transfer(map->i2c_bus, priv->msgs, nmsgs);
+        res = (res < 0) ? res : MCUPR_RES_OK;
+    } else {
+        res = MCUPR_RES_OK;
+        for (i = 0; i < nmsgs && res == MCUPR_RES_OK; i++) {
+            res = regmap_bus_write(map, priv->msgs[i].data, priv->msgs[i].length - 1);
+        }
+    }
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    priv->stats.bus_writes += nmsgs;
+    for (i = 0; i < nregs; i++) {
+        priv->regs[i].dirty = 0;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+void mcupr_regmap_invalidate(mcupr_regmap_t *map)
+{
+    int i;
+
+    if (map == NULL || map->data == NULL) {
+        return;
+    }
+    struct regmap_data *priv = (struct regmap_data *)map->data;
+    for (i = 0; i < priv->params.nregs; i++) {
+        priv->regs[i].valid = 0;
+        priv->regs[i].dirty = 0;
+    }
+}
+
+mcupr_result_t mcupr_regmap_get_stats(mcupr_regmap_t *map, mcupr_regmap_stats_t *stats)
+{
+    if (map == NULL || map->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct regmap_data *priv = (struct regmap_data *)map->data;
+    *stats = priv->stats;
+
+    return MCUPR_RES_OK;
+}
@@ -0,0 +1,466 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 hanyazou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mcu_peripheral/mcu_peripheral.h>
+#include <mcu_peripheral/log.h>
+#include "impl.h"
+#include "utils.h"
+
+/*
+ * SPI API
+ * Dispatch to the operations of the bus under the lock of the bus.
+ */
+
+void mcupr_spi_lock(mcupr_spi_bus_t *bus)
+{
+    mcupr_lock_acquire(&bus->lock);
+}
+
+void mcupr_spi_unlock(mcupr_spi_bus_t *bus)
+{
+    mcupr_lock_release(&bus->lock);
+}
+
+void mcupr_spi_bus_release(mcupr_spi_bus_t *bus)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return;
+    }
+    (*bus->ops->release)(bus);
+}
+
+mcupr_result_t mcupr_spi_open(mcupr_spi_bus_t *bus, mcupr_spi_device_t *dev, int csnum)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    mcupr_spi_lock(bus);
+    mcupr_result_t res = (*bus->ops->open)(bus, dev, csnum);
+    mcupr_spi_unlock(bus);
+
+    return res;
+}
+
+void mcupr_spi_close(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return;
+    }
+    mcupr_spi_lock(bus);
+    (*bus->ops->close)(bus, dev);
+    mcupr_spi_unlock(bus);
+}
+
+int mcupr_spi_transfer(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                       const uint8_t *tx_data, uint8_t *rx_data, int length)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    mcupr_spi_lock(bus);
+    int res = (*bus->ops->transfer)(bus, dev, tx_data, rx_data, length);
+    mcupr_spi_unlock(bus);
+
+    return res;
+}
+
+/* whole words as bytes, most significant byte first on the wire, in one transfer */
+static int spi_transfer_words_emulate(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                                      const void *tx_data, void *rx_data, int count, int size,
+                                      int bits)
+{
+    if (bits != size * 8) {
+        return MCUPR_RES_NOT_SUPPORTED;
+    }
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (*bus->ops->transfer)(bus, dev, tx_data, rx_data, count * size);
+#else
+    /*
+     * Zeros need no swapping. Other words are swapped into rx_data and sent from there, or
+     * without rx_data swapped in the caller's buffer and swapped back after the transfer.
+     */
+    void *buf = (rx_data != NULL) ? rx_data : (void *)tx_data;
+    int ret;
+
+    if (tx_data != NULL && size == 2) {
+        mcupr_swap16(buf, tx_data, count);
+    } else if (tx_data != NULL) {
+        mcupr_swap32(buf, tx_data, count);
+    }
+    ret = (*bus->ops->transfer)(bus, dev, (tx_data != NULL) ? buf : NULL, rx_data, count * size);
+    if (rx_data == NULL && tx_data != NULL) {
+        if (size == 2) {
+            mcupr_swap16(buf, buf, count);
+        } else {
+            mcupr_swap32(buf, buf, count);
+        }
+    } else if (0 < ret && rx_data != NULL && size == 2) {
+        mcupr_swap16(rx_data, rx_data, ret / 2);
+    } else if (0 < ret && rx_data != NULL) {
+        mcupr_swap32(rx_data, rx_data, ret / 4);
+    }
+    return ret;
+#endif
+}
+
+static int spi_transfer_words(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, const void *tx_data,
+                              void *rx_data, int count, int size, int bits)
+{
+    int res = MCUPR_RES_NOT_SUPPORTED;
+
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (count < 0 || bits < 1 || size * 8 < bits || INT32_MAX / size < count) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    mcupr_spi_lock(bus);
+    if (bus->ops->transfer_words != NULL) {
+        res = (*bus->ops->transfer_words)(bus, dev, tx_data, rx_data, count, size, bits);
+    }
+    if (res == MCUPR_RES_NOT_SUPPORTED) {
+        res = spi_transfer_words_emulate(bus, dev, tx_data, rx_data, count, size, bits);
+    }
+    mcupr_spi_unlock(bus);
+
+    return (res < 0) ? res : res / size;
+}
+
+int mcupr_spi_transfer16(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                         const uint16_t *tx_data, uint16_t *rx_data, int count, int bits)
+{
+    return spi_transfer_words(bus, dev, tx_data, rx_data, count, 2, bits);
+}
+
+int mcupr_spi_transfer32(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                         const uint32_t *tx_data, uint32_t *rx_data, int count, int bits)
+{
+    return spi_transfer_words(bus, dev, tx_data, rx_data, count, 4, bits);
+}
+
+/* one transfer per run of segments between cs_change points, through a bounce buffer */
+static int spi_message_emulate(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                               const mcupr_spi_segment_t *segs, int n)
+{
+    uint8_t *buf;
+    uint32_t length, max = 0, pos;
+    int i, first, last, ret, total = 0;
+
+    for (first = 0; first < n; first = last + 1) {
+        length = 0;
+        for (last = first; ; last++) {
+            if (segs[last].speed_hz != 0 || segs[last].bits_per_word != 0) {
+                return MCUPR_RES_NOT_SUPPORTED;
+            }
+            length += segs[last].length;
+            if (last == n - 1 || segs[last].cs_change) {
+                break;
+            }
+            if (segs[last].delay_usecs != 0) {
+                return MCUPR_RES_NOT_SUPPORTED;
+            }
+        }
+        if (max < length) {
+            max = length;
+        }
+    }
+
+    if (n == 1) {
+        /* a single segment needs no copy */
+        ret = (*bus->ops->transfer)(bus, dev, segs[0].tx_data, segs[0].rx_data, segs[0].length);
+        if (0 <= ret && segs[0].delay_usecs != 0) {
+            usleep(segs[0].delay_usecs);
+        }
+        return ret;
+    }
+    if (max == 0) {
+        return 0;
+    }
+    buf = malloc(max);
+    if (buf == NULL) {
+        MCUPR_ERR("%s: memory allocation failed", __func__);
+        return MCUPR_RES_NOMEM;
+    }
+    for (first = 0; first < n; first = last + 1) {
+        pos = 0;
+        for (last = first; ; last++) {
+            if (segs[last].tx_data != NULL) {
+                memcpy(&buf[pos], segs[last].tx_data, segs[last].length);
+            } else {
+                memset(&buf[pos], 0, segs[last].length);
+            }
+            pos += segs[last].length;
+            if (last == n - 1 || segs[last].cs_change) {
+                break;
+            }
+        }
+        ret = (*bus->ops->transfer)(bus, dev, buf, buf, pos);
+        if (ret < 0) {
+            total = ret;
+            break;
+        }
+        pos = 0;
+        for (i = first; i <= last; i++) {
+            if (segs[i].rx_data != NULL) {
+                memcpy(segs[i].rx_data, &buf[pos], segs[i].length);
+            }
+            pos += segs[i].length;
+        }
+        total += ret;
+        if (segs[last].delay_usecs != 0) {
+            usleep(segs[last].delay_usecs);
+        }
+    }
+    free(buf);
+
+    return total;
+}
+
+int mcupr_spi_message(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                      const mcupr_spi_segment_t *segs, int n)
+{
+    int res;
+
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (n <= 0 || segs == NULL) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    mcupr_spi_lock(bus);
+    if (bus->ops->message != NULL) {
+        res = (*bus->ops->message)(bus, dev, segs, n);
+    } else {
+        res = spi_message_emulate(bus, dev, segs, n);
+    }
+    mcupr_spi_unlock(bus);
+
+    return res;
+}
+
+/* chunk size of streams on buses without the stream operation */
+#define SPI_STREAM_CHUNK 4096
+
+/* one transfer per chunk, the device may be deselected between chunks */
+static int spi_stream_emulate(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, uint32_t length,
+                              mcupr_spi_fill_t fill, mcupr_spi_drain_t drain, void *user_data)
+{
+    uint32_t offset, chunk = SPI_STREAM_CHUNK;
+    uint8_t *buf;
+    int ret = 0;
+
+    buf = calloc(1, chunk);
+    if (buf == NULL) {
+        MCUPR_ERR("%s: memory allocation failed", __func__);
+        return MCUPR_RES_NOMEM;
+    }
+    for (offset = 0; offset < length; offset += chunk) {
+        if (length - offset < chunk) {
+            chunk = length - offset;
+        }
+        if (fill != NULL) {
+            ret = (*fill)(user_data, buf, offset, chunk);
+        } else if (drain != NULL) {
+            memset(buf, 0, chunk);
+        }
+        if (0 <= ret) {
+            ret = (*bus->ops->transfer)(bus, dev, buf, (drain != NULL) ? buf : NULL, chunk);
+        }
+        if (0 <= ret && drain != NULL) {
+            ret = (*drain)(user_data, buf, offset, chunk);
+        }
+        if (ret < 0) {
+            break;
+        }
+    }
+    free(buf);
+
+    return (ret < 0) ? ret : (int)length;
+}
+
+int mcupr_spi_stream(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev, uint32_t length,
+                     mcupr_spi_fill_t fill, mcupr_spi_drain_t drain, void *user_data)
+{
+    int res;
+
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (INT32_MAX < length) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    mcupr_spi_lock(bus);
+    if (bus->ops->stream != NULL) {
+        res = (*bus->ops->stream)(bus, dev, length, fill, drain, user_data);
+    } else {
+        res = spi_stream_emulate(bus, dev, length, fill, drain, user_data);
+    }
+    mcupr_spi_unlock(bus);
+
+    return res;
+}
+
+mcupr_result_t mcupr_spi_configure(mcupr_spi_bus_t *bus, mcupr_spi_device_t dev,
+                                   const mcupr_spi_config_t *config)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (bus->ops->configure == NULL) {
+        return MCUPR_RES_NOT_SUPPORTED;
+    }
+    mcupr_spi_lock(bus);
+    mcupr_result_t res = (*bus->ops->configure)(bus, dev, config);
+    mcupr_spi_unlock(bus);
+
+    return res;
+}
+
+/*
+ * SPI register access
+ */
+
+/* larger blocks go through mcupr_spi_message(), allocating where it is emulated */
+#define SPI_REG_STACK_BUF 64
+#define SPI_REG_HEADER_MAX (4 + 255)
+
+static uint32_t spi_reg_header(const mcupr_spi_regdev_t *rd, uint32_t reg, int read,
+                               uint32_t length, uint8_t *buf)
+{
+    uint32_t i, n = rd->addr_width;
+
+    reg |= read ? rd->read_mask : rd->write_mask;
+    if (1 < length) {
+        reg |= rd->burst_mask;
+    }
+    for (i = 0; i < n; i++) {
+        buf[i] = reg >> ((n - 1 - i) * 8);
+    }
+    if (read) {
+        memset(&buf[n], 0, rd->dummy);
+        n += rd->dummy;
+    }
+    return n;
+}
+
+mcupr_result_t mcupr_spi_reg_read(const mcupr_spi_regdev_t *rd, uint32_t reg, uint8_t *data,
+                                  uint32_t length)
+{
+    uint8_t tx[SPI_REG_STACK_BUF], rx[SPI_REG_STACK_BUF];
+    uint32_t n;
+    int res;
+
+    if (rd == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (rd->addr_width < 1 || 4 < rd->addr_width || (data == NULL && 0 < length)) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    if (rd->addr_width + rd->dummy + length <= sizeof(tx)) {
+        n = spi_reg_header(rd, reg, 1, length, tx);
+        memset(&tx[n], 0, length);
+        res = mcupr_spi_transfer(rd->bus, rd->dev, tx, rx, n + length);
+        if (res == (int)(n + length)) {
+            memcpy(data, &rx[n], length);
+        }
+    } else {
+        uint8_t header[SPI_REG_HEADER_MAX];
+        mcupr_spi_segment_t segs[2] = {
+            { .tx_data = header },
+            { .rx_data = data, .length = length },
+        };
+        segs[0].length = n = spi_reg_header(rd, reg, 1, length, header);
+        res = mcupr_spi_message(rd->bus, rd->dev, segs, 2);
+    }
+    if (res < 0) {
+        return res;
+    }
+
+    return (res == (int)(n + length)) ? MCUPR_RES_OK : MCUPR_RES_COMMUNICATION_ERROR;
+}
+
+mcupr_result_t mcupr_spi_reg_write(const mcupr_spi_regdev_t *rd, uint32_t reg,
+                                   const uint8_t *data, uint32_t length)
+{
+    uint8_t tx[SPI_REG_STACK_BUF];
+    uint32_t n;
+    int res;
+
+    if (rd == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (rd->addr_width < 1 || 4 < rd->addr_width || (data == NULL && 0 < length)) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    if (rd->addr_width + length <= sizeof(tx)) {
+        n = spi_reg_header(rd, reg, 0, length, tx);
+        memcpy(&tx[n], data, length);
+        res = mcupr_spi_transfer(rd->bus, rd->dev, tx, NULL, n + length);
+    } else {
+        mcupr_spi_segment_t segs[2] = {
+            { .tx_data = tx },
+            { .tx_data = data, .length = length },
+        };
+        segs[0].length = n = spi_reg_header(rd, reg, 0, length, tx);
+        res = mcupr_spi_message(rd->bus, rd->dev, segs, 2);
+    }
+    if (res < 0) {
+        return res;
+    }
+
+    return (res == (int)(n + length)) ? MCUPR_RES_OK : MCUPR_RES_COMMUNICATION_ERROR;
+}
+
+mcupr_result_t mcupr_spi_set_speed(mcupr_spi_bus_t *bus, uint32_t speed)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (bus->ops->set_speed == NULL) {
+        return MCUPR_RES_NOT_SUPPORTED;
+    }
+    mcupr_spi_lock(bus);
+    mcupr_result_t res = (*bus->ops->set_speed)(bus, speed);
+    mcupr_spi_unlock(bus);
+
+    return res;
+}
+
+mcupr_result_t mcupr_spi_set_mode(mcupr_spi_bus_t *bus, mcupr_spi_mode_t mode)
+{
+    if (bus == NULL || bus->ops == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (bus->ops->set_mode == NULL) {
+        return MCUPR_RES_NOT_SUPPORTED;
+    }
+    mcupr_spi_lock(bus);
+    mcupr_result_t res = (*bus->ops->set_mode)(bus, mode);
+    mcupr_spi_unlock(bus);
+
+    return res;
+}
@@ -0,0 +1,481 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 hanyazou
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "utils.h"
+#include <mcu_peripheral/mcu_peripheral.h>
+#include <mcu_peripheral/log.h>
+
+/*
+ * SPI sampling engine
+ * The engine thread owns one buffer at a time and points the receive buffers of the segments
+ * of a batch straight into it, so the data of a conversion is written once, by the driver.
+ * Deadlines are kept on an absolute schedule from the start so that errors don't accumulate;
+ * when the thread falls behind by whole periods they are skipped and counted instead of run
+ * back to back.
+ */
+
+#define SPI_SAMPLER_START_DELAY_NS 100000   /* lead time before the first batch */
+#define SPI_SAMPLER_MAX_SLEEP_NS 10000000   /* sleep in slices to notice a stop request */
+
+enum {
+    SPI_SAMPLER_FREE = 0,
+    SPI_SAMPLER_FILLING,
+    SPI_SAMPLER_FULL,
+    SPI_SAMPLER_TAKEN,
+};
+
+struct spi_sampler_buffer {
+    uint8_t *data;
+    int state;
+    uint32_t seqno;
+    uint64_t timestamp_ns;
+};
+
+struct spi_sampler_data {
+    mcupr_spi_sampler_params_t params;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* start requests for the engine */
+    pthread_cond_t full;        /* filled buffers for the consumer */
+    int exiting;
+    int running;
+    int stop;                   /* leave the current schedule */
+    uint8_t *mem;
+    struct spi_sampler_buffer bufs[MCUPR_SPI_SAMPLER_MAX_BUFFERS];
+    uint32_t seqno;
+    mcupr_spi_segment_t *segs;
+    mcupr_spi_sampler_stats_t stats;
+    uint64_t jitter_sum;
+    uint64_t batches;
+};
+
+static uint64_t spi_sampler_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Wait until the deadline, returns non-zero if a stop was requested meanwhile */
+static int spi_sampler_wait(struct spi_sampler_data *priv, uint64_t deadline)
+{
+    struct timespec ts;
+    uint64_t now;
+
+    while ((now = spi_sampler_now()) < deadline) {
+        if (__atomic_load_n(&priv->stop, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+        uint64_t t = deadline;
+        if (SPI_SAMPLER_MAX_SLEEP_NS < t - now) {
+            t = now + SPI_SAMPLER_MAX_SLEEP_NS;
+        }
+        ts.tv_sec = t / 1000000000;
+        ts.tv_nsec = t % 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+
+    return __atomic_load_n(&priv->stop, __ATOMIC_RELAXED);
+}
+
+/*
+ * A free buffer for the engine, or else the oldest full one other than the buffer just filled,
+ * which is left for the consumer. NULL if the consumer holds all the others.
+ */
+static struct spi_sampler_buffer *spi_sampler_next_buffer(struct spi_sampler_data *priv,
+                                                          struct spi_sampler_buffer *filled)
+{
+    struct spi_sampler_buffer *buf = NULL;
+    uint32_t i;
+
+    for (i = 0; i < priv->params.nbuffers; i++) {
+        if (priv->bufs[i].state == SPI_SAMPLER_FREE) {
+            buf = &priv->bufs[i];
+            break;
+        }
+        if (priv->bufs[i].state == SPI_SAMPLER_FULL && &priv->bufs[i] != filled &&
+            (buf == NULL || (int32_t)(priv->bufs[i].seqno - buf->seqno) < 0)) {
+            buf = &priv->bufs[i];
+        }
+    }
+    if (buf != NULL && buf->state == SPI_SAMPLER_FULL) {
+        priv->stats.overruns += priv->params.count / priv->params.batch;
+    }
+    if (buf != NULL) {
+        buf->state = SPI_SAMPLER_FILLING;
+    }
+
+    return buf;
+}
+
+static void *spi_sampler_thread(void *arg)
+{
+    mcupr_spi_sampler_t *sampler = (mcupr_spi_sampler_t *)arg;
+    struct spi_sampler_data *priv = (struct spi_sampler_data *)sampler->data;
+    const mcupr_spi_sampler_params_t *params = &priv->params;
+    uint64_t period = (uint64_t)1000000000 * params->batch / params->rate;
+    uint32_t batch_bytes = params->batch * params->length;
+    struct spi_sampler_buffer *buf = NULL;
+    uint64_t deadline, now, jitter, late;
+    uint32_t pos, i;
+    int res;
+
+    pthread_mutex_lock(&priv->lock);
+    while (!priv->exiting) {
+        if (!priv->running) {
+            pthread_cond_wait(&priv->cond, &priv->lock);
+            continue;
+        }
+        buf = spi_sampler_next_buffer(priv, NULL);
+        pthread_mutex_unlock(&priv->lock);
+
+        pos = 0;
+        deadline = spi_sampler_now() + SPI_SAMPLER_START_DELAY_NS;
+        while (!spi_sampler_wait(priv, deadline)) {
+            now = spi_sampler_now();
+            jitter = now - deadline;
+            res = MCUPR_RES_OK;
+            if (buf != NULL) {
+                if (pos == 0) {
+                    buf->timestamp_ns = now;
+                }
+                for (i = 0; i < params->batch; i++) {
+                    priv->segs[i].rx_data = &buf->data[pos + i * params->length];
+                }
+                if (params->batch == 1) {
+                    res = mcupr_spi_transfer(sampler->bus, sampler->dev, params->tx_data,
+                                             priv->segs[0].rx_data, params->length);
+                } else {
+                    res = mcupr_spi_message(sampler->bus, sampler->dev, priv->segs,
+                                            params->batch);
+                }
+                pos += batch_bytes;
+            }
+
+            /* skip the deadlines which have passed already */
+            deadline += period;
+            now = spi_sampler_now();
+            late = (deadline + period <= now) ? (now - deadline) / period : 0;
+            deadline += late * period;
+
+            pthread_mutex_lock(&priv->lock);
+            priv->batches++;
+            priv->jitter_sum += jitter;
+            if (priv->stats.max_jitter_ns < jitter) {
+                priv->stats.max_jitter_ns = (jitter < UINT32_MAX) ? jitter : UINT32_MAX;
+            }
+            priv->stats.missed += late;
+            if (buf == NULL) {
+                /* the consumer holds all buffers, the batch is dropped */
+                priv->stats.overruns++;
+                buf = spi_sampler_next_buffer(priv, NULL);
+            } else if (res < 0) {
+                priv->stats.errors++;
+            } else {
+                priv->stats.samples += params->batch;
+            }
+            if (buf != NULL && pos == params->count * params->length) {
+                buf->state = SPI_SAMPLER_FULL;
+                buf->seqno = priv->seqno++;
+                pthread_cond_broadcast(&priv->full);
+                buf = spi_sampler_next_buffer(priv, buf);
+                pos = 0;
+            }
+            pthread_mutex_unlock(&priv->lock);
+        }
+
+        pthread_mutex_lock(&priv->lock);
+        if (buf != NULL) {
+            /* a partly filled buffer is dropped */
+            buf->state = SPI_SAMPLER_FREE;
+            buf = NULL;
+        }
+        priv->running = 0;
+        priv->stop = 0;
+        pthread_cond_broadcast(&priv->full);
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return NULL;
+}
+
+static mcupr_result_t spi_sampler_start_thread(mcupr_spi_sampler_t *sampler)
+{
+    struct spi_sampler_data *priv = (struct spi_sampler_data *)sampler->data;
+    pthread_attr_t attr;
+    int res;
+
+    pthread_attr_init(&attr);
+    if (0 <= priv->params.cpu) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(priv->params.cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    if (0 < priv->params.priority) {
+        struct sched_param sp;
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = priv->params.priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &sp);
+    }
+    res = pthread_create(&priv->thread, &attr, spi_sampler_thread, sampler);
+    if (res == EPERM && 0 < priv->params.priority) {
+        MCUPR_WRN("%s: no permission for SCHED_FIFO, use normal scheduling", __func__);
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        res = pthread_create(&priv->thread, &attr, spi_sampler_thread, sampler);
+    }
+    pthread_attr_destroy(&attr);
+    if (res != 0) {
+        MCUPR_ERR("%s: can't create engine thread, %s", __func__, strerror(res));
+        return MCUPR_RES_BACKEND_FAILURE;
+    }
+
+    return MCUPR_RES_OK;
+}
+
+static void spi_sampler_free(mcupr_spi_sampler_t *sampler)
+{
+    struct spi_sampler_data *priv = (struct spi_sampler_data *)sampler->data;
+
+    pthread_cond_destroy(&priv->full);
+    pthread_cond_destroy(&priv->cond);
+    pthread_mutex_destroy(&priv->lock);
+    free(priv->segs);
+    free(priv->mem);
+    mcupr_release_object(sampler);
+}
+
+mcupr_result_t mcupr_spi_sampler_create(mcupr_spi_sampler_t **samplerp, mcupr_spi_bus_t *bus,
+                                        mcupr_spi_device_t dev,
+                                        const mcupr_spi_sampler_params_t *params)
+{
+    mcupr_result_t res;
+    mcupr_spi_sampler_t *sampler;
+    pthread_condattr_t attr;
+    uint32_t i;
+
+    if (bus == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    if (params == NULL || params->rate == 0 || params->batch == 0 || params->length == 0 ||
+        params->count == 0 || params->count % params->batch != 0 || params->nbuffers < 2 ||
+        MCUPR_SPI_SAMPLER_MAX_BUFFERS < params->nbuffers ||
+        (uint64_t)params->count * params->length * params->nbuffers > INT32_MAX) {
+        return MCUPR_RES_INVALID_ARGUMENT;
+    }
+    res = MCUPR_ALLOC_OBJECT(sampler, mcupr_spi_sampler_t, data, struct spi_sampler_data);
+    if (res != MCUPR_RES_OK) {
+        return res;
+    }
+    struct spi_sampler_data *priv = (struct spi_sampler_data *)sampler->data;
+    sampler->bus = bus;
+    sampler->dev = dev;
+    priv->params = *params;
+    pthread_mutex_init(&priv->lock, NULL);
+    pthread_cond_init(&priv->cond, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&priv->full, &attr);
+    pthread_condattr_destroy(&attr);
+
+    priv->mem = malloc((size_t)params->count * params->length * params->nbuffers);
+    priv->segs = calloc(params->batch, sizeof(*priv->segs));
+    if (priv->mem == NULL || priv->segs == NULL) {
+        MCUPR_ERR("%s: memory allocation failed", __func__);
+        spi_sampler_free(sampler);
+        return MCUPR_RES_NOMEM;
+    }
+    for (i = 0; i < params->nbuffers; i++) {
+        priv->bufs[i].data = &priv->mem[(size_t)i * params->count * params->length];
+    }
+    for (i = 0; i < params->batch; i++) {
+        priv->segs[i].tx_data = params->tx_data;
+        priv->segs[i].length = params->length;
+        if (i + 1 < params->batch) {
+            priv->segs[i].cs_change = 1;
+            priv->segs[i].delay_usecs = params->spacing_us;
+        }
+    }
+
+    res = spi_sampler_start_thread(sampler);
+    if (res != MCUPR_RES_OK) {
+        spi_sampler_free(sampler);
+        return res;
+    }
+    *samplerp = sampler;
+
+    return MCUPR_RES_OK;
+}
+
+void mcupr_spi_sampler_release(mcupr_spi_sampler_t *sampler)
+{
+    if (sampler == NULL || sampler->data == NULL) {
+        return;
+    }
+    struct spi_sampler_data *priv = (struct spi_sampler_data *)sampler->data;
+
+    pthread_mutex_lock(&priv->lock);
+    priv->exiting = 1;
+    __atomic_store_n(&priv->stop, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&priv->cond);
+    pthread_mutex_unlock(&priv->lock);
+    pthread_join(priv->thread, NULL);
+
+    spi_sampler_free(sampler);
+}
+
+mcupr_result_t mcupr_spi_sampler_start(mcupr_spi_sampler_t *sampler)
+{
+    if (sampler == NULL || sampler->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct spi_sampler_data *priv = (struct spi_sampler_data *)sampler->data;
+
+    pthread_mutex_lock(&priv->lock);
+    if (priv->running) {
+        pthread_mutex_unlock(&priv->lock);
+        return MCUPR_RES_BUSY;
+    }
+    priv->running = 1;
+    pthread_cond_signal(&priv->cond);
+    pthread_mutex_unlock(&priv->lock);
+
+    return MCUPR_RES_OK;
+}
+
+void mcupr_spi_sampler_stop(mcupr_spi_sampler_t *sampler)
+{
+    if (sampler == NULL || sampler->data == NULL) {
+        return;
+    }
+    struct spi_sampler_data *priv = (struct spi_sampler_data *)sampler->data;
+
+    pthread_mutex_lock(&priv->lock);
+    if (priv->running) {
+        __atomic_store_n(&priv->stop, 1, __ATOMIC_RELAXED);
+    }
+    while (priv->running) {
+        pthread_cond_wait(&priv->full, &priv->lock);
+    }
+    pthread_mutex_unlock(&priv->lock);
+}
+
+mcupr_result_t mcupr_spi_sampler_get(mcupr_spi_sampler_t *sampler,
+                                     mcupr_spi_sampler_buffer_t *buffer, int timeout_ms)
+{
+    struct spi_sampler_buffer *buf;
+    struct timespec deadline;
+    uint32_t i;
+    int err = 0;
+
+    if (sampler == NULL || sampler->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct spi_sampler_data *priv = (struct spi_sampler_data *)sampler->data;
+
+    if (0 < timeout_ms) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+        if (1000000000 <= deadline.tv_nsec) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+    pthread_mutex_lock(&priv->lock);
+    for (;;) {
+        buf = NULL;
+        for (i = 0; i < priv->params.nbuffers; i++) {
+            if (priv->bufs[i].state == SPI_SAMPLER_FULL &&
+                (buf == NULL || (int32_t)(priv->bufs[i].seqno - buf->seqno) < 0)) {
+                buf = &priv->bufs[i];
+            }
+        }
+        if (buf != NULL || timeout_ms == 0 || err == ETIMEDOUT) {
+            break;
+        }
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&priv->full, &priv->lock);
+        } else {
+            err = pthread_cond_timedwait(&priv->full, &priv->lock, &deadline);
+        }
+    }
+    if (buf != NULL) {
+        buf->state = SPI_SAMPLER_TAKEN;
+        buffer->data = buf->data;
+        buffer->count = priv->params.count;
+        buffer->seqno = buf->seqno;
+        buffer->timestamp_ns = buf->timestamp_ns;
+        buffer->index = buf - priv->bufs;
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return (buf != NULL) ? MCUPR_RES_OK : MCUPR_RES_TIMEOUT;
+}
+
+void mcupr_spi_sampler_put(mcupr_spi_sampler_t *sampler, mcupr_spi_sampler_buffer_t *buffer)
+{
+    if (sampler == NULL || sampler->data == NULL || buffer == NULL) {
+        return;
+    }
+    struct spi_sampler_data *priv = (struct spi_sampler_data *)sampler->data;
+
+    pthread_mutex_lock(&priv->lock);
+    if (0 <= buffer->index && (uint32_t)buffer->index < priv->params.nbuffers &&
+        priv->bufs[buffer->index].state == SPI_SAMPLER_TAKEN) {
+        priv->bufs[buffer->index].state = SPI_SAMPLER_FREE;
+    }
+    buffer->data = NULL;
+    buffer->index = -1;
+    pthread_mutex_unlock(&priv->lock);
+}
+
+mcupr_result_t mcupr_spi_sampler_get_stats(mcupr_spi_sampler_t *sampler,
+                                           mcupr_spi_sampler_stats_t *stats)
+{
+    if (sampler == NULL || sampler->data == NULL) {
+        return MCUPR_RES_INVALID_OBJ;
+    }
+    struct spi_sampler_data *priv = (struct spi_sampler_data *)sampler->data;
+
+    pthread_mutex_lock(&priv->lock);
+    *stats = priv->stats;
+    stats->missed = __atomic_load_n(&priv->stats.missed, __ATOMIC_RELAXED);
+    if (0 < priv->batches) {
+        stats->avg_jitter_ns = priv->jitter_sum / priv->batches;
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return MCUPR_RES_OK;
+}
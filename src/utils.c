@@ -24,6 +24,9 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "utils.h"
 #include <mcu_peripheral/mcu_peripheral.h>
 #include <mcu_peripheral/log.h>
@@ -64,6 +67,188 @@ void mcupr_release_object(void *objp)
     int size = MCUPR_ALIGN(sizeof(mcupr_object_t), sizeof(void*));
     mcupr_object_t *obj = (mcupr_object_t *)((uint8_t*)objp - size);
 
-    memset(objp, 0, obj->size);
+    memset(obj, 0, obj->size);
     free(obj);
 }
+
+mcupr_result_t mcupr_ring_init(mcupr_ring_t *ring, uint32_t elem_size, uint32_t count)
+{
+    uint32_t n = 1;
+
+    while (n < count) {
+        n <<= 1;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->buf = calloc(n, elem_size);
+    if (ring->buf == NULL) {
+        MCUPR_ERR("%s: memory allocation failed", __func__);
+        return MCUPR_RES_NOMEM;
+    }
+    ring->elem_size = elem_size;
+    ring->mask = n - 1;
+
+    return MCUPR_RES_OK;
+}
+
+void mcupr_ring_free(mcupr_ring_t *ring)
+{
+    free(ring->buf);
+    memset(ring, 0, sizeof(*ring));
+}
+
+/* Copy n elements into the ring from the producer thread, returns the number stored */
+int mcupr_ring_push(mcupr_ring_t *ring, const void *elems, int n)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t room = ring->mask + 1 - (head - tail);
+    uint32_t count = ((uint32_t)n < room) ? (uint32_t)n : room;
+    uint32_t pos = head & ring->mask;
+    uint32_t first = ring->mask + 1 - pos;
+
+    if (first > count) {
+        first = count;
+    }
+    memcpy(&ring->buf[pos * ring->elem_size], elems, first * ring->elem_size);
+    memcpy(ring->buf, (const uint8_t *)elems + first * ring->elem_size,
+           (count - first) * ring->elem_size);
+    __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+    if (count < (uint32_t)n) {
+        __atomic_add_fetch(&ring->dropped, n - count, __ATOMIC_RELAXED);
+    }
+
+    return count;
+}
+
+/* Copy up to max elements out of the ring from the consumer thread, returns the number copied */
+int mcupr_ring_pop(mcupr_ring_t *ring, void *elems, int max)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t count = head - tail;
+    uint32_t pos = tail & ring->mask;
+    uint32_t first = ring->mask + 1 - pos;
+
+    if ((uint32_t)max < count) {
+        count = max;
+    }
+    if (first > count) {
+        first = count;
+    }
+    memcpy(elems, &ring->buf[pos * ring->elem_size], first * ring->elem_size);
+    memcpy((uint8_t *)elems + first * ring->elem_size, ring->buf,
+           (count - first) * ring->elem_size);
+    __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+/* Return the number of elements dropped since the last call */
+uint32_t mcupr_ring_take_dropped(mcupr_ring_t *ring)
+{
+    return __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+}
+
+#define MCUPR_LOCK_SPIN 100
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MCUPR_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || (defined(__ARM_ARCH) && 7 <= __ARM_ARCH)
+#define MCUPR_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define MCUPR_CPU_RELAX() do { } while (0)
+#endif
+
+/* the address of this variable identifies the calling thread without a syscall */
+static __thread char mcupr_lock_self;
+
+static void mcupr_futex_wait(uint32_t *addr, uint32_t val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void mcupr_futex_wake(uint32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+void mcupr_lock_acquire(mcupr_lock_t *lock)
+{
+    uintptr_t self = (uintptr_t)&mcupr_lock_self;
+    uint32_t c = 0;
+    int i;
+
+    if (__atomic_load_n(&lock->owner, __ATOMIC_RELAXED) == self) {
+        lock->depth++;
+        return;
+    }
+    if (!__atomic_compare_exchange_n(&lock->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        for (i = 0; i < MCUPR_LOCK_SPIN; i++) {
+            c = 0;
+            if (__atomic_compare_exchange_n(&lock->state, &c, 1, 0, __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED)) {
+                goto locked;
+            }
+            MCUPR_CPU_RELAX();
+        }
+        /* mark the lock contended and sleep until the owner wakes us */
+        if (c != 2) {
+            c = __atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE);
+        }
+        while (c != 0) {
+            mcupr_futex_wait(&lock->state, 2);
+            c = __atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE);
+        }
+    }
+ locked:
+    __atomic_store_n(&lock->owner, self, __ATOMIC_RELAXED);
+    lock->depth = 1;
+}
+
+void mcupr_lock_release(mcupr_lock_t *lock)
+{
+    if (0 < --lock->depth) {
+        return;
+    }
+    __atomic_store_n(&lock->owner, 0, __ATOMIC_RELAXED);
+    if (__atomic_exchange_n(&lock->state, 0, __ATOMIC_RELEASE) == 2) {
+        mcupr_futex_wake(&lock->state);
+    }
+}
+
+/*
+ * Byte swap with the vector extension of the compiler, which turns the lane-wise shifts into
+ * SSE2 or NEON instructions, 16 bytes per iteration. The tail is swapped word by word.
+ */
+typedef uint16_t mcupr_v8u16 __attribute__((vector_size(16)));
+typedef uint32_t mcupr_v4u32 __attribute__((vector_size(16)));
+
+void mcupr_swap16(uint16_t *dst, const uint16_t *src, uint32_t n)
+{
+    mcupr_v8u16 v;
+    uint32_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        memcpy(&v, &src[i], sizeof(v));
+        v = (v << 8) | (v >> 8);
+        memcpy(&dst[i], &v, sizeof(v));
+    }
+    for (; i < n; i++) {
+        dst[i] = __builtin_bswap16(src[i]);
+    }
+}
+
+void mcupr_swap32(uint32_t *dst, const uint32_t *src, uint32_t n)
+{
+    mcupr_v4u32 v;
+    uint32_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        memcpy(&v, &src[i], sizeof(v));
+        v = (v << 24) | ((v << 8) & 0x00ff0000) | ((v >> 8) & 0x0000ff00) | (v >> 24);
+        memcpy(&dst[i], &v, sizeof(v));
+    }
+    for (; i < n; i++) {
+        dst[i] = __builtin_bswap32(src[i]);
+    }
+}
@@ -34,11 +34,43 @@ extern "C" {
 #define MCUPR_ALIGN(x, n) (((x) + ((n) - 1)) & ~((n) - 1))
 #define MCUPR_ALLOC_OBJECT(obj, obj_type, data, data_type) \
 	mcupr_alloc_object((void**)&(obj), sizeof(obj_type), \
-			   offsetof(data_type, data), sizeof(data_type))
+			   offsetof(obj_type, data), sizeof(data_type))
 
 mcupr_result_t mcupr_alloc_object(void **obj0, int size0, int offset, int size1);
 void mcupr_release_object(void *obj);
 
+/*
+ * Lock-free ring buffer for one producer thread and one consumer thread.
+ * Elements which don't fit are dropped and counted.
+ */
+typedef struct mcupr_ring_s {
+    uint8_t *buf;
+    uint32_t elem_size;
+    uint32_t mask;      /* number of elements - 1, the number of elements is a power of two */
+    uint32_t head;      /* written by the producer only */
+    uint32_t tail;      /* written by the consumer only */
+    uint32_t dropped;
+} mcupr_ring_t;
+
+mcupr_result_t mcupr_ring_init(mcupr_ring_t *ring, uint32_t elem_size, uint32_t count);
+void mcupr_ring_free(mcupr_ring_t *ring);
+int mcupr_ring_push(mcupr_ring_t *ring, const void *elems, int n);
+int mcupr_ring_pop(mcupr_ring_t *ring, void *elems, int max);
+uint32_t mcupr_ring_take_dropped(mcupr_ring_t *ring);
+
+/*
+ * Recursive lock on a futex. Taking a free lock is one atomic operation, a contended one spins
+ * briefly before sleeping in the kernel.
+ */
+void mcupr_lock_acquire(mcupr_lock_t *lock);
+void mcupr_lock_release(mcupr_lock_t *lock);
+
+/*
+ * Byte swap of n 16-bit or 32-bit words from src to dst, which may be the same buffer.
+ */
+void mcupr_swap16(uint16_t *dst, const uint16_t *src, uint32_t n);
+void mcupr_swap32(uint32_t *dst, const uint32_t *src, uint32_t n);
+
 #ifdef __cplusplus
 }
 #endif